@@ -0,0 +1,137 @@
+#ifndef BUGME_APU_HH
+#define BUGME_APU_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "savestate.hh"
+#include "types.hh"
+
+namespace bugme {
+
+class BlipBuffer;
+
+/**
+ * The audio processing unit: two square channels (the first with a frequency
+ * sweep), a wave channel and a noise channel, with a 512 Hz frame sequencer
+ * clocking their lengths, envelopes and sweep.
+ *
+ * The APU is never ticked. It catches up with the machine's cycle counter
+ * only when it must: when a sound register is written, or NR52 is read, or
+ * samples are read. While catching up, every change in a channel's output is
+ * added as a step to a pair of band-limited buffers (left and right) at the
+ * host sample rate, so the cost is per edge of the waveforms rather than per
+ * cycle.
+ *
+ * Output is disabled by default. Catching up then only runs the frame
+ * sequencer, which is all the registers depend on, so a headless machine
+ * pays next to nothing for sound.
+ *
+ * \see BlipBuffer
+ */
+class Apu : public Noncopyable {
+ public:
+  /** \param cycles The machine's T-cycle counter. */
+  explicit Apu(const std::uint64_t &cycles);
+  ~Apu();
+
+  /** \param addr An address within 0xFF10-0xFF3F. */
+  byte_t read(word_t addr);
+  void write(word_t addr, byte_t byte);
+
+  /**
+   * Enables output at sample_rate samples per second, or disables it if
+   * sample_rate is 0.
+   */
+  void set_sample_rate(unsigned int sample_rate);
+
+  /**
+   * Scales the rate at which enabled output is produced, e.g. by 1.005 for
+   * 0.5% more samples per emulated second. Small adjustments are inaudible,
+   * and let a frontend keep its audio buffer from draining or filling.
+   */
+  void set_rate_adjustment(double ratio);
+
+  /**
+   * Emulates sound up to the current cycle, and reads the samples produced.
+   *
+   * \param out Where to write interleaved left and right samples.
+   * \param frames The most sample frames (pairs) to read.
+   * \return The number of sample frames read.
+   */
+  std::size_t read_samples(std::int16_t *out, std::size_t frames);
+
+  /**
+   * Marks the frames emulated from here on as speculative, i.e. to be undone
+   * by loading the state they started from, as run-ahead does. They produce
+   * no sound, and that load carries the output on from where it stopped
+   * rather than starting it afresh.
+   */
+  void set_speculative(bool speculative);
+
+  void save_state(ApuState &state) const;
+  /**
+   * Restores a saved state. Output already produced is dropped, since it
+   * belongs to a different timeline, unless the machine is speculating.
+   */
+  void load_state(const ApuState &state);
+
+ private:
+  struct Channel {
+    bool enabled = false;
+    bool dac = false;
+    bool length_enabled = false;
+    byte_t volume = 0;
+    byte_t envelope_timer = 0;
+    /** Step within the duty cycle, or sample within wave RAM. */
+    byte_t position = 0;
+    word_t length = 0;
+    std::uint64_t next_tick = 0;
+    /** Current contributions to the left and right mix. */
+    int left = 0;
+    int right = 0;
+  };
+
+  void catch_up_();
+  void run_channels_(std::uint64_t end);
+  void step_sequencer_();
+  void clock_sweep_();
+  void trigger_(unsigned int channel);
+  void power_off_();
+  void reset_output_();
+  void update_output_(unsigned int channel, std::uint64_t time);
+  byte_t level_(unsigned int channel) const;
+  std::uint64_t period_(unsigned int channel) const;
+  word_t frequency_(unsigned int channel) const;
+  unsigned int sweep_frequency_() const;
+  byte_t &reg_(word_t addr) { return registers_[addr - 0xFF10]; }
+  byte_t reg_(word_t addr) const { return registers_[addr - 0xFF10]; }
+
+  const std::uint64_t &cycles_;
+  /** The T-cycle sound has been emulated up to. */
+  std::uint64_t time_ = 0;
+  std::uint64_t next_sequencer_step_ = 0;
+  byte_t sequencer_step_ = 0;
+  bool powered_ = false;
+
+  byte_t registers_[0x30] = {};
+  Channel channels_[4];
+
+  bool sweep_enabled_ = false;
+  byte_t sweep_timer_ = 0;
+  word_t shadow_frequency_ = 0;
+  word_t lfsr_ = 0x7FFF;
+
+  unsigned int sample_rate_ = 0;
+  double rate_adjustment_ = 1.0;
+  bool speculative_ = false;
+  std::unique_ptr<BlipBuffer> left_;
+  std::unique_ptr<BlipBuffer> right_;
+  /** The T-cycle at which the buffers' current frame started. */
+  std::uint64_t frame_start_ = 0;
+};
+
+}  // namespace bugme
+
+#endif
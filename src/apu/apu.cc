@@ -0,0 +1,476 @@
+#include "apu.hh"
+
+#include <algorithm>
+
+#include "blip_buffer.hh"
+#include "mmap.hh"
+
+namespace bugme {
+
+namespace {
+inline const double CLOCK_RATE = 4194304.0;
+
+/** T-cycles between steps of the 512 Hz frame sequencer. */
+inline const std::uint64_t SEQUENCER_PERIOD = 8192;
+
+/**
+ * Output amplitude per unit of channel level and master volume. Four
+ * channels at level 15 and volume 8 come to 30720, just inside 16 bits.
+ */
+inline const int SCALE = 64;
+
+/** Square waveforms, one bit per step, first step in the high bit. */
+inline const byte_t DUTY_CYCLES[4] = {0b00000001, 0b10000001, 0b10000111,
+                                      0b01111110};
+
+/** Bits of 0xFF10-0xFF26 which always read as 1. */
+inline const byte_t READ_MASKS[0x17] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF,  // NR10-NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,  // NR20-NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,  // NR30-NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,  // NR40-NR44
+    0x00, 0x00, 0x70,              // NR50-NR52
+};
+
+/** \return The address of a channel's first register (NRx0). */
+word_t channel_base(unsigned int channel) {
+  return static_cast<word_t>(mmap::apu::START + 5 * channel);
+}
+}  // namespace
+
+Apu::Apu(const std::uint64_t &cycles)
+    : cycles_(cycles), time_(cycles), frame_start_(cycles) {}
+
+Apu::~Apu() = default;
+
+byte_t Apu::read(word_t addr) {
+  if (addr == mmap::apu::NR52) {
+    catch_up_();
+    byte_t status = powered_ ? 0xF0 : 0x70;
+    for (unsigned int channel = 0; channel < 4; ++channel) {
+      if (channels_[channel].enabled) {
+        status |= static_cast<byte_t>(1 << channel);
+      }
+    }
+    return status;
+  }
+
+  if (addr >= mmap::apu::WAVE_RAM_START) {
+    return reg_(addr);
+  }
+  if (addr > mmap::apu::NR51) {
+    return 0xFF;
+  }
+  return reg_(addr) | READ_MASKS[addr - mmap::apu::START];
+}
+
+void Apu::write(word_t addr, byte_t byte) {
+  catch_up_();
+
+  if (addr >= mmap::apu::WAVE_RAM_START) {
+    reg_(addr) = byte;
+    return;
+  }
+
+  if (addr == mmap::apu::NR52) {
+    if (powered_ && !(byte & 0x80)) {
+      power_off_();
+    } else if (!powered_ && (byte & 0x80)) {
+      powered_ = true;
+      sequencer_step_ = 0;
+      next_sequencer_step_ = time_ + SEQUENCER_PERIOD;
+    }
+    return;
+  }
+
+  if (!powered_ || addr > mmap::apu::NR51) {
+    return;
+  }
+  reg_(addr) = byte;
+
+  if (addr >= mmap::apu::NR50) {
+    for (unsigned int channel = 0; channel < 4; ++channel) {
+      update_output_(channel, time_);
+    }
+    return;
+  }
+
+  unsigned int channel = (addr - mmap::apu::START) / 5;
+  Channel &c = channels_[channel];
+  switch ((addr - mmap::apu::START) % 5) {
+    case 0:
+      if (channel == 2) {
+        c.dac = byte & 0x80;
+        c.enabled = c.enabled && c.dac;
+      }
+      break;
+    case 1:
+      c.length = static_cast<word_t>(channel == 2 ? 256 - byte
+                                                  : 64 - (byte & 0x3F));
+      break;
+    case 2:
+      if (channel != 2) {
+        c.dac = byte & 0xF8;
+        c.enabled = c.enabled && c.dac;
+      }
+      break;
+    case 4:
+      c.length_enabled = byte & 0x40;
+      if (byte & 0x80) {
+        trigger_(channel);
+      }
+      break;
+  }
+  update_output_(channel, time_);
+}
+
+void Apu::set_sample_rate(unsigned int sample_rate) {
+  catch_up_();
+  sample_rate_ = sample_rate;
+  if (sample_rate == 0) {
+    left_.reset();
+    right_.reset();
+    return;
+  }
+
+  // A tenth of a second is far more than a frame's worth of samples.
+  double rate = sample_rate * rate_adjustment_;
+  left_ = std::make_unique<BlipBuffer>(CLOCK_RATE, rate, sample_rate / 10);
+  right_ = std::make_unique<BlipBuffer>(CLOCK_RATE, rate, sample_rate / 10);
+  reset_output_();
+}
+
+void Apu::set_rate_adjustment(double ratio) {
+  rate_adjustment_ = ratio;
+  if (left_) {
+    // The new ratio applies from the start of the buffers' current frame, so
+    // catch up and close that frame first.
+    catch_up_();
+    left_->end_frame(time_ - frame_start_);
+    right_->end_frame(time_ - frame_start_);
+    frame_start_ = time_;
+    left_->set_rates(CLOCK_RATE, sample_rate_ * ratio);
+    right_->set_rates(CLOCK_RATE, sample_rate_ * ratio);
+  }
+}
+
+std::size_t Apu::read_samples(std::int16_t *out, std::size_t frames) {
+  if (!left_) {
+    return 0;
+  }
+
+  catch_up_();
+  left_->end_frame(time_ - frame_start_);
+  right_->end_frame(time_ - frame_start_);
+  frame_start_ = time_;
+
+  frames = left_->read_samples(out, frames, 2);
+  right_->read_samples(out + 1, frames, 2);
+  return frames;
+}
+
+void Apu::set_speculative(bool speculative) {
+  if (speculative) {
+    // Sound up to here is real. Catching up also puts it in any state saved
+    // next, which is what the buffers will carry on from.
+    catch_up_();
+  }
+  speculative_ = speculative;
+}
+
+void Apu::save_state(ApuState &state) const {
+  std::copy(std::begin(registers_), std::end(registers_), state.registers);
+  for (unsigned int channel = 0; channel < 4; ++channel) {
+    const Channel &c = channels_[channel];
+    ApuChannelState &s = state.channels[channel];
+    s.enabled = c.enabled;
+    s.dac = c.dac;
+    s.length_enabled = c.length_enabled;
+    s.volume = c.volume;
+    s.envelope_timer = c.envelope_timer;
+    s.position = c.position;
+    s.length = c.length;
+    s.next_tick = c.next_tick;
+  }
+  state.powered = powered_;
+  state.sequencer_step = sequencer_step_;
+  state.sweep_enabled = sweep_enabled_;
+  state.sweep_timer = sweep_timer_;
+  state.shadow_frequency = shadow_frequency_;
+  state.lfsr = lfsr_;
+  state.time = time_;
+  state.next_sequencer_step = next_sequencer_step_;
+}
+
+void Apu::load_state(const ApuState &state) {
+  std::copy(std::begin(state.registers), std::end(state.registers),
+            registers_);
+  for (unsigned int channel = 0; channel < 4; ++channel) {
+    Channel &c = channels_[channel];
+    const ApuChannelState &s = state.channels[channel];
+    c.enabled = s.enabled;
+    c.dac = s.dac;
+    c.length_enabled = s.length_enabled;
+    c.volume = s.volume;
+    c.envelope_timer = s.envelope_timer;
+    c.position = s.position;
+    c.length = s.length;
+    c.next_tick = s.next_tick;
+  }
+  powered_ = state.powered;
+  sequencer_step_ = state.sequencer_step;
+  sweep_enabled_ = state.sweep_enabled;
+  sweep_timer_ = state.sweep_timer;
+  shadow_frequency_ = state.shadow_frequency;
+  lfsr_ = state.lfsr;
+  time_ = state.time;
+  next_sequencer_step_ = state.next_sequencer_step;
+
+  // Speculative frames left the buffers and each channel's contribution to
+  // them as they were in the state now loaded, so output carries on.
+  if (left_ && !speculative_) {
+    left_->clear();
+    right_->clear();
+    reset_output_();
+  }
+}
+
+void Apu::catch_up_() {
+  std::uint64_t now = cycles_;
+  while (time_ < now) {
+    std::uint64_t end = powered_ ? std::min(now, next_sequencer_step_) : now;
+    if (left_ && !speculative_) {
+      run_channels_(end);
+    }
+    time_ = end;
+
+    if (powered_ && time_ == next_sequencer_step_) {
+      step_sequencer_();
+      next_sequencer_step_ += SEQUENCER_PERIOD;
+    }
+  }
+}
+
+void Apu::run_channels_(std::uint64_t end) {
+  for (unsigned int channel = 0; channel < 4; ++channel) {
+    Channel &c = channels_[channel];
+    if (!c.enabled) {
+      continue;
+    }
+
+    // The waveform is not kept running while output is disabled.
+    c.next_tick = std::max(c.next_tick, time_);
+    std::uint64_t period = period_(channel);
+    while (c.next_tick <= end) {
+      switch (channel) {
+        case 0:
+        case 1:
+          c.position = (c.position + 1) & 7;
+          break;
+        case 2:
+          c.position = (c.position + 1) & 31;
+          break;
+        case 3: {
+          word_t bit = (lfsr_ ^ (lfsr_ >> 1)) & 1;
+          lfsr_ = static_cast<word_t>((lfsr_ >> 1) | (bit << 14));
+          if (reg_(mmap::apu::NR43) & 0x08) {
+            lfsr_ = static_cast<word_t>((lfsr_ & ~0x40) | (bit << 6));
+          }
+          break;
+        }
+      }
+      update_output_(channel, c.next_tick);
+      c.next_tick += period;
+    }
+  }
+}
+
+void Apu::step_sequencer_() {
+  if ((sequencer_step_ & 1) == 0) {
+    for (unsigned int channel = 0; channel < 4; ++channel) {
+      Channel &c = channels_[channel];
+      if (c.length_enabled && c.length > 0 && --c.length == 0) {
+        c.enabled = false;
+        update_output_(channel, time_);
+      }
+    }
+  }
+
+  if (sequencer_step_ == 2 || sequencer_step_ == 6) {
+    clock_sweep_();
+  }
+
+  if (sequencer_step_ == 7) {
+    for (unsigned int channel : {0u, 1u, 3u}) {
+      Channel &c = channels_[channel];
+      byte_t envelope = reg_(channel_base(channel) + 2);
+      byte_t period = envelope & 0x07;
+      if (period == 0 || (c.envelope_timer > 0 && --c.envelope_timer > 0)) {
+        continue;
+      }
+      c.envelope_timer = period;
+      if ((envelope & 0x08) && c.volume < 15) {
+        ++c.volume;
+      } else if (!(envelope & 0x08) && c.volume > 0) {
+        --c.volume;
+      }
+      update_output_(channel, time_);
+    }
+  }
+
+  sequencer_step_ = (sequencer_step_ + 1) & 7;
+}
+
+void Apu::clock_sweep_() {
+  byte_t sweep = reg_(mmap::apu::NR10);
+  byte_t period = (sweep >> 4) & 0x07;
+  if (sweep_timer_ > 0 && --sweep_timer_ > 0) {
+    return;
+  }
+  sweep_timer_ = period ? period : 8;
+  if (!sweep_enabled_ || period == 0) {
+    return;
+  }
+
+  unsigned int frequency = sweep_frequency_();
+  if (frequency <= 2047 && (sweep & 0x07)) {
+    shadow_frequency_ = static_cast<word_t>(frequency);
+    reg_(mmap::apu::NR13) = frequency & 0xFF;
+    reg_(mmap::apu::NR14) =
+        static_cast<byte_t>((reg_(mmap::apu::NR14) & ~0x07) | (frequency >> 8));
+    frequency = sweep_frequency_();
+  }
+  if (frequency > 2047) {
+    channels_[0].enabled = false;
+    update_output_(0, time_);
+  }
+}
+
+void Apu::trigger_(unsigned int channel) {
+  Channel &c = channels_[channel];
+  c.enabled = c.dac;
+  if (c.length == 0) {
+    c.length = channel == 2 ? 256 : 64;
+  }
+  c.next_tick = time_ + period_(channel);
+
+  if (channel == 2) {
+    c.position = 0;
+  } else {
+    byte_t envelope = reg_(channel_base(channel) + 2);
+    c.volume = envelope >> 4;
+    c.envelope_timer = envelope & 0x07;
+  }
+
+  if (channel == 3) {
+    lfsr_ = 0x7FFF;
+  }
+
+  if (channel == 0) {
+    byte_t sweep = reg_(mmap::apu::NR10);
+    byte_t period = (sweep >> 4) & 0x07;
+    shadow_frequency_ = frequency_(0);
+    sweep_timer_ = period ? period : 8;
+    sweep_enabled_ = period || (sweep & 0x07);
+    if ((sweep & 0x07) && sweep_frequency_() > 2047) {
+      c.enabled = false;
+    }
+  }
+}
+
+void Apu::power_off_() {
+  std::fill(std::begin(registers_),
+            std::begin(registers_) + (mmap::apu::NR52 - mmap::apu::START), 0);
+  for (unsigned int channel = 0; channel < 4; ++channel) {
+    Channel &c = channels_[channel];
+    c.enabled = false;
+    update_output_(channel, time_);
+    c = Channel{.left = c.left, .right = c.right};
+  }
+  powered_ = false;
+}
+
+void Apu::reset_output_() {
+  frame_start_ = time_;
+  for (unsigned int channel = 0; channel < 4; ++channel) {
+    channels_[channel].left = 0;
+    channels_[channel].right = 0;
+    update_output_(channel, time_);
+  }
+}
+
+void Apu::update_output_(unsigned int channel, std::uint64_t time) {
+  if (!left_ || speculative_) {
+    return;
+  }
+
+  Channel &c = channels_[channel];
+  int level = level_(channel);
+  byte_t volume = reg_(mmap::apu::NR50);
+  byte_t panning = reg_(mmap::apu::NR51);
+  int left = (panning >> (4 + channel)) & 1
+                 ? level * (((volume >> 4) & 0x07) + 1) * SCALE
+                 : 0;
+  int right =
+      (panning >> channel) & 1 ? level * ((volume & 0x07) + 1) * SCALE : 0;
+
+  if (left != c.left) {
+    left_->add_delta(time - frame_start_, left - c.left);
+    c.left = left;
+  }
+  if (right != c.right) {
+    right_->add_delta(time - frame_start_, right - c.right);
+    c.right = right;
+  }
+}
+
+byte_t Apu::level_(unsigned int channel) const {
+  const Channel &c = channels_[channel];
+  if (!c.enabled || !c.dac) {
+    return 0;
+  }
+
+  switch (channel) {
+    case 0:
+    case 1: {
+      byte_t duty = reg_(channel_base(channel) + 1) >> 6;
+      return ((DUTY_CYCLES[duty] >> (7 - c.position)) & 1) ? c.volume : 0;
+    }
+    case 2: {
+      byte_t samples = reg_(mmap::apu::WAVE_RAM_START + c.position / 2);
+      byte_t sample = (c.position & 1) ? (samples & 0x0F) : (samples >> 4);
+      byte_t shift = (reg_(mmap::apu::NR32) >> 5) & 0x03;
+      return shift == 0 ? 0 : static_cast<byte_t>(sample >> (shift - 1));
+    }
+    default:
+      return (lfsr_ & 1) ? 0 : c.volume;
+  }
+}
+
+std::uint64_t Apu::period_(unsigned int channel) const {
+  switch (channel) {
+    case 0:
+    case 1:
+      return (2048 - frequency_(channel)) * 4;
+    case 2:
+      return (2048 - frequency_(channel)) * 2;
+    default: {
+      byte_t noise = reg_(mmap::apu::NR43);
+      std::uint64_t divisor = (noise & 0x07) ? (noise & 0x07) * 16 : 8;
+      return divisor << (noise >> 4);
+    }
+  }
+}
+
+word_t Apu::frequency_(unsigned int channel) const {
+  word_t base = channel_base(channel);
+  return static_cast<word_t>(reg_(base + 3) | ((reg_(base + 4) & 0x07) << 8));
+}
+
+unsigned int Apu::sweep_frequency_() const {
+  byte_t sweep = reg_(mmap::apu::NR10);
+  unsigned int delta = shadow_frequency_ >> (sweep & 0x07);
+  return (sweep & 0x08) ? shadow_frequency_ - delta : shadow_frequency_ + delta;
+}
+
+}  // namespace bugme
@@ -0,0 +1,75 @@
+#ifndef BUGME_AUDIO_RING_HH
+#define BUGME_AUDIO_RING_HH
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "types.hh"
+
+namespace bugme {
+
+/**
+ * A lock-free queue of audio samples between exactly one producer (the
+ * emulator) and one consumer (the audio callback).
+ *
+ * Neither side ever blocks or allocates: push() drops what does not fit, and
+ * pop() returns what there is. Each side only writes its own index, which the
+ * other reads with acquire semantics, so samples are always visible before
+ * the index that publishes them.
+ */
+class AudioRing : public Noncopyable {
+ public:
+  /** \param capacity The most samples held at once; rounded up to a power of 2. */
+  explicit AudioRing(std::size_t capacity) {
+    std::size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    samples_.resize(size);
+  }
+
+  /** \return The number of samples pushed. Called by the producer only. */
+  std::size_t push(const std::int16_t *samples, std::size_t count) {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+    std::size_t head = head_.load(std::memory_order_acquire);
+    count = std::min(count, samples_.size() - (tail - head));
+    for (std::size_t i = 0; i < count; ++i) {
+      samples_[(tail + i) & (samples_.size() - 1)] = samples[i];
+    }
+    tail_.store(tail + count, std::memory_order_release);
+    return count;
+  }
+
+  /** \return The number of samples popped. Called by the consumer only. */
+  std::size_t pop(std::int16_t *samples, std::size_t count) {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    std::size_t tail = tail_.load(std::memory_order_acquire);
+    count = std::min(count, tail - head);
+    for (std::size_t i = 0; i < count; ++i) {
+      samples[i] = samples_[(head + i) & (samples_.size() - 1)];
+    }
+    head_.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  /** \return The number of samples queued, as of some recent moment. */
+  std::size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  std::size_t capacity() const { return samples_.size(); }
+
+ private:
+  std::vector<std::int16_t> samples_;
+  /** Free-running counts of samples popped and pushed. */
+  alignas(64) std::atomic<std::size_t> head_ = 0;
+  alignas(64) std::atomic<std::size_t> tail_ = 0;
+};
+
+}  // namespace bugme
+
+#endif
@@ -0,0 +1,212 @@
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "color.hh"
+#include "log.hh"
+#include "machine.hh"
+#include "rtc.hh"
+#include "thread_pool.hh"
+#include "util.hh"
+
+namespace bugme {
+
+namespace {
+
+struct BatchOptions {
+  std::vector<std::string> rom_filenames;
+  unsigned int instances = 1;  // per ROM
+  unsigned int frames = 3600;  // per instance
+  unsigned int quantum = 1;    // frames per task
+  unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+  RtcClock rtc_clock = RtcClock::Emulated;
+  LogLevel log_level = LogLevel::Error;
+};
+
+/**
+ * One machine and everything belonging to it. Instances share nothing
+ * mutable, so any worker may advance any instance, as long as only one does
+ * at a time.
+ */
+struct Instance {
+  std::string name;
+  Logger logger;
+  std::unique_ptr<Machine> machine;
+  unsigned int frames_left = 0;
+  std::uint64_t frame_hash = 0;
+};
+
+/** Per-worker totals, each only ever written by its own worker. */
+struct alignas(64) WorkerStats {
+  std::uint64_t frames = 0;
+  std::uint64_t cpu_ns = 0;
+};
+
+std::uint64_t thread_cpu_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000 +
+         static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
+/**
+ * Advances an instance by one quantum, then queues its next quantum. Since
+ * the pool runs a worker's own tasks first, an instance tends to stay on one
+ * core until the other workers run dry and steal it.
+ */
+void run_quantum(ThreadPool &pool, Instance &instance,
+                 const BatchOptions &options,
+                 std::vector<WorkerStats> &stats) {
+  ScopedLogger scoped_logger(instance.logger);
+  std::uint64_t start = thread_cpu_ns();
+
+  unsigned int frames = std::min(options.quantum, instance.frames_left);
+  for (unsigned int i = 0; i < frames; ++i) {
+    instance.machine->run_frame();
+  }
+  instance.frames_left -= frames;
+
+  WorkerStats &worker = stats[pool.worker_index()];
+  worker.frames += frames;
+  worker.cpu_ns += thread_cpu_ns() - start;
+
+  if (instance.frames_left > 0) {
+    pool.submit([&]() { run_quantum(pool, instance, options, stats); });
+    return;
+  }
+
+  const std::vector<Color> &frame = instance.machine->frame_buffer();
+  instance.frame_hash = util::fnv1a(
+      reinterpret_cast<const byte_t *>(frame.data()), frame.size());
+}
+
+BatchOptions get_batch_options(int argc, char **argv) {
+  if (argc < 2) {
+    log_error(
+        "usage: bugme-batch <rom_file>... [--instances n] [--frames n] "
+        "[--quantum n] [--threads n] [--rtc-clock host|emulated] "
+        "[--verbosity v]");
+    std::exit(2);
+  }
+
+  BatchOptions options;
+  std::vector<std::string> args(argv + 1, argv + argc);
+  for (unsigned int i = 0; i < args.size(); ++i) {
+    if (args[i] == "--instances" && i + 1 < args.size()) {
+      options.instances = std::max(1, std::atoi(args[++i].c_str()));
+    } else if (args[i] == "--frames" && i + 1 < args.size()) {
+      options.frames = std::max(1, std::atoi(args[++i].c_str()));
+    } else if (args[i] == "--quantum" && i + 1 < args.size()) {
+      options.quantum = std::max(1, std::atoi(args[++i].c_str()));
+    } else if (args[i] == "--threads" && i + 1 < args.size()) {
+      options.threads = std::max(1, std::atoi(args[++i].c_str()));
+    } else if (args[i] == "--rtc-clock" && i + 1 < args.size()) {
+      options.rtc_clock =
+          args[++i] == "host" ? RtcClock::Host : RtcClock::Emulated;
+    } else if (args[i] == "--verbosity" && i + 1 < args.size()) {
+      switch (std::atoi(args[++i].c_str())) {
+        case 1:
+          options.log_level = LogLevel::Warning;
+          break;
+        case 2:
+          options.log_level = LogLevel::Info;
+          break;
+        case 3:
+          options.log_level = LogLevel::Debug;
+          break;
+        default:
+          options.log_level = LogLevel::Error;
+      }
+    } else {
+      options.rom_filenames.push_back(args[i]);
+    }
+  }
+  return options;
+}
+
+}  // namespace
+
+int batch_main(int argc, char **argv) {
+  BatchOptions options = get_batch_options(argc, argv);
+  log_set_level(options.log_level);
+
+  std::vector<std::unique_ptr<Instance>> instances;
+  for (const std::string &filename : options.rom_filenames) {
+    std::vector<byte_t> rom;
+    if (!util::read_file(filename, rom)) {
+      log_error("[batch] cannot read rom %s", filename.c_str());
+      return 1;
+    }
+    auto shared_rom =
+        std::make_shared<const std::vector<byte_t>>(std::move(rom));
+
+    for (unsigned int i = 0; i < options.instances; ++i) {
+      auto instance = std::make_unique<Instance>();
+      instance->name = filename + "#" + std::to_string(i);
+      instance->logger = Logger("[" + instance->name + "]");
+      instance->logger.set_level(options.log_level);
+      instance->frames_left = options.frames;
+
+      // Instances of the same ROM must not share a save file, so cartridge
+      // RAM is kept in memory.
+      ScopedLogger scoped_logger(instance->logger);
+      instance->machine = std::make_unique<Machine>(shared_rom, std::string(),
+                                                    options.rtc_clock);
+      instances.push_back(std::move(instance));
+    }
+  }
+
+  std::vector<WorkerStats> stats;
+  auto start = std::chrono::steady_clock::now();
+  {
+    ThreadPool pool(options.threads);
+    stats.resize(pool.size());
+    for (std::unique_ptr<Instance> &instance : instances) {
+      Instance &ref = *instance;
+      pool.submit([&]() { run_quantum(pool, ref, options, stats); });
+    }
+    pool.wait();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  for (const std::unique_ptr<Instance> &instance : instances) {
+    std::printf("%s: %u frames, frame hash %016llx\n", instance->name.c_str(),
+                options.frames,
+                static_cast<unsigned long long>(instance->frame_hash));
+  }
+
+  // A Gameboy shows 59.73 frames per second.
+  const double frames_per_second_realtime = 4194304.0 / 70224.0;
+  std::uint64_t total_frames = 0;
+  for (unsigned int i = 0; i < stats.size(); ++i) {
+    double cpu_seconds = static_cast<double>(stats[i].cpu_ns) / 1e9;
+    std::printf("worker %u: %llu frames in %.3fs cpu, %.1f frames/s\n", i,
+                static_cast<unsigned long long>(stats[i].frames), cpu_seconds,
+                cpu_seconds > 0 ? static_cast<double>(stats[i].frames) /
+                                      cpu_seconds
+                                : 0.0);
+    total_frames += stats[i].frames;
+  }
+
+  double frames_per_second =
+      static_cast<double>(total_frames) / elapsed.count();
+  std::printf(
+      "%zu instances x %u frames on %zu threads in %.3fs: %.1f frames/s "
+      "(%.1fx realtime), %.1f frames/s per thread\n",
+      instances.size(), options.frames, stats.size(), elapsed.count(),
+      frames_per_second, frames_per_second / frames_per_second_realtime,
+      frames_per_second / static_cast<double>(stats.size()));
+  return 0;
+}
+
+}  // namespace bugme
+
+int main(int argc, char **argv) { return bugme::batch_main(argc, argv); }
@@ -0,0 +1,205 @@
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cartridge.hh"
+#include "color.hh"
+#include "log.hh"
+#include "machine.hh"
+#include "movie.hh"
+#include "rtc.hh"
+#include "util.hh"
+
+namespace bugme {
+
+namespace {
+
+/** T-cycles per second, and per frame, of a Gameboy. */
+inline const double CLOCK_RATE = 4194304.0;
+inline const double CYCLES_PER_FRAME = 70224.0;
+
+struct BenchOptions {
+  std::vector<std::string> rom_filenames;
+  unsigned int frames = 3600;
+  /** Input movie replayed on every ROM, or empty to run without input. */
+  std::string input;
+  unsigned int runs = 1;
+  bool rendering = true;
+  RtcClock rtc_clock = RtcClock::Emulated;
+};
+
+struct RunResult {
+  std::uint64_t instructions = 0;
+  std::uint64_t cycles = 0;
+  double host_seconds = 0;
+  std::uint64_t frame_hash = 0;
+};
+
+std::string json_string(const std::string &s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+/** \return The process's peak resident set size, in kilobytes. */
+long peak_rss_kb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/**
+ * Runs a freshly powered on machine for the configured number of frames,
+ * timing only the emulation itself.
+ *
+ * \return false if the input movie does not belong to the ROM.
+ */
+bool run(const std::shared_ptr<const std::vector<byte_t>> &rom,
+         const BenchOptions &options, RunResult &result) {
+  Machine machine(rom, std::string(), options.rtc_clock);
+  machine.set_rendering(options.rendering);
+
+  std::unique_ptr<MovieReader> movie;
+  if (!options.input.empty()) {
+    movie = std::make_unique<MovieReader>(options.input);
+    if (!movie->good()) {
+      return false;
+    }
+    const MovieFileHeader &header = movie->header();
+    if (!machine.header().matches(header.title, header.global_checksum)) {
+      log_error("[bench] input %s belongs to another rom",
+                options.input.c_str());
+      return false;
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned int frame = 0; frame < options.frames; ++frame) {
+    // As when replaying in bugme, input is applied at frame boundaries.
+    if (movie) {
+      byte_t buttons;
+      while (movie->next(machine.cycles(), buttons)) {
+        machine.set_buttons(buttons);
+      }
+    }
+    machine.run_frame();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  result.host_seconds = elapsed.count();
+  result.cycles = machine.cycles();
+  result.instructions = machine.instructions();
+  const std::vector<Color> &frame = machine.frame_buffer();
+  result.frame_hash = util::fnv1a(
+      reinterpret_cast<const byte_t *>(frame.data()), frame.size());
+  return true;
+}
+
+void print_result(const std::string &rom_filename, const RunResult &result,
+                  unsigned int frames, bool last) {
+  double emulated_seconds = static_cast<double>(result.cycles) / CLOCK_RATE;
+  std::printf(
+      "    {\"rom\": %s, \"frames\": %u, \"emulated_seconds\": %.3f, "
+      "\"instructions\": %llu, \"host_seconds\": %.6f, \"speed\": %.3f, "
+      "\"instructions_per_second\": %.0f, \"frames_per_second\": %.1f, "
+      "\"frame_hash\": \"%016llx\"}%s\n",
+      json_string(rom_filename).c_str(), frames, emulated_seconds,
+      static_cast<unsigned long long>(result.instructions),
+      result.host_seconds, emulated_seconds / result.host_seconds,
+      static_cast<double>(result.instructions) / result.host_seconds,
+      static_cast<double>(frames) / result.host_seconds,
+      static_cast<unsigned long long>(result.frame_hash), last ? "" : ",");
+}
+
+BenchOptions get_bench_options(int argc, char **argv) {
+  if (argc < 2) {
+    log_error(
+        "usage: bugme-bench <rom_file>... [--frames n | --seconds s] "
+        "[--input movie] [--runs n] [--no-render] "
+        "[--rtc-clock host|emulated]");
+    std::exit(2);
+  }
+
+  BenchOptions options;
+  std::vector<std::string> args(argv + 1, argv + argc);
+  for (unsigned int i = 0; i < args.size(); ++i) {
+    if (args[i] == "--frames" && i + 1 < args.size()) {
+      options.frames = std::max(1, std::atoi(args[++i].c_str()));
+    } else if (args[i] == "--seconds" && i + 1 < args.size()) {
+      double seconds = std::max(0.0, std::atof(args[++i].c_str()));
+      options.frames = std::max(
+          1u, static_cast<unsigned int>(
+                  std::ceil(seconds * CLOCK_RATE / CYCLES_PER_FRAME)));
+    } else if (args[i] == "--input" && i + 1 < args.size()) {
+      options.input = args[++i];
+    } else if (args[i] == "--runs" && i + 1 < args.size()) {
+      options.runs = std::max(1, std::atoi(args[++i].c_str()));
+    } else if (args[i] == "--no-render") {
+      options.rendering = false;
+    } else if (args[i] == "--rtc-clock" && i + 1 < args.size()) {
+      options.rtc_clock =
+          args[++i] == "host" ? RtcClock::Host : RtcClock::Emulated;
+    } else {
+      options.rom_filenames.push_back(args[i]);
+    }
+  }
+  return options;
+}
+
+}  // namespace
+
+int bench_main(int argc, char **argv) {
+  // Only errors, on stderr, so that stdout is nothing but the report.
+  log_set_level(LogLevel::Error);
+  BenchOptions options = get_bench_options(argc, argv);
+
+  std::vector<std::pair<std::string, RunResult>> results;
+  for (const std::string &filename : options.rom_filenames) {
+    std::vector<byte_t> rom;
+    if (!util::read_file(filename, rom)) {
+      log_error("[bench] cannot read rom %s", filename.c_str());
+      return 1;
+    }
+    auto shared_rom =
+        std::make_shared<const std::vector<byte_t>>(std::move(rom));
+
+    for (unsigned int i = 0; i < options.runs; ++i) {
+      RunResult result;
+      if (!run(shared_rom, options, result)) {
+        return 1;
+      }
+      results.emplace_back(filename, result);
+    }
+  }
+
+  std::printf("{\n  \"results\": [\n");
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    print_result(results[i].first, results[i].second, options.frames,
+                 i + 1 == results.size());
+  }
+  std::printf("  ],\n  \"rendering\": %s,\n  \"peak_rss_kb\": %ld\n}\n",
+              options.rendering ? "true" : "false", peak_rss_kb());
+  return 0;
+}
+
+}  // namespace bugme
+
+int main(int argc, char **argv) { return bugme::bench_main(argc, argv); }
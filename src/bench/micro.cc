@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "apu.hh"
+#include "cartridge.hh"
+#include "color.hh"
+#include "constants.hh"
+#include "cpu.hh"
+#include "joypad.hh"
+#include "log.hh"
+#include "memory.hh"
+#include "ppu.hh"
+#include "rtc.hh"
+#include "sdl_display.hh"
+#include "serial.hh"
+#include "timer.hh"
+
+namespace bugme {
+
+namespace {
+
+/** Where operands and the stack live while opcodes are timed. */
+inline const word_t CODE_ADDR = 0xC000;
+inline const word_t DATA_ADDR = 0xC100;
+inline const word_t STACK_ADDR = 0xDFF0;
+
+struct MicroOptions {
+  /** Only kernels whose names contain this are run. */
+  std::string filter;
+  unsigned int repetitions = 7;
+};
+
+struct MicroResult {
+  std::string name;
+  std::uint64_t ops = 0;
+  double best_ns = 0;
+  double median_ns = 0;
+};
+
+struct OpcodeGroup {
+  const char *name;
+  bool cb;
+  /** Whether pc, sp and hl are put back before each opcode. */
+  bool reset;
+  std::vector<byte_t> opcodes;
+};
+
+std::vector<byte_t> range(unsigned int first, unsigned int last,
+                          std::function<bool(byte_t)> keep = nullptr) {
+  std::vector<byte_t> opcodes;
+  for (unsigned int op = first; op <= last; ++op) {
+    if (!keep || keep(static_cast<byte_t>(op))) {
+      opcodes.push_back(static_cast<byte_t>(op));
+    }
+  }
+  return opcodes;
+}
+
+/**
+ * The opcodes timed, by kind. HALT, STOP, DI, EI and the illegal opcodes are
+ * left out, since they change how the CPU runs rather than doing work.
+ */
+std::vector<OpcodeGroup> opcode_groups() {
+  auto is_hl = [](byte_t op) {
+    return (op & 0x07) == 6 || (op & 0xF8) == 0x70;
+  };
+  return {
+      {"ld r,r", false, false,
+       range(0x40, 0x7F, [&](byte_t op) { return !is_hl(op); })},
+      {"ld (hl)", false, true,
+       [&]() {
+         std::vector<byte_t> ops = range(
+             0x40, 0x7F, [&](byte_t op) { return is_hl(op) && op != 0x76; });
+         ops.insert(ops.end(), {0x22, 0x2A, 0x32, 0x3A, 0x36});
+         return ops;
+       }()},
+      {"ld r,d8/d16", false, true,
+       {0x06, 0x0E, 0x16, 0x1E, 0x26, 0x2E, 0x3E, 0x01, 0x11, 0x21, 0x31,
+        0x08, 0xF8, 0xF9}},
+      {"ld mem", false, true,
+       {0x02, 0x0A, 0x12, 0x1A, 0xE0, 0xF0, 0xE2, 0xF2, 0xEA, 0xFA}},
+      {"alu r", false, true, range(0x80, 0xBF)},
+      {"alu d8", false, true, {0xC6, 0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE}},
+      {"inc/dec", false, true,
+       {0x04, 0x05, 0x0C, 0x0D, 0x14, 0x15, 0x1C, 0x1D, 0x24, 0x25, 0x2C, 0x2D,
+        0x34, 0x35, 0x3C, 0x3D, 0x03, 0x0B, 0x13, 0x1B, 0x23, 0x2B, 0x33,
+        0x3B}},
+      {"add 16", false, true, {0x09, 0x19, 0x29, 0x39, 0xE8}},
+      {"rotate a/flags", false, false,
+       {0x07, 0x0F, 0x17, 0x1F, 0x27, 0x2F, 0x37, 0x3F}},
+      {"jumps", false, true,
+       {0x18, 0x20, 0x28, 0x30, 0x38, 0xC2, 0xC3, 0xCA, 0xD2, 0xDA, 0xE9}},
+      {"call/ret/rst", false, true,
+       {0xC4, 0xCC, 0xCD, 0xD4, 0xDC, 0xC0, 0xC8, 0xC9, 0xD0, 0xD8, 0xD9,
+        0xC7, 0xCF, 0xD7, 0xDF, 0xE7, 0xEF, 0xF7, 0xFF}},
+      {"push/pop", false, true,
+       {0xC5, 0xC1, 0xD5, 0xD1, 0xE5, 0xE1, 0xF5, 0xF1}},
+      {"cb rotate/shift", true, true, range(0x00, 0x3F)},
+      {"cb bit", true, true, range(0x40, 0x7F)},
+      {"cb res/set", true, true, range(0x80, 0xFF)},
+  };
+}
+
+/** A 32KB MBC1 ROM with 8KB of RAM and nothing to run. */
+std::shared_ptr<const std::vector<byte_t>> synthetic_rom() {
+  auto rom = std::make_shared<std::vector<byte_t>>(0x8000, 0x00);
+  (*rom)[0x0147] = 0x02;  // MBC1+RAM
+  (*rom)[0x0148] = 0x00;  // 32KB
+  (*rom)[0x0149] = 0x02;  // 8KB
+  for (std::size_t i = 0x0150; i < rom->size(); ++i) {
+    (*rom)[i] = static_cast<byte_t>(i * 7);
+  }
+  return rom;
+}
+
+}  // namespace
+
+/**
+ * Times the emulator's hot kernels in isolation: opcode handlers, bus reads
+ * and writes by region, PPU line renderers, OAM DMA and the frame conversion
+ * done before presenting. Complements bugme-bench, which times whole games
+ * and so cannot say which kernel a change made faster or slower.
+ *
+ * Kernels run on a machine assembled by hand, as Machine does, and reach
+ * into the components' internals; this class is their friend.
+ */
+class MicroBench {
+ public:
+  explicit MicroBench(const MicroOptions &options)
+      : options_(options),
+        cartridge_(synthetic_rom(), std::string(), RtcClock::Emulated,
+                   cycles_),
+        ppu_(memory_, interrupts_, discard_frame_),
+        timer_(interrupts_, cycles_),
+        joypad_(interrupts_),
+        serial_(interrupts_, cycles_),
+        apu_(cycles_),
+        cpu_(memory_, cartridge_, interrupts_, ppu_, timer_, joypad_, serial_,
+             apu_, cycles_) {
+    // Past the boot ROM, with cartridge RAM enabled.
+    cpu_.boot_rom_control.set(0x01);
+    cartridge_.write(0x0000, 0x0A);
+
+    // Operands: JR by 0, jumps and calls to DATA_ADDR + 0x100, and absolute
+    // loads and stores to DATA_ADDR + 0x100 too.
+    cpu_.write_(CODE_ADDR, 0x00);
+    cpu_.write_(CODE_ADDR + 1, (DATA_ADDR >> 8) + 1);
+  }
+
+  void run() {
+    for (const OpcodeGroup &group : opcode_groups()) {
+      time_opcodes_(group);
+    }
+    time_cpu_reset_();
+    time_memory_();
+    time_ppu_();
+    time_dma_();
+    time_convert_();
+  }
+
+  const std::vector<MicroResult> &results() const { return results_; }
+
+  /** Keeps results of the timed code alive, so it is not optimised away. */
+  std::uint64_t sink() const { return sink_; }
+
+ private:
+  /**
+   * Times fn, which performs ops operations, the configured number of times
+   * after one untimed warm up run.
+   */
+  void time_(const std::string &name, std::uint64_t ops,
+             const std::function<void()> &fn) {
+    if (name.find(options_.filter) == std::string::npos) {
+      return;
+    }
+
+    fn();
+    std::vector<double> ns_per_op;
+    for (unsigned int i = 0; i < options_.repetitions; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      fn();
+      std::chrono::duration<double, std::nano> elapsed =
+          std::chrono::steady_clock::now() - start;
+      ns_per_op.push_back(elapsed.count() / static_cast<double>(ops));
+    }
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    results_.push_back(
+        {name, ops, ns_per_op.front(), ns_per_op[ns_per_op.size() / 2]});
+  }
+
+  void reset_cpu_() {
+    cpu_.pc.set(CODE_ADDR);
+    cpu_.sp.set(STACK_ADDR);
+    cpu_.hl.set(DATA_ADDR);
+  }
+
+  void time_opcodes_(const OpcodeGroup &group) {
+    const unsigned int iterations = 20000;
+    reset_cpu_();
+    const std::uint64_t ops =
+        static_cast<std::uint64_t>(iterations) * group.opcodes.size();
+    time_(std::string("cpu/") + group.name, ops, [&]() {
+      for (unsigned int i = 0; i < iterations; ++i) {
+        for (byte_t opcode : group.opcodes) {
+          if (group.reset) {
+            reset_cpu_();
+          }
+          if (group.cb) {
+            cpu_.cb_op(opcode);
+          } else {
+            cpu_.op(opcode);
+          }
+        }
+      }
+      sink_ += cpu_.af.value();
+    });
+  }
+
+  /** What the groups which reset pay for it, per opcode. */
+  void time_cpu_reset_() {
+    const unsigned int iterations = 1000000;
+    time_("cpu/reset (baseline)", iterations, [&]() {
+      for (unsigned int i = 0; i < iterations; ++i) {
+        reset_cpu_();
+      }
+      sink_ += cpu_.pc.value();
+    });
+  }
+
+  void time_memory_() {
+    struct Region {
+      const char *name;
+      word_t base;
+      /** Accesses cycle through base to base + mask. */
+      word_t mask;
+    };
+    const std::vector<Region> regions = {
+        {"rom bank 0", 0x0150, 0xFF}, {"rom bank n", 0x4000, 0xFF},
+        {"vram", 0x8000, 0xFF},       {"cart ram", 0xA000, 0xFF},
+        {"wram", 0xC200, 0xFF},       {"echo", 0xE200, 0xFF},
+        {"oam", 0xFE00, 0x9F},        {"hram", 0xFF80, 0x3F},
+    };
+    const unsigned int iterations = 1 << 20;
+
+    for (const Region &region : regions) {
+      time_(std::string("read/") + region.name, iterations, [&]() {
+        std::uint64_t sum = 0;
+        for (unsigned int i = 0; i < iterations; ++i) {
+          sum += cpu_.read_(region.base + (i & region.mask));
+        }
+        sink_ += sum;
+      });
+      if (region.base < 0x8000) {
+        continue;
+      }
+      time_(std::string("write/") + region.name, iterations, [&]() {
+        for (unsigned int i = 0; i < iterations; ++i) {
+          cpu_.write_(region.base + (i & region.mask),
+                      static_cast<byte_t>(i));
+        }
+      });
+    }
+
+    // Registers go through the IO switch rather than a buffer.
+    const word_t reads[] = {0xFF00, 0xFF04, 0xFF0F, 0xFF40,
+                            0xFF41, 0xFF44, 0xFF47, 0xFFFF};
+    time_("read/io", iterations, [&]() {
+      std::uint64_t sum = 0;
+      for (unsigned int i = 0; i < iterations; ++i) {
+        sum += cpu_.read_(reads[i & 7]);
+      }
+      sink_ += sum;
+    });
+    const word_t writes[] = {0xFF06, 0xFF07, 0xFF42, 0xFF43,
+                             0xFF47, 0xFF48, 0xFF49, 0xFF4A};
+    time_("write/io", iterations, [&]() {
+      for (unsigned int i = 0; i < iterations; ++i) {
+        cpu_.write_(writes[i & 7], static_cast<byte_t>(i));
+      }
+    });
+    time_("write/rom (mbc)", iterations, [&]() {
+      for (unsigned int i = 0; i < iterations; ++i) {
+        cpu_.write_(0x2000, 0x01);
+      }
+    });
+  }
+
+  void time_ppu_() {
+    // Busy tiles and maps everywhere, a window over the lower half, and all
+    // 40 sprites on screen.
+    std::uint32_t state = 0x12345678;
+    for (std::size_t i = 0; i < sizeof(MemoryState::vram); ++i) {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      memory_.vram()[i] = static_cast<byte_t>(state);
+    }
+    for (std::size_t i = 0; i < 40; ++i) {
+      memory_.oam()[i * 4] = static_cast<byte_t>(16 + (i * 29) % 144);
+      memory_.oam()[i * 4 + 1] = static_cast<byte_t>(8 + (i * 37) % 160);
+      memory_.oam()[i * 4 + 2] = static_cast<byte_t>(i * 3);
+      memory_.oam()[i * 4 + 3] = static_cast<byte_t>((i & 3) << 5);
+    }
+    ppu_.lcd_control.set(0xF3);
+    ppu_.bg_palette.set(0xE4);
+    ppu_.sprite_palette_0.set(0xD2);
+    ppu_.sprite_palette_1.set(0x1B);
+    ppu_.scroll_x.set(3);
+    ppu_.scroll_y.set(5);
+    ppu_.window_x.set(7);
+    ppu_.window_y.set(GAMEBOY_HEIGHT / 2);
+    ppu_.own_frame_buffer_(false);
+
+    const unsigned int frames = 200;
+    auto lines = [&](void (Ppu::*fn)()) {
+      return [this, fn]() {
+        for (unsigned int frame = 0; frame < frames; ++frame) {
+          for (unsigned int line = 0; line < GAMEBOY_HEIGHT; ++line) {
+            ppu_.line.set(static_cast<byte_t>(line));
+            (ppu_.*fn)();
+          }
+        }
+      };
+    };
+    const std::uint64_t ops =
+        static_cast<std::uint64_t>(frames) * GAMEBOY_HEIGHT;
+    time_("ppu/bg line", ops, lines(&Ppu::write_bg_line_));
+    time_("ppu/window line", ops, lines(&Ppu::write_window_line_));
+    time_("ppu/scanline", ops, lines(&Ppu::write_scanline_));
+    // Sprites are drawn over the finished frame, all at once.
+    time_("ppu/sprites frame", frames, [&]() {
+      for (unsigned int frame = 0; frame < frames; ++frame) {
+        ppu_.draw_sprites_();
+      }
+    });
+  }
+
+  void time_dma_() {
+    const unsigned int iterations = 20000;
+    time_("dma/oam from wram", iterations, [&]() {
+      for (unsigned int i = 0; i < iterations; ++i) {
+        cpu_.dma_transfer_(0xC0);
+      }
+    });
+    time_("dma/oam from rom", iterations, [&]() {
+      for (unsigned int i = 0; i < iterations; ++i) {
+        cpu_.dma_transfer_(0x40);
+      }
+    });
+  }
+
+  void time_convert_() {
+    std::vector<Color> frame(GAMEBOY_WIDTH * GAMEBOY_HEIGHT);
+    for (std::size_t i = 0; i < frame.size(); ++i) {
+      frame[i] = static_cast<Color>((i * 7 + i / GAMEBOY_WIDTH) & 3);
+    }
+    std::vector<std::uint32_t> pixels(frame.size());
+    const unsigned int iterations = 500;
+    time_("display/convert frame", iterations, [&]() {
+      for (unsigned int i = 0; i < iterations; ++i) {
+        SdlDisplay::convert(frame, pixels.data());
+      }
+      sink_ += pixels.back();
+    });
+  }
+
+  const MicroOptions options_;
+  std::vector<MicroResult> results_;
+  std::uint64_t sink_ = 0;
+
+  /** Frames go nowhere; kernels time the PPU's work, not the display's. */
+  struct DiscardFrame {
+    void operator()(std::vector<Color> &) {}
+  };
+  DiscardFrame discard_frame_;
+
+  std::uint64_t cycles_ = 0;
+  Cartridge cartridge_;
+  Memory memory_;
+  Interrupts interrupts_;
+  Ppu ppu_;
+  Timer timer_;
+  Joypad joypad_;
+  Serial serial_;
+  Apu apu_;
+  Cpu cpu_;
+};
+
+namespace {
+
+MicroOptions get_micro_options(int argc, char **argv) {
+  MicroOptions options;
+  std::vector<std::string> args(argv + 1, argv + argc);
+  for (unsigned int i = 0; i < args.size(); ++i) {
+    if (args[i] == "--filter" && i + 1 < args.size()) {
+      options.filter = args[++i];
+    } else if (args[i] == "--repetitions" && i + 1 < args.size()) {
+      options.repetitions = std::max(1, std::atoi(args[++i].c_str()));
+    } else {
+      log_error("usage: bugme-microbench [--filter name] [--repetitions n]");
+      std::exit(2);
+    }
+  }
+  return options;
+}
+
+}  // namespace
+
+int micro_main(int argc, char **argv) {
+  // Only errors, on stderr, so that stdout is nothing but the report.
+  log_set_level(LogLevel::Error);
+  MicroOptions options = get_micro_options(argc, argv);
+
+  auto bench = std::make_unique<MicroBench>(options);
+  bench->run();
+
+  const std::vector<MicroResult> &results = bench->results();
+  std::printf("{\n  \"results\": [\n");
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    std::printf(
+        "    {\"name\": \"%s\", \"ops\": %llu, \"best_ns_per_op\": %.3f, "
+        "\"median_ns_per_op\": %.3f}%s\n",
+        results[i].name.c_str(),
+        static_cast<unsigned long long>(results[i].ops), results[i].best_ns,
+        results[i].median_ns, i + 1 == results.size() ? "" : ",");
+  }
+  std::printf("  ],\n  \"repetitions\": %u,\n  \"sink\": %llu\n}\n",
+              options.repetitions,
+              static_cast<unsigned long long>(bench->sink()));
+  return 0;
+}
+
+}  // namespace bugme
+
+int main(int argc, char **argv) { return bugme::micro_main(argc, argv); }
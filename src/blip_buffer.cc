@@ -0,0 +1,110 @@
+#include "blip_buffer.hh"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace bugme {
+
+namespace {
+/** Samples each step is spread over. */
+inline const std::size_t TAPS = 16;
+/** Sub-sample positions a step can take. */
+inline const unsigned int PHASE_BITS = 5;
+inline const std::size_t PHASES = 1 << PHASE_BITS;
+
+/** How quickly DC decays, like the capacitor on the Gameboy's output. */
+inline const float HIGH_PASS = 1.0f / 512;
+
+typedef std::array<std::array<float, TAPS>, PHASES> Kernel;
+
+/**
+ * For each phase, a windowed sinc impulse cut off just below the output
+ * Nyquist frequency, offset by that phase. Summed, each row makes a unit
+ * step, band-limited.
+ */
+const Kernel &kernel() {
+  static const Kernel table = []() {
+    const double pi = std::acos(-1.0);
+    const double cutoff = 0.9;  // of the Nyquist frequency
+    Kernel k;
+    for (std::size_t phase = 0; phase < PHASES; ++phase) {
+      double sum = 0;
+      for (std::size_t tap = 0; tap < TAPS; ++tap) {
+        double x = static_cast<double>(tap) - (TAPS / 2 - 1) -
+                   static_cast<double>(phase) / PHASES;
+        double sinc = x == 0 ? 1 : std::sin(pi * cutoff * x) / (pi * cutoff * x);
+        double window = 0.42 + 0.5 * std::cos(2 * pi * x / TAPS) +
+                        0.08 * std::cos(4 * pi * x / TAPS);
+        k[phase][tap] = static_cast<float>(sinc * window);
+        sum += sinc * window;
+      }
+      for (float &tap : k[phase]) {
+        tap = static_cast<float>(tap / sum);
+      }
+    }
+    return k;
+  }();
+  return table;
+}
+}  // namespace
+
+BlipBuffer::BlipBuffer(double clock_rate, double sample_rate,
+                       std::size_t capacity)
+    : buffer_(capacity + TAPS) {
+  set_rates(clock_rate, sample_rate);
+}
+
+void BlipBuffer::set_rates(double clock_rate, double sample_rate) {
+  factor_ = static_cast<std::uint64_t>(
+      std::llround(sample_rate / clock_rate * 4294967296.0));
+}
+
+void BlipBuffer::add_delta(std::uint64_t time, int delta) {
+  std::uint64_t position = offset_ + time * factor_;
+  std::size_t index = available_ + static_cast<std::size_t>(position >> 32);
+  if (index + TAPS > buffer_.size()) {
+    return;
+  }
+
+  const std::array<float, TAPS> &taps =
+      kernel()[(position >> (32 - PHASE_BITS)) & (PHASES - 1)];
+  float *out = &buffer_[index];
+  for (std::size_t tap = 0; tap < TAPS; ++tap) {
+    out[tap] += static_cast<float>(delta) * taps[tap];
+  }
+}
+
+void BlipBuffer::end_frame(std::uint64_t time) {
+  offset_ += time * factor_;
+  available_ += static_cast<std::size_t>(offset_ >> 32);
+  offset_ &= 0xFFFFFFFF;
+  available_ = std::min(available_, buffer_.size() - TAPS);
+}
+
+std::size_t BlipBuffer::read_samples(std::int16_t *out, std::size_t count,
+                                     std::size_t stride) {
+  count = std::min(count, available_);
+  for (std::size_t i = 0; i < count; ++i) {
+    integrator_ += buffer_[i];
+    out[i * stride] = static_cast<std::int16_t>(
+        std::clamp(integrator_, -32768.0f, 32767.0f));
+    integrator_ -= integrator_ * HIGH_PASS;
+  }
+
+  std::copy(buffer_.begin() + static_cast<std::ptrdiff_t>(count),
+            buffer_.end(), buffer_.begin());
+  std::fill(buffer_.end() - static_cast<std::ptrdiff_t>(count), buffer_.end(),
+            0.0f);
+  available_ -= count;
+  return count;
+}
+
+void BlipBuffer::clear() {
+  std::fill(buffer_.begin(), buffer_.end(), 0.0f);
+  offset_ = 0;
+  available_ = 0;
+  integrator_ = 0;
+}
+
+}  // namespace bugme
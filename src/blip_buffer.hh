@@ -0,0 +1,78 @@
+#ifndef BUGME_BLIP_BUFFER_HH
+#define BUGME_BLIP_BUFFER_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "types.hh"
+
+namespace bugme {
+
+/**
+ * Band-limited synthesis of a signal made of steps, resampling it from an
+ * emulated clock to a host sample rate.
+ *
+ * Rather than being sampled, the signal is described by its changes: each
+ * add_delta() places a band-limited step at its exact (fractional) sample
+ * position, so square waves come out free of aliasing however their edges
+ * fall relative to the output samples. The cost is per step rather than per
+ * clock, which suits the Gameboy, whose channels change level rarely.
+ *
+ * Times are in clocks, relative to the start of the current frame; frames
+ * are closed with end_frame(), after which their samples can be read.
+ */
+class BlipBuffer : public Noncopyable {
+ public:
+  /**
+   * \param clock_rate Clocks per second of the emulated signal.
+   * \param sample_rate Samples per second of the output.
+   * \param capacity The most samples which may be buffered at once. Steps
+   *        beyond it are dropped.
+   */
+  BlipBuffer(double clock_rate, double sample_rate, std::size_t capacity);
+
+  /**
+   * Changes the resampling ratio, from the start of the current frame. Small
+   * adjustments are inaudible, which makes this suitable for rate control.
+   */
+  void set_rates(double clock_rate, double sample_rate);
+
+  /** Adds a step of height delta at the given time. */
+  void add_delta(std::uint64_t time, int delta);
+
+  /** Ends the current frame at the given time, making its samples readable. */
+  void end_frame(std::uint64_t time);
+
+  /** \return The number of samples ready to be read. */
+  std::size_t samples_available() const { return available_; }
+
+  /**
+   * Reads samples, removing them from the buffer.
+   *
+   * \param out Where to write samples.
+   * \param count The most samples to read.
+   * \param stride The distance between samples in out, e.g. 2 to interleave
+   *        two buffers into stereo.
+   * \return The number of samples read.
+   */
+  std::size_t read_samples(std::int16_t *out, std::size_t count,
+                           std::size_t stride);
+
+  /** Discards all buffered samples and steps. */
+  void clear();
+
+ private:
+  /** Output samples per clock, as 32.32 fixed point. */
+  std::uint64_t factor_ = 0;
+  /** Where the current frame starts, past the readable samples, in 32.32. */
+  std::uint64_t offset_ = 0;
+  std::size_t available_ = 0;
+  /** Deltas of the output, which read_samples() integrates. */
+  std::vector<float> buffer_;
+  float integrator_ = 0;
+};
+
+}  // namespace bugme
+
+#endif
@@ -0,0 +1,121 @@
+#include "bugme.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "color.hh"
+#include "link_cable.hh"
+#include "log.hh"
+#include "machine.hh"
+#include "memory.hh"
+#include "savestate.hh"
+
+using namespace bugme;
+
+static_assert(sizeof(PpuState::frame_buffer) ==
+              BUGME_FRAME_WIDTH * BUGME_FRAME_HEIGHT);
+static_assert(sizeof(Color) == 1);
+static_assert(Memory::PAGE_SIZE == BUGME_PAGE_SIZE);
+
+struct bugme_instance {
+  /** Quiet by default; the host has no use for per-instruction logging. */
+  Logger logger = Logger("[bugme]");
+  /** Shared by both linked instances; outlives the machine plugged into it. */
+  std::shared_ptr<LinkCable> cable;
+  std::unique_ptr<Machine> machine;
+
+  bugme_instance() { logger.set_level(LogLevel::Error); }
+};
+
+namespace {
+/** Header plus the cartridge header, the least a ROM can be. */
+inline const std::size_t MIN_ROM_SIZE = 0x150;
+
+bool is_aligned(const void *buffer) {
+  return reinterpret_cast<std::uintptr_t>(buffer) % 8 == 0;
+}
+}  // namespace
+
+int bugme_abi_version(void) { return BUGME_ABI_VERSION; }
+
+bugme_t *bugme_create(const uint8_t *rom, size_t rom_size) {
+  if (rom == nullptr || rom_size < MIN_ROM_SIZE) {
+    return nullptr;
+  }
+
+  auto instance = std::make_unique<bugme_t>();
+  ScopedLogger scoped_logger(instance->logger);
+  instance->machine =
+      std::make_unique<Machine>(std::vector<byte_t>(rom, rom + rom_size),
+                                std::string(), RtcClock::Emulated);
+  return instance.release();
+}
+
+bugme_t *bugme_fork(bugme_t *instance) {
+  auto child = std::make_unique<bugme_t>();
+  child->logger = instance->logger;
+  ScopedLogger scoped_logger(child->logger);
+  child->machine = instance->machine->fork();
+  return child.release();
+}
+
+void bugme_destroy(bugme_t *instance) { delete instance; }
+
+uint64_t bugme_step(bugme_t *instance, unsigned int frames, uint8_t buttons) {
+  ScopedLogger scoped_logger(instance->logger);
+  instance->machine->set_buttons(buttons);
+  for (unsigned int i = 0; i < frames; ++i) {
+    instance->machine->run_frame();
+  }
+  return instance->machine->cycles();
+}
+
+void bugme_set_rendering(bugme_t *instance, int enabled) {
+  instance->machine->set_rendering(enabled != 0);
+}
+
+void bugme_link(bugme_t *a, bugme_t *b) {
+  bugme_unlink(a);
+  bugme_unlink(b);
+  a->cable = b->cable = std::make_shared<LinkCable>();
+  a->machine->plug(*a->cable, 0);
+  b->machine->plug(*b->cable, 1);
+}
+
+void bugme_unlink(bugme_t *instance) {
+  instance->machine->unplug();
+  instance->cable.reset();
+}
+
+const uint8_t *bugme_frame_buffer(const bugme_t *instance) {
+  return reinterpret_cast<const uint8_t *>(
+      instance->machine->frame_buffer().data());
+}
+
+const uint8_t *bugme_memory_page(const bugme_t *instance, uint16_t addr) {
+  return instance->machine->memory_page(addr);
+}
+
+size_t bugme_state_size(const bugme_t *instance) {
+  return instance->machine->state_size();
+}
+
+int bugme_save_state(const bugme_t *instance, void *buffer, size_t size) {
+  if (!is_aligned(buffer) || size < instance->machine->state_size()) {
+    return -1;
+  }
+  instance->machine->save_state(static_cast<byte_t *>(buffer));
+  return 0;
+}
+
+int bugme_load_state(bugme_t *instance, const void *buffer, size_t size) {
+  if (!is_aligned(buffer)) {
+    return -1;
+  }
+  ScopedLogger scoped_logger(instance->logger);
+  return instance->machine->load_state(static_cast<const byte_t *>(buffer), size)
+             ? 0
+             : -1;
+}
@@ -0,0 +1,148 @@
+#ifndef BUGME_H
+#define BUGME_H
+
+/**
+ * \file
+ * C interface to the bugme emulator, for driving it from other languages.
+ *
+ * An instance is a single headless Gameboy. Instances share nothing mutable,
+ * so any number may be used concurrently, each from one thread at a time.
+ * Nothing is written to disk: cartridge RAM is kept in memory, and survives
+ * only through save states.
+ *
+ * Pointers returned by an instance point into the instance itself and are
+ * valid until the next call which runs or loads it (bugme_step,
+ * bugme_load_state), or destroys it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUGME_API __attribute__((visibility("default")))
+
+/** Bumped whenever a function or its meaning changes incompatibly. */
+#define BUGME_ABI_VERSION 1
+
+/** Frame buffer dimensions, in pixels. */
+#define BUGME_FRAME_WIDTH 160
+#define BUGME_FRAME_HEIGHT 144
+
+/** Size, in bytes, of the pages returned by bugme_memory_page(). */
+#define BUGME_PAGE_SIZE 256
+
+/** Bits of a button mask. */
+#define BUGME_BUTTON_UP 0x01
+#define BUGME_BUTTON_DOWN 0x02
+#define BUGME_BUTTON_LEFT 0x04
+#define BUGME_BUTTON_RIGHT 0x08
+#define BUGME_BUTTON_A 0x10
+#define BUGME_BUTTON_B 0x20
+#define BUGME_BUTTON_SELECT 0x40
+#define BUGME_BUTTON_START 0x80
+
+typedef struct bugme_instance bugme_t;
+
+/** \return BUGME_ABI_VERSION, as the library was built. */
+BUGME_API int bugme_abi_version(void);
+
+/**
+ * Creates an instance, powered on and about to run the boot ROM.
+ *
+ * \param rom The cartridge ROM, which is copied.
+ * \param rom_size The size of rom, in bytes.
+ * \return The new instance, or NULL if rom is too small to be a ROM.
+ */
+BUGME_API bugme_t *bugme_create(const uint8_t *rom, size_t rom_size);
+
+/**
+ * Creates a copy of an instance, far more cheaply than a save state round
+ * trip. Work RAM, VRAM, OAM, I/O and high RAM are copied outright; only
+ * cartridge RAM and the frame buffers are shared copy-on-write.
+ */
+BUGME_API bugme_t *bugme_fork(bugme_t *instance);
+
+BUGME_API void bugme_destroy(bugme_t *instance);
+
+/**
+ * Holds buttons down for some frames, then emulates up to the end of the
+ * last one.
+ *
+ * \param frames The number of frames to run.
+ * \param buttons The buttons to hold, as BUGME_BUTTON_* bits.
+ * \return T-cycles elapsed since power on.
+ */
+BUGME_API uint64_t bugme_step(bugme_t *instance, unsigned int frames,
+                              uint8_t buttons);
+
+/**
+ * Enables or disables drawing. Frames which are never looked at are
+ * noticeably cheaper to emulate without it.
+ */
+BUGME_API void bugme_set_rendering(bugme_t *instance, int enabled);
+
+/**
+ * Connects the serial ports of two instances with a link cable, unlinking
+ * each from any previous partner. The two must then be stepped on separate
+ * threads: a transfer blocks until the other side takes part in it, which it
+ * can only do while being stepped.
+ *
+ * Neither instance may be being stepped during this call.
+ */
+BUGME_API void bugme_link(bugme_t *a, bugme_t *b);
+
+/**
+ * Disconnects an instance's link cable. Its partner, if blocked in a
+ * transfer, is released and receives 0xFF, as from an unplugged cable.
+ */
+BUGME_API void bugme_unlink(bugme_t *instance);
+
+/**
+ * \return The last completed frame: BUGME_FRAME_WIDTH * BUGME_FRAME_HEIGHT
+ *         bytes in row-major order, each a shade from 0 (lightest) to 3
+ *         (darkest).
+ */
+BUGME_API const uint8_t *bugme_frame_buffer(const bugme_t *instance);
+
+/**
+ * Reads work RAM (0xC000-0xDFFF) or high RAM (0xFF80-0xFFFE) in place.
+ *
+ * \return The BUGME_PAGE_SIZE bytes starting at addr rounded down to a
+ *         multiple of BUGME_PAGE_SIZE, so that the byte at addr is at index
+ *         addr % BUGME_PAGE_SIZE; or NULL if addr lies outside those ranges.
+ */
+BUGME_API const uint8_t *bugme_memory_page(const bugme_t *instance,
+                                           uint16_t addr);
+
+/** \return The size, in bytes, of a save state of this instance. */
+BUGME_API size_t bugme_state_size(const bugme_t *instance);
+
+/**
+ * Captures the complete machine state.
+ *
+ * \param buffer Where to write the state, aligned to 8 bytes.
+ * \param size The size of buffer, at least bugme_state_size().
+ * \return 0 on success, or -1 if buffer is too small or misaligned.
+ */
+BUGME_API int bugme_save_state(const bugme_t *instance, void *buffer,
+                               size_t size);
+
+/**
+ * Restores the complete machine state.
+ *
+ * \param buffer A state from bugme_save_state(), aligned to 8 bytes.
+ * \param size The size of buffer, in bytes.
+ * \return 0 on success, or -1 (leaving the instance untouched) if buffer is
+ *         misaligned or not a save state for this ROM.
+ */
+BUGME_API int bugme_load_state(bugme_t *instance, const void *buffer,
+                               size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,8 +1,13 @@
 #include "cartridge.hh"
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <utility>
 
 #include "log.hh"
+#include "mmap.hh"
+#include "save_file.hh"
+#include "util.hh"
 
 namespace bugme {
 
@@ -72,14 +77,400 @@ std::string get_readable_mbc_mode(byte_t cartridge_type) {
   }
 }
 
-Cartridge::Cartridge(std::vector<byte_t> rom_data) : rom_data_(rom_data) {
-  header_ = *reinterpret_cast<CartridgeHeader *>(&rom_data_.at(0x0100));
+MbcType get_mbc_type(byte_t cartridge_type) {
+  switch (cartridge_type) {
+    case 0x01:
+    case 0x02:
+    case 0x03:
+      return MbcType::MBC1;
+    case 0x05:
+    case 0x06:
+      return MbcType::MBC2;
+    case 0x0F:
+    case 0x10:
+    case 0x11:
+    case 0x12:
+    case 0x13:
+      return MbcType::MBC3;
+    case 0x19:
+    case 0x1A:
+    case 0x1B:
+    case 0x1C:
+    case 0x1D:
+    case 0x1E:
+      return MbcType::MBC5;
+    default:
+      return MbcType::NONE;
+  }
+}
+
+bool has_battery(byte_t cartridge_type) {
+  switch (cartridge_type) {
+    case 0x03:
+    case 0x06:
+    case 0x09:
+    case 0x0D:
+    case 0x0F:
+    case 0x10:
+    case 0x13:
+    case 0x17:
+    case 0x1B:
+    case 0x1E:
+    case 0xFF:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool has_rtc(byte_t cartridge_type) {
+  return cartridge_type == 0x0F || cartridge_type == 0x10;
+}
+
+std::size_t get_ram_size(const CartridgeHeader &header) {
+  // MBC2 has 512 half-bytes of RAM built into the controller itself.
+  if (get_mbc_type(header.cartridge_type) == MbcType::MBC2) {
+    return 0x200;
+  }
+
+  switch (header.ram_size) {
+    case 0x01:
+      return 0x800;
+    case 0x02:
+      return 0x2000;
+    case 0x03:
+      return 0x8000;
+    case 0x04:
+      return 0x20000;
+    case 0x05:
+      return 0x10000;
+    default:
+      return 0;
+  }
+}
+
+std::size_t get_rom_size(const CartridgeHeader &header) {
+  return static_cast<std::size_t>(0x8000) << header.rom_size;
+}
+
+byte_t compute_header_checksum(const byte_t *rom) {
+  byte_t checksum = 0;
+  for (word_t addr = 0x0134; addr <= 0x014C; ++addr) {
+    checksum = static_cast<byte_t>(checksum - rom[addr] - 1);
+  }
+  return checksum;
+}
+
+word_t compute_global_checksum(const byte_t *rom, std::size_t size) {
+  const std::uint64_t LOW_BYTES = 0x00FF00FF00FF00FF;
+
+  // Sum eight bytes at a time as four 16-bit lanes. Each step adds at most
+  // 2 * 0xFF to a lane, so lanes are folded into the total well before they
+  // could overflow.
+  std::uint64_t total = 0;
+  std::size_t i = 0;
+  while (i + 8 <= size) {
+    std::uint64_t lanes = 0;
+    for (unsigned int step = 0; step < 64 && i + 8 <= size; ++step, i += 8) {
+      std::uint64_t chunk;
+      std::memcpy(&chunk, rom + i, sizeof(chunk));
+      lanes += (chunk & LOW_BYTES) + ((chunk >> 8) & LOW_BYTES);
+    }
+    total += (lanes & 0xFFFF) + ((lanes >> 16) & 0xFFFF) +
+             ((lanes >> 32) & 0xFFFF) + (lanes >> 48);
+  }
+  for (; i < size; ++i) {
+    total += rom[i];
+  }
+
+  return static_cast<word_t>(total - rom[0x014E] - rom[0x014F]);
+}
+
+namespace {
+inline const std::size_t ROM_BANK_SIZE = 0x4000;
+inline const std::size_t RAM_BANK_SIZE = 0x2000;
+}  // namespace
+
+bool CartridgeHeader::matches(const byte_t *title,
+                              word_t global_checksum) const {
+  return std::memcmp(title, this->title, sizeof(this->title)) == 0 &&
+         global_checksum ==
+             util::fuse(this->global_checksum[0], this->global_checksum[1]);
+}
+
+Cartridge::Cartridge(std::shared_ptr<const std::vector<byte_t>> rom,
+                     const std::string &save_filename, RtcClock rtc_clock,
+                     const std::uint64_t &cycles)
+    : rom_(std::move(rom)), ram_pages_(0) {
+  header_ = *reinterpret_cast<const CartridgeHeader *>(&rom_->at(0x0100));
+  mbc_type_ = get_mbc_type(header_.cartridge_type);
+  ram_size_ = get_ram_size(header_);
+
   log_info("[cart] cartridge header:");
   log_info("[cart] \t%s", reinterpret_cast<char const *>(&header_.title));
   log_info("[cart] \t%s",
            get_readable_mbc_mode(header_.cartridge_type).c_str());
+  log_info("[cart] \t%zu bytes of RAM", ram_size_);
+
+  // The clock state is saved immediately after external RAM.
+  bool rtc = has_rtc(header_.cartridge_type);
+  save_size_ = ram_size_ + (rtc ? sizeof(RtcSaveData) : 0);
+
+  RtcSaveData *rtc_data = &rtc_data_;
+  if (save_size_ > 0 && has_battery(header_.cartridge_type) &&
+      !save_filename.empty()) {
+    save_file_ = std::make_unique<SaveFile>(save_filename, save_size_);
+    ram_ = save_file_->data();
+    rtc_data = reinterpret_cast<RtcSaveData *>(ram_ + ram_size_);
+  } else {
+    ram_pages_ = CowBuffer(ram_size_);
+  }
+
+  if (rtc) {
+    rtc_ = std::make_unique<Rtc>(rtc_clock, cycles, rtc_data);
+  }
+}
+
+Cartridge::~Cartridge() {
+  if (rtc_) {
+    rtc_->sync();
+  }
+}
+
+byte_t Cartridge::read(word_t addr) const {
+  if (addr >= mmap::CARTRIDGE_RAM_START) {
+    return read_ram_(addr);
+  }
+
+  return (*rom_)[rom_offset_(addr)];
+}
+
+const byte_t *Cartridge::rom_block(word_t addr, std::size_t size) const {
+  std::size_t offset = rom_offset_(addr);
+  if (offset + size > rom_->size()) {
+    return nullptr;
+  }
+  return rom_->data() + offset;
+}
+
+std::size_t Cartridge::rom_bank() const {
+  std::size_t banks = std::max<std::size_t>(1, rom_->size() / ROM_BANK_SIZE);
+  return rom_bank_ % banks;
+}
+
+void Cartridge::write(word_t addr, byte_t byte) {
+  if (addr >= mmap::CARTRIDGE_RAM_START) {
+    write_ram_(addr, byte);
+    return;
+  }
+
+  write_mbc_(addr, byte);
+}
+
+void Cartridge::save_state(CartridgeState &state, byte_t *ram) const {
+  state.rom_bank = rom_bank_;
+  state.ram_bank = ram_bank_;
+  state.ram_enabled = ram_enabled_;
+  state.banking_mode = banking_mode_;
+  state.rtc_last_latch_write = 0;
+  state.rtc_base_cycles = 0;
+  if (rtc_) {
+    rtc_->save_state(state);
+  }
+  state.ram_size = static_cast<std::uint32_t>(save_size_);
+  if (ram_) {
+    std::memcpy(ram, ram_, save_size_);
+  } else {
+    ram_pages_.copy_to(ram);
+    if (rtc_) {
+      std::memcpy(ram + ram_size_, &rtc_data_, sizeof(rtc_data_));
+    }
+  }
+}
+
+void Cartridge::load_state(const CartridgeState &state, const byte_t *ram) {
+  rom_bank_ = state.rom_bank;
+  ram_bank_ = state.ram_bank;
+  ram_enabled_ = state.ram_enabled;
+  banking_mode_ = state.banking_mode;
+  if (rtc_) {
+    rtc_->load_state(state);
+  }
+  if (ram_) {
+    std::memcpy(ram_, ram, save_size_);
+    mark_dirty_();
+  } else {
+    ram_pages_.copy_from(ram);
+    if (rtc_) {
+      std::memcpy(&rtc_data_, ram + ram_size_, sizeof(rtc_data_));
+    }
+  }
+}
+
+void Cartridge::share(Cartridge &other) {
+  if (ram_ || other.ram_) {
+    std::vector<byte_t> ram(save_size_);
+    CartridgeState state;
+    other.save_state(state, ram.data());
+    load_state(state, ram.data());
+    return;
+  }
+
+  rom_bank_ = other.rom_bank_;
+  ram_bank_ = other.ram_bank_;
+  ram_enabled_ = other.ram_enabled_;
+  banking_mode_ = other.banking_mode_;
+  if (rtc_) {
+    CartridgeState state;
+    other.rtc_->save_state(state);
+    rtc_->load_state(state);
+  }
+  ram_pages_.share(other.ram_pages_);
+  rtc_data_ = other.rtc_data_;
+}
+
+void Cartridge::set_speculative(bool speculative) {
+  if (!save_file_ || speculative == speculative_) {
+    return;
+  }
+
+  speculative_ = speculative;
+  byte_t *file = save_file_->data();
+  if (speculative) {
+    speculative_ram_.assign(file, file + save_size_);
+    ram_ = speculative_ram_.data();
+  } else {
+    ram_ = file;
+  }
+  if (rtc_) {
+    rtc_->set_data(reinterpret_cast<RtcSaveData *>(ram_ + ram_size_));
+  }
 }
 
-byte_t Cartridge::read(word_t addr) const { return rom_data_.at(addr); }
+void Cartridge::mark_dirty_() {
+  if (save_file_ && !speculative_) {
+    save_file_->mark_dirty();
+  }
+}
+
+byte_t Cartridge::read_ram_(word_t addr) const {
+  if (rtc_ && ram_enabled_ && ram_bank_ >= Rtc::SECONDS) {
+    // MBC3 maps nothing at 0x0D-0x0F.
+    return (ram_bank_ <= Rtc::DAYS_HIGH) ? rtc_->read(ram_bank_) : 0xFF;
+  }
+
+  if (ram_size_ == 0 || (mbc_type_ != MbcType::NONE && !ram_enabled_)) {
+    return 0xFF;
+  }
+
+  std::size_t offset = ram_offset_(addr);
+  byte_t byte = ram_ ? ram_[offset] : ram_pages_.read(offset);
+  return (mbc_type_ == MbcType::MBC2) ? (0xF0 | byte) : byte;
+}
+
+void Cartridge::write_ram_(word_t addr, byte_t byte) {
+  if (rtc_ && ram_enabled_ && ram_bank_ >= Rtc::SECONDS) {
+    if (ram_bank_ <= Rtc::DAYS_HIGH) {
+      rtc_->write(ram_bank_, byte);
+      mark_dirty_();
+    }
+    return;
+  }
+
+  if (ram_size_ == 0 || (mbc_type_ != MbcType::NONE && !ram_enabled_)) {
+    return;
+  }
+
+  std::size_t offset = ram_offset_(addr);
+  byte = (mbc_type_ == MbcType::MBC2) ? (byte & 0x0F) : byte;
+  if (ram_) {
+    ram_[offset] = byte;
+    mark_dirty_();
+  } else {
+    ram_pages_.write(offset, byte);
+  }
+}
+
+std::size_t Cartridge::rom_offset_(word_t addr) const {
+  if (addr < ROM_BANK_SIZE) {
+    std::size_t bank =
+        (mbc_type_ == MbcType::MBC1 && banking_mode_) ? (ram_bank_ << 5) : 0;
+    return (bank * ROM_BANK_SIZE + addr) % rom_->size();
+  }
+  return (rom_bank_ * ROM_BANK_SIZE + (addr - ROM_BANK_SIZE)) % rom_->size();
+}
+
+std::size_t Cartridge::ram_offset_(word_t addr) const {
+  std::size_t offset = addr - mmap::CARTRIDGE_RAM_START;
+  if (mbc_type_ == MbcType::MBC2) {
+    return offset & 0x1FF;
+  }
+
+  std::size_t bank = (mbc_type_ == MbcType::MBC1 && !banking_mode_)
+                         ? 0
+                         : static_cast<std::size_t>(ram_bank_);
+  return (bank * RAM_BANK_SIZE + offset) % ram_size_;
+}
+
+void Cartridge::write_mbc_(word_t addr, byte_t byte) {
+  switch (mbc_type_) {
+    case MbcType::NONE:
+      return;
+
+    case MbcType::MBC1:
+      if (addr < 0x2000) {
+        ram_enabled_ = (byte & 0x0F) == 0x0A;
+      } else if (addr < 0x4000) {
+        byte &= 0x1F;
+        rom_bank_ = static_cast<word_t>((rom_bank_ & 0x60) | (byte ? byte : 1));
+      } else if (addr < 0x6000) {
+        ram_bank_ = byte & 0x03;
+        rom_bank_ = static_cast<word_t>((rom_bank_ & 0x1F) | (ram_bank_ << 5));
+      } else {
+        banking_mode_ = byte & 0x01;
+      }
+      return;
+
+    case MbcType::MBC2:
+      if (addr >= 0x4000) {
+        return;
+      }
+      if (!(addr & 0x0100)) {
+        ram_enabled_ = (byte & 0x0F) == 0x0A;
+      } else {
+        byte &= 0x0F;
+        rom_bank_ = byte ? byte : 1;
+      }
+      return;
+
+    case MbcType::MBC3:
+      if (addr < 0x2000) {
+        ram_enabled_ = (byte & 0x0F) == 0x0A;
+      } else if (addr < 0x4000) {
+        byte &= 0x7F;
+        rom_bank_ = byte ? byte : 1;
+      } else if (addr < 0x6000) {
+        // 0x00-0x03 select a RAM bank, 0x08-0x0C select an RTC register.
+        ram_bank_ = byte & 0x0F;
+      } else if (rtc_) {
+        rtc_->latch(byte);
+        mark_dirty_();
+      }
+      return;
+
+    case MbcType::MBC5:
+      if (addr < 0x2000) {
+        ram_enabled_ = (byte & 0x0F) == 0x0A;
+      } else if (addr < 0x3000) {
+        rom_bank_ = static_cast<word_t>((rom_bank_ & 0x100) | byte);
+      } else if (addr < 0x4000) {
+        rom_bank_ =
+            static_cast<word_t>((rom_bank_ & 0xFF) | ((byte & 0x01) << 8));
+      } else if (addr < 0x6000) {
+        ram_bank_ = byte & 0x0F;
+      }
+      return;
+  }
+}
 
 }  // namespace bugme
@@ -1,9 +1,13 @@
 #ifndef BUGME_CARTRIDGE_HH
 #define BUGME_CARTRIDGE_HH
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "cow_buffer.hh"
+#include "rtc.hh"
+#include "savestate.hh"
 #include "types.hh"
 
 namespace bugme {
@@ -22,35 +26,174 @@ struct CartridgeHeader {
   byte_t rom_version;
   byte_t header_checksum;
   byte_t global_checksum[2];
+
+  /**
+   * \return Whether a movie or save state stamped with title and
+   *         global_checksum was made with this ROM.
+   */
+  bool matches(const byte_t *title, word_t global_checksum) const;
 };
 
+/** The family of memory bank controller a cartridge uses. */
+enum class MbcType { NONE, MBC1, MBC2, MBC3, MBC5 };
+
+class SaveFile;
+
 /**
  * Representation of a Gameboy cartridge.
  *
- * This class currently only encapsulates ROM data. Future plans for the class
- * include:
- *  - MBC support (in progress)
- *  - battery support
+ * This class encapsulates ROM data, external (cartridge) RAM and the memory
+ * bank controller which maps both into the address space. For cartridges with
+ * a battery, external RAM (and the MBC3 real-time clock, if present) is backed
+ * by a memory-mapped save file; otherwise it is kept in pages which can be
+ * shared copy-on-write with another cartridge. The ROM itself is immutable, so
+ * it is always shared.
+ *
+ * \see SaveFile
+ * \see Rtc
  */
 class Cartridge : public Noncopyable {
  public:
   /**
    * Constructor.
    *
-   * \param rom_data Hexdump vector of the Gameboy ROM.
+   * \param rom The Gameboy ROM, which may be shared with other cartridges.
+   * \param save_filename Where to persist battery-backed RAM. If empty, or if
+   *        the cartridge has no battery, RAM is kept in memory only.
+   * \param rtc_clock The time source for the real-time clock, if present.
+   * \param cycles The machine's T-cycle counter, for RtcClock::Emulated.
    */
-  Cartridge(std::vector<byte_t> rom_data);
+  Cartridge(std::shared_ptr<const std::vector<byte_t>> rom,
+            const std::string &save_filename,
+            RtcClock rtc_clock, const std::uint64_t &cycles);
+  ~Cartridge();
 
   /**
    * Retrieves the byte at address addr
    *
-   * \param addr The address (index) at which to fetch from the Gameboy ROM.
+   * \param addr The address at which to fetch, either within cartridge ROM
+   *        (0x0000-0x7FFF) or cartridge RAM (0xA000-0xBFFF).
    */
   byte_t read(word_t addr) const;
 
+  /**
+   * Writes byte to address addr.
+   *
+   * Writes to the cartridge ROM range (0x0000-0x7FFF) are interpreted as
+   * memory bank controller commands; writes to the cartridge RAM range
+   * (0xA000-0xBFFF) go to external RAM, if enabled.
+   */
+  void write(word_t addr, byte_t byte);
+
+  const CartridgeHeader &header() const { return header_; }
+
+  /**
+   * \param addr An address within cartridge ROM (0x0000-0x7FFF).
+   * \return The size bytes mapped from addr on, if they lie in one piece in
+   *         the ROM, or nullptr.
+   */
+  const byte_t *rom_block(word_t addr, std::size_t size) const;
+
+  /** \return The ROM bank mapped at 0x4000-0x7FFF. */
+  std::size_t rom_bank() const;
+
+  const std::shared_ptr<const std::vector<byte_t>> &rom() const {
+    return rom_;
+  }
+
+  /** \return The size of the external RAM and RTC data in a save state. */
+  std::size_t state_ram_size() const { return save_size_; }
+
+  /**
+   * Captures the mapper state, and copies external RAM (and RTC) data into
+   * ram, which must hold state_ram_size() bytes.
+   */
+  void save_state(CartridgeState &state, byte_t *ram) const;
+  void load_state(const CartridgeState &state, const byte_t *ram);
+
+  /**
+   * Makes this cartridge identical to other, which must hold the same ROM.
+   * If neither cartridge has a save file, external RAM is shared
+   * copy-on-write; otherwise it is copied.
+   */
+  void share(Cartridge &other);
+
+  /**
+   * Runs on a private copy of the save file's RAM while speculative is set,
+   * so that nothing written in frames which are to be undone reaches the
+   * file. The copy is dropped, unsaved, when speculative is cleared.
+   */
+  void set_speculative(bool speculative);
+
  private:
-  std::vector<byte_t> rom_data_;
+  byte_t read_ram_(word_t addr) const;
+  void write_ram_(word_t addr, byte_t byte);
+  void write_mbc_(word_t addr, byte_t byte);
+  std::size_t ram_offset_(word_t addr) const;
+  std::size_t rom_offset_(word_t addr) const;
+  /** Flags the save file for a flush, unless running speculatively. */
+  void mark_dirty_();
+
+  std::shared_ptr<const std::vector<byte_t>> rom_;
   CartridgeHeader header_;
+  MbcType mbc_type_;
+
+  std::unique_ptr<SaveFile> save_file_;
+  std::unique_ptr<Rtc> rtc_;
+  /** External RAM and clock state, when there is no save file. */
+  CowBuffer ram_pages_;
+  RtcSaveData rtc_data_ = {};
+  /** External RAM within the save file, if there is one. */
+  byte_t *ram_ = nullptr;
+  /** Stands in for the save file's RAM while speculative. */
+  std::vector<byte_t> speculative_ram_;
+  bool speculative_ = false;
+  std::size_t ram_size_ = 0;
+  std::size_t save_size_ = 0;
+
+  bool ram_enabled_ = false;
+  word_t rom_bank_ = 1;
+  byte_t ram_bank_ = 0;
+  bool banking_mode_ = false;
 };
+
+/** \return A human-readable name for a cartridge type header byte. */
+extern std::string get_readable_mbc_mode(byte_t cartridge_type);
+
+/** \return The memory bank controller family for a cartridge type byte. */
+extern MbcType get_mbc_type(byte_t cartridge_type);
+
+/** \return true if the cartridge type has a battery to persist its RAM. */
+extern bool has_battery(byte_t cartridge_type);
+
+/** \return true if the cartridge type has an MBC3 real-time clock. */
+extern bool has_rtc(byte_t cartridge_type);
+
+/** \return The size, in bytes, of external RAM described by the header. */
+extern std::size_t get_ram_size(const CartridgeHeader &header);
+
+/** \return The size, in bytes, of the ROM described by the header. */
+extern std::size_t get_rom_size(const CartridgeHeader &header);
+
+/**
+ * Computes the header checksum over bytes 0x0134-0x014C of a ROM, as verified
+ * by the boot ROM.
+ *
+ * \param rom At least 0x150 bytes of ROM data.
+ */
+extern byte_t compute_header_checksum(const byte_t *rom);
+
+/**
+ * Computes the global checksum of a ROM: the 16-bit sum of every byte except
+ * the two checksum bytes themselves (0x014E-0x014F).
+ *
+ * The sum is computed eight bytes at a time, so this is cheap enough to run
+ * over entire ROM libraries.
+ *
+ * \param rom At least 0x150 bytes of ROM data.
+ * \param size The size of rom, in bytes.
+ */
+extern word_t compute_global_checksum(const byte_t *rom, std::size_t size);
+
 }  // namespace bugme
 #endif
@@ -3,9 +3,11 @@
 
 #include <cstdint>
 
+#include "types.hh"
+
 namespace bugme {
 /** Available DMG Gameboy colors. */
-enum class Color { WHITE = 0, LIGHT_GRAY, DARK_GRAY, BLACK };
+enum class Color : byte_t { WHITE = 0, LIGHT_GRAY, DARK_GRAY, BLACK };
 
 namespace DmgRealColor {
 inline const std::uint32_t WHITE = 0x9BBC0F, LIGHT_GRAY = 0x8BAC0F,
@@ -0,0 +1,74 @@
+#include "cow_buffer.hh"
+
+#include <algorithm>
+#include <cstring>
+
+namespace bugme {
+
+namespace {
+/**
+ * The page every buffer starts out with. It is never owned, so it is never
+ * written; the first write to any page of a new buffer copies it.
+ */
+std::shared_ptr<byte_t[]> zero_page() {
+  static const std::shared_ptr<byte_t[]> page(
+      new byte_t[CowBuffer::PAGE_SIZE]());
+  return page;
+}
+}  // namespace
+
+CowBuffer::CowBuffer(std::size_t size)
+    : size_(size),
+      pages_((size + PAGE_SIZE - 1) / PAGE_SIZE),
+      storage_(pages_.size(), zero_page()),
+      owned_(pages_.size(), false) {
+  for (std::size_t page = 0; page < pages_.size(); ++page) {
+    pages_[page] = storage_[page].get();
+  }
+}
+
+void CowBuffer::copy_to(byte_t *out) const {
+  for (std::size_t page = 0; page < pages_.size(); ++page) {
+    std::size_t offset = page * PAGE_SIZE;
+    std::memcpy(out + offset, pages_[page],
+                std::min(PAGE_SIZE, size_ - offset));
+  }
+}
+
+void CowBuffer::copy_from(const byte_t *in) {
+  for (std::size_t page = 0; page < pages_.size(); ++page) {
+    std::size_t offset = page * PAGE_SIZE;
+    if (!owned_[page]) {
+      own_(page, false);
+    }
+    std::memcpy(pages_[page], in + offset, std::min(PAGE_SIZE, size_ - offset));
+  }
+}
+
+void CowBuffer::share(CowBuffer &other) {
+  storage_ = other.storage_;
+  pages_ = other.pages_;
+  std::fill(owned_.begin(), owned_.end(), false);
+  std::fill(other.owned_.begin(), other.owned_.end(), false);
+}
+
+std::size_t CowBuffer::owned_pages() const {
+  return static_cast<std::size_t>(
+      std::count(owned_.begin(), owned_.end(), true));
+}
+
+void CowBuffer::own_(std::size_t page, bool copy) {
+  // Nothing else can take a new reference to a page this buffer alone holds,
+  // so such a page may be claimed without copying it.
+  if (storage_[page].use_count() > 1) {
+    std::shared_ptr<byte_t[]> fresh(new byte_t[PAGE_SIZE]);
+    if (copy) {
+      std::memcpy(fresh.get(), pages_[page], PAGE_SIZE);
+    }
+    storage_[page] = std::move(fresh);
+    pages_[page] = storage_[page].get();
+  }
+  owned_[page] = true;
+}
+
+}  // namespace bugme
@@ -0,0 +1,88 @@
+#ifndef BUGME_COW_BUFFER_HH
+#define BUGME_COW_BUFFER_HH
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "types.hh"
+
+namespace bugme {
+
+/**
+ * A fixed-size block of emulated memory whose pages may be shared,
+ * copy-on-write, between machines.
+ *
+ * Reads go through a table of page pointers. A write to a page that is not
+ * owned by this buffer first copies it (or claims it in place, if no other
+ * buffer still refers to it), so after share() both buffers pay only for the
+ * pages they go on to write.
+ *
+ * Buffers cannot be copied, only shared. A buffer may only be used by one
+ * thread at a time, but buffers sharing pages may be used from different
+ * threads: shared pages are never written.
+ */
+class CowBuffer {
+ public:
+  static constexpr std::size_t PAGE_BITS = 8;
+  static constexpr std::size_t PAGE_SIZE = 1 << PAGE_BITS;
+
+  /** \param size The size of the buffer, in bytes. It starts zeroed. */
+  explicit CowBuffer(std::size_t size);
+  CowBuffer(CowBuffer &&) = default;
+  CowBuffer &operator=(CowBuffer &&) = default;
+  CowBuffer(const CowBuffer &) = delete;
+  CowBuffer &operator=(const CowBuffer &) = delete;
+
+  std::size_t size() const { return size_; }
+
+  byte_t read(std::size_t offset) const {
+    return pages_[offset >> PAGE_BITS][offset & (PAGE_SIZE - 1)];
+  }
+
+  void write(std::size_t offset, byte_t byte) {
+    std::size_t page = offset >> PAGE_BITS;
+    if (!owned_[page]) {
+      own_(page, true);
+    }
+    pages_[page][offset & (PAGE_SIZE - 1)] = byte;
+  }
+
+  /**
+   * \return The page holding offset, which is PAGE_SIZE bytes long (or less,
+   *         for the last page) and valid until the next write or share().
+   */
+  const byte_t *page(std::size_t offset) const {
+    return pages_[offset >> PAGE_BITS];
+  }
+
+  /** Copies the whole buffer into out, which must hold size() bytes. */
+  void copy_to(byte_t *out) const;
+
+  /** Overwrites the whole buffer from in, which must hold size() bytes. */
+  void copy_from(const byte_t *in);
+
+  /**
+   * Makes this buffer refer to all of other's pages, which must be the same
+   * size. Neither buffer owns any page afterwards, so the next write to a
+   * page, by either of them, copies it first.
+   */
+  void share(CowBuffer &other);
+
+  /** \return The number of pages written since the last share(). */
+  std::size_t owned_pages() const;
+
+ private:
+  /** Makes page private to this buffer, preserving its contents if copy. */
+  void own_(std::size_t page, bool copy);
+
+  std::size_t size_;
+  /** Where each page currently lives; what read() and write() go through. */
+  std::vector<byte_t *> pages_;
+  std::vector<std::shared_ptr<byte_t[]>> storage_;
+  std::vector<byte_t> owned_;
+};
+
+}  // namespace bugme
+
+#endif
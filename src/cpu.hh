@@ -6,7 +6,11 @@
 #include <memory>
 
 #include "interrupts.hh"
+#include "profiler.hh"
 #include "register.hh"
+#include "savestate.hh"
+#include "timeline.hh"
+#include "trace.hh"
 
 namespace bugme {
 namespace interrupt_vectors {
@@ -28,44 +32,130 @@ inline const word_t _30 = 0x0030;
 inline const word_t _38 = 0x0038;
 }  // namespace rst
 
-/* clang-format off */
-class InterruptEnable : public ControlRegister {
-public:
-  CONTROL_FLAG(4, joypad_interrupt_enable)
-  CONTROL_FLAG(3, serial_interrupt_enable)
-  CONTROL_FLAG(2, timer_interrupt_enable)
-  CONTROL_FLAG(1, lcd_stat_interrupt_enable)
-  CONTROL_FLAG(0, vblank_interrupt_enable)
-};
-/* clang-format on */
-
+class Apu;
+class Debugger;
 class Memory;
 class Cartridge;
 struct PpuBus;
-struct TimerBus;
+class Timer;
 struct JoypadBus;
+struct SerialBus;
 
 class Cpu : public Noncopyable {
  public:
-  Cpu(Memory &memory, Cartridge &cartridge, PpuBus &ppuBus, TimerBus &timerBus,
-      JoypadBus &joypadBus);
+  /** What tick() returns when the debugger stops before an instruction. */
+  static constexpr mcycles_t STOPPED = ~0u;
+
+  /** \param cycles The machine's T-cycle counter. */
+  Cpu(Memory &memory, Cartridge &cartridge, Interrupts &interrupts,
+      PpuBus &ppuBus, Timer &timer, JoypadBus &joypadBus, SerialBus &serialBus,
+      Apu &apu, const std::uint64_t &cycles);
 
   mcycles_t tick();
   void reset();
 
+  /** \return Instructions executed, not counting cycles spent halted. */
+  std::uint64_t instructions() const { return instructions_; }
+
+  void save_state(CpuState &state) const;
+  void load_state(const CpuState &state);
+
+  /**
+   * Records the state before every instruction to trace, or stops recording
+   * if trace is null.
+   *
+   * \param stub_ly Reads LY as 0x90 while tracing, as gameboy-doctor's
+   *        reference logs assume, so that they can be diffed against.
+   */
+  void set_trace(TraceWriter *trace, bool stub_ly) {
+    trace_ = trace;
+    stub_ly_ = trace != nullptr && stub_ly;
+  }
+
+  /**
+   * Makes OAM DMA take the 160 M-cycles it does on hardware, during which
+   * the CPU can reach neither OAM nor the bus the transfer reads from,
+   * rather than completing the moment it is started. Off by default.
+   */
+  void set_accurate_dma(bool enabled) { accurate_dma_ = enabled; }
+
+  /**
+   * Hands instructions and accesses on the pages debugger traps to it, or
+   * stops doing so if debugger is null.
+   */
+  void set_debugger(Debugger *debugger);
+
+#ifdef BUGME_PROFILER
+  const Profiler &profiler() const { return profiler_; }
+  Profiler &profiler() { return profiler_; }
+#endif
+#ifdef BUGME_TIMELINE
+  /** Marks HALT and interrupt handlers on timeline, which may be null. */
+  void set_timeline(Timeline *timeline) { timeline_ = timeline; }
+#endif
+
+  /** Times the internals directly. \see bench/micro.cc */
+  friend class MicroBench;
+  friend class Debugger;
+
  private:
   Memory &memory_;
   Cartridge &cartridge_;
+  Interrupts &interrupts_;
   PpuBus &ppuBus_;
-  TimerBus &timerBus_;
+  Timer &timer_;
   JoypadBus &joypadBus_;
+  SerialBus &serialBus_;
+  Apu &apu_;
 
   ByteRegister boot_rom_control;
 
+  const std::uint64_t &cycles_;
+  TraceWriter *trace_ = nullptr;
+  bool stub_ly_ = false;
+  void trace_instruction_();
+
+#ifdef BUGME_PROFILER
+  Profiler profiler_;
+  /** \return The ROM bank addr is executed from, for the profiler. */
+  std::size_t bank_(word_t addr) const;
+#endif
+#ifdef BUGME_TIMELINE
+  Timeline *timeline_ = nullptr;
+#endif
+
+  Debugger *debugger_ = nullptr;
+  /** The debugger's trap flags per page, or null without one. */
+  const byte_t *traps_ = nullptr;
+
+  /** Runs one instruction, or one cycle of HALT. \see tick */
+  mcycles_t execute_();
+
+  /** Reads addr as the CPU sees it, which accurate DMA may interfere with. */
   byte_t read_(word_t addr) const;
   void write_(word_t addr, byte_t byte);
+  /** Reads addr off the bus, as DMA does. */
+  byte_t bus_read_(word_t addr) const;
 
   void dma_transfer_(byte_t byte);
+  /**
+   * \return The 160 bytes at source, if they are plain memory in one piece,
+   *         to be copied in bulk; or nullptr.
+   */
+  const byte_t *dma_block_(word_t source) const;
+  /** Copies bytes [from, to) of a transfer from source into OAM. */
+  void dma_copy_(word_t source, word_t from, word_t to);
+  /** Advances an accurate transfer by the cycles of an instruction. */
+  void dma_tick_(mcycles_t cycles);
+  /** \return Whether an accurate transfer keeps the CPU from addr. */
+  bool dma_conflicts_(word_t addr) const;
+
+  bool accurate_dma_ = false;
+  /** Whether an accurate transfer is underway, and where it is up to. */
+  bool dma_active_ = false;
+  bool dma_started_ = false;
+  word_t dma_source_ = 0;
+  word_t dma_done_ = 0;
 
   void check_interrupts();
 
@@ -219,12 +309,11 @@ class Cpu : public Noncopyable {
   FlagRegister f;
 
   bool interrupt_master_enable;
-  InterruptEnable interrupt_enable;
-  InterruptFlag interrupt_flag;
 
   bool stopped_ = false;
   bool halted_ = false;
   bool did_branch_ = false;
+  std::uint64_t instructions_ = 0;
   bool halt_bug_no_step_mode_ = false;
 
   void op(word_t word);
@@ -1,11 +1,15 @@
 #include "cpu.hh"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 
+#include "apu.hh"
 #include "bootrom.hh"
 #include "cartridge.hh"
+#include "debug.hh"
 #include "joypad.hh"
 #include "log.hh"
 #include "memory.hh"
@@ -14,34 +18,55 @@
 #include "opcode_names.hh"
 #include "ppu.hh"
 #include "register.hh"
+#include "serial.hh"
 #include "timer.hh"
 #include "util.hh"
 
 namespace bugme {
 
-Cpu::Cpu(Memory &memory, Cartridge &cartridge, PpuBus &ppuBus,
-         TimerBus &timerBus, JoypadBus &joypadBus)
+namespace {
+/** What one OAM DMA copies, in bytes and in M-cycles. */
+inline const word_t OAM_SIZE = mmap::OAM_END - mmap::OAM_START + 1;
+}  // namespace
+
+Cpu::Cpu(Memory &memory, Cartridge &cartridge, Interrupts &interrupts,
+         PpuBus &ppuBus, Timer &timer, JoypadBus &joypadBus,
+         SerialBus &serialBus, Apu &apu, const std::uint64_t &cycles)
     : memory_(memory),
       cartridge_(cartridge),
+      interrupts_(interrupts),
       ppuBus_(ppuBus),
-      timerBus_(timerBus),
+      timer_(timer),
       joypadBus_(joypadBus),
+      serialBus_(serialBus),
+      apu_(apu),
+      cycles_(cycles),
       af(a, f),
       bc(b, c),
       de(d, e),
       hl(h, l) {
   reset();
-  ppuBus_.register_vblank_interrupt_request_cb(
-      [&]() { interrupt_flag.set_vblank_interrupt_request(); });
-  ppuBus_.register_lcd_stat_interrupt_request_cb(
-      [&]() { interrupt_flag.set_lcd_stat_interrupt_request(); });
-  timerBus_.register_timer_interrupt_request_cb(
-      [&]() { interrupt_flag.set_timer_interrupt_request(); });
-  joypadBus_.register_joypad_interrupt_request_cb(
-      [&]() { interrupt_flag.set_joypad_interrupt_request(); });
+}
+
+void Cpu::set_debugger(Debugger *debugger) {
+  debugger_ = debugger;
+  traps_ = debugger != nullptr ? debugger->traps() : nullptr;
 }
 
 byte_t Cpu::read_(word_t addr) const {
+  if (traps_ != nullptr && (traps_[addr >> 8] & Debugger::TRAP_READ)) {
+    debugger_->on_read_(addr);
+  }
+  if (dma_active_ && dma_conflicts_(addr)) {
+    // Another bus is free, this one has the byte in transfer on it, and OAM
+    // is not there to be read at all.
+    bool oam = util::in_range(addr, mmap::OAM_START, mmap::UNUSED_END);
+    return (oam || dma_done_ == 0) ? 0xFF : memory_.oam()[dma_done_ - 1];
+  }
+  return bus_read_(addr);
+}
+
+byte_t Cpu::bus_read_(word_t addr) const {
   // cartridge rom
   if (util::in_range(addr, mmap::CARTRIDGE_ROM_START,
                      mmap::CARTRIDGE_ROM_END)) {
@@ -55,55 +80,61 @@ byte_t Cpu::read_(word_t addr) const {
 
   // vram
   if (util::in_range(addr, mmap::VRAM_START, mmap::VRAM_END)) {
-    return ppuBus_.vram.at(addr - mmap::VRAM_START);
+    return memory_.vram()[addr - mmap::VRAM_START];
   }
 
   // cartridge ram
   if (util::in_range(addr, mmap::CARTRIDGE_RAM_START,
                      mmap::CARTRIDGE_RAM_END)) {
-    return memory_.read(addr);
+    return cartridge_.read(addr);
   }
 
   // work ram
   if (util::in_range(addr, mmap::WORK_RAM_START, mmap::WORK_RAM_END)) {
-    return memory_.read(addr);
+    return memory_.work_ram()[addr - mmap::WORK_RAM_START];
   }
 
   // echo work ram
   if (util::in_range(addr, mmap::ECHO_WORK_RAM_START,
                      mmap::ECHO_WORK_RAM_END)) {
     log_warn("reading from echo ram [%x]", addr);
-    return memory_.read(addr - 0x2000);
+    return memory_.work_ram()[addr - mmap::ECHO_WORK_RAM_START];
   }
 
   // oam
   if (util::in_range(addr, mmap::OAM_START, mmap::OAM_END)) {
-    return ppuBus_.oam.at(addr - mmap::OAM_START);
+    return memory_.oam()[addr - mmap::OAM_START];
   }
 
   // unused
   if (util::in_range(addr, mmap::UNUSED_START, mmap::UNUSED_END)) {
     // log_warn("reading from unused ram [%x]", addr);
-    return memory_.read(addr);
+    return memory_.unused()[addr - mmap::UNUSED_START];
   }
 
   // i/o registers
   if (util::in_range(addr, mmap::IO_REGISTERS_START, mmap::IO_REGISTERS_END)) {
+    if (util::in_range(addr, mmap::apu::START, mmap::apu::END)) {
+      return apu_.read(addr);
+    }
+
     switch (addr) {
       case mmap::joypad::JOYP:
         return joypadBus_.joyp.value();
 
+      case mmap::serial::SB:
+        return serialBus_.data.value();
+      case mmap::serial::SC:
+        return serialBus_.control.value() | 0x7E;  // unused bits read 1
+
       case mmap::timer::DIV:
-        return timerBus_.divider.value();
       case mmap::timer::TIMA:
-        return timerBus_.timer_counter.value();
       case mmap::timer::TMA:
-        return timerBus_.timer_modulo.value();
       case mmap::timer::TAC:
-        return timerBus_.timer_control.value();
+        return timer_.read(addr);
 
       case mmap::INTERRUPTS_FLAG:
-        return interrupt_flag.value();
+        return interrupts_.flag();
 
       case mmap::ppu::LCD_CONTROL:
         return ppuBus_.lcd_control.value();
@@ -114,7 +145,7 @@ byte_t Cpu::read_(word_t addr) const {
       case mmap::ppu::SCROLL_X:
         return ppuBus_.scroll_x.value();
       case mmap::ppu::LINE:
-        return ppuBus_.line.value();
+        return stub_ly_ ? 0x90 : ppuBus_.line.value();
       case mmap::ppu::LY_COMPARE:
         return ppuBus_.ly_compare.value();
       case mmap::ppu::DMA_TRANSFER:
@@ -134,17 +165,17 @@ byte_t Cpu::read_(word_t addr) const {
         return boot_rom_control.value();
 
       default:
-        return memory_.read(addr);
+        return memory_.io()[addr - mmap::IO_REGISTERS_START];
     }
   }
 
   // zero page
   if (util::in_range(addr, mmap::ZERO_PAGE_START, mmap::ZERO_PAGE_END)) {
-    return memory_.read(addr);
+    return memory_.high_ram()[addr - mmap::ZERO_PAGE_START];
   }
 
   if (addr == mmap::INTERRUPTS_ENABLED) {
-    return interrupt_enable.value();
+    return interrupts_.enable();
   }
 
   log_error("could not read from address 0x%x", addr);
@@ -152,30 +183,37 @@ byte_t Cpu::read_(word_t addr) const {
 }
 
 void Cpu::write_(word_t addr, byte_t byte) {
-  // cartridge rom
+  if (traps_ != nullptr && (traps_[addr >> 8] & Debugger::TRAP_WRITE)) {
+    debugger_->on_write_(addr, byte);
+  }
+  if (dma_active_ && dma_conflicts_(addr)) {
+    return;
+  }
+
+  // cartridge rom (memory bank controller)
   if (util::in_range(addr, mmap::CARTRIDGE_ROM_START,
                      mmap::CARTRIDGE_ROM_END)) {
-    memory_.write(addr, byte);
+    cartridge_.write(addr, byte);
     return;
   }
 
   // vram
   if (util::in_range(addr, mmap::VRAM_START, mmap::VRAM_END)) {
     // TODO: NOT ALWAYS!!!!
-    ppuBus_.vram.at(addr - mmap::VRAM_START) = byte;
+    memory_.vram()[addr - mmap::VRAM_START] = byte;
     return;
   }
 
   // cartridge ram
   if (util::in_range(addr, mmap::CARTRIDGE_RAM_START,
                      mmap::CARTRIDGE_RAM_END)) {
-    memory_.write(addr, byte);
+    cartridge_.write(addr, byte);
     return;
   }
 
   // work ram
   if (util::in_range(addr, mmap::WORK_RAM_START, mmap::WORK_RAM_END)) {
-    memory_.write(addr, byte);
+    memory_.work_ram()[addr - mmap::WORK_RAM_START] = byte;
     return;
   }
 
@@ -183,47 +221,52 @@ void Cpu::write_(word_t addr, byte_t byte) {
   if (util::in_range(addr, mmap::ECHO_WORK_RAM_START,
                      mmap::ECHO_WORK_RAM_END)) {
     log_warn("writing to echo ram [%x]", addr);
-    memory_.write(addr - 0x2000, byte);
+    memory_.work_ram()[addr - mmap::ECHO_WORK_RAM_START] = byte;
     return;
   }
 
   // oam
   if (util::in_range(addr, mmap::OAM_START, mmap::OAM_END)) {
-    ppuBus_.oam.at(addr - mmap::OAM_START) = byte;
+    memory_.oam()[addr - mmap::OAM_START] = byte;
     return;
   }
 
   // unused
   if (util::in_range(addr, mmap::UNUSED_START, mmap::UNUSED_END)) {
     // log_warn("writing to unused ram [%x]", addr);
-    memory_.write(addr, byte);
+    memory_.unused()[addr - mmap::UNUSED_START] = byte;
     return;
   }
 
   // i/o registers
   if (util::in_range(addr, mmap::IO_REGISTERS_START, mmap::IO_REGISTERS_END)) {
+    if (util::in_range(addr, mmap::apu::START, mmap::apu::END)) {
+      apu_.write(addr, byte);
+      return;
+    }
+
     switch (addr) {
       case mmap::joypad::JOYP:
         // hack to make sure that no buttons are pressed?
         joypadBus_.joyp.set(byte | 0b1111);
         return;
 
-      case mmap::timer::DIV:
-        // DIV register -- writes 0 on attempt
-        timerBus_.divider.set(0);
+      case mmap::serial::SB:
+        serialBus_.data.set(byte);
         return;
-      case mmap::timer::TIMA:
-        timerBus_.timer_counter.set(byte);
+      case mmap::serial::SC:
+        serialBus_.control.set(byte & 0x81);
         return;
+
+      case mmap::timer::DIV:
+      case mmap::timer::TIMA:
       case mmap::timer::TMA:
-        timerBus_.timer_modulo.set(byte);
-        return;
       case mmap::timer::TAC:
-        timerBus_.timer_control.set(byte);
+        timer_.write(addr, byte);
         return;
 
       case mmap::INTERRUPTS_FLAG:
-        interrupt_flag.set(byte);
+        interrupts_.set_flag(byte);
         return;
 
       case mmap::ppu::LCD_CONTROL:
@@ -269,19 +312,19 @@ void Cpu::write_(word_t addr, byte_t byte) {
         return;
 
       default:
-        memory_.write(addr, byte);
+        memory_.io()[addr - mmap::IO_REGISTERS_START] = byte;
         return;
     }
   }
 
   // zero page
   if (util::in_range(addr, mmap::ZERO_PAGE_START, mmap::ZERO_PAGE_END)) {
-    memory_.write(addr, byte);
+    memory_.high_ram()[addr - mmap::ZERO_PAGE_START] = byte;
     return;
   }
 
   if (addr == mmap::INTERRUPTS_ENABLED) {
-    interrupt_enable.set(byte);
+    interrupts_.set_enable(byte);
     return;
   }
 
@@ -290,20 +333,129 @@ void Cpu::write_(word_t addr, byte_t byte) {
 }
 
 void Cpu::dma_transfer_(byte_t byte) {
-  word_t source_base = static_cast<word_t>(byte) << 8;
-  for (word_t offset = 0; offset <= 0x009F; ++offset) {
-    ppuBus_.oam.at(offset) = read_(source_base + offset);
+  word_t source = static_cast<word_t>(byte) << 8;
+  if (!accurate_dma_) {
+    dma_copy_(source, 0, OAM_SIZE);
+    return;
   }
+  // The instruction which starts the transfer is its one cycle of setup;
+  // bytes move from the next instruction on. \see dma_tick_
+  dma_active_ = true;
+  dma_started_ = false;
+  dma_source_ = source;
+  dma_done_ = 0;
+}
+
+const byte_t *Cpu::dma_block_(word_t source) const {
+  if (util::in_range(source, mmap::CARTRIDGE_ROM_START,
+                     mmap::CARTRIDGE_ROM_END)) {
+    if (util::in_range(source, mmap::BOOT_ROM_START, mmap::BOOT_ROM_END) &&
+        boot_rom_control.value() == 0x0) {
+      return nullptr;
+    }
+    return cartridge_.rom_block(source, OAM_SIZE);
+  }
+  if (util::in_range(source, mmap::VRAM_START, mmap::VRAM_END)) {
+    return memory_.vram() + (source - mmap::VRAM_START);
+  }
+  if (util::in_range(source, mmap::WORK_RAM_START, mmap::WORK_RAM_END)) {
+    return memory_.work_ram() + (source - mmap::WORK_RAM_START);
+  }
+  if (util::in_range(source, mmap::ECHO_WORK_RAM_START,
+                     mmap::ECHO_WORK_RAM_END)) {
+    return memory_.work_ram() + (source - mmap::ECHO_WORK_RAM_START);
+  }
+  // Cartridge RAM may be disabled, banked or a clock, and the rest is I/O.
+  return nullptr;
+}
+
+void Cpu::dma_copy_(word_t source, word_t from, word_t to) {
+  if (const byte_t *block = dma_block_(source)) {
+    std::memcpy(memory_.oam() + from, block + from, to - from);
+    return;
+  }
+  for (word_t offset = from; offset < to; ++offset) {
+    memory_.oam()[offset] = bus_read_(source + offset);
+  }
+}
+
+void Cpu::dma_tick_(mcycles_t cycles) {
+  if (!dma_started_) {
+    dma_started_ = true;
+    return;
+  }
+  // A byte a cycle. Within an instruction, its accesses are not timed, so
+  // the conflicts it sees are those in force when it began.
+  word_t to =
+      static_cast<word_t>(std::min<mcycles_t>(OAM_SIZE, dma_done_ + cycles));
+  dma_copy_(dma_source_, dma_done_, to);
+  dma_done_ = to;
+  dma_active_ = dma_done_ < OAM_SIZE;
+}
+
+bool Cpu::dma_conflicts_(word_t addr) const {
+  if (util::in_range(addr, mmap::OAM_START, mmap::UNUSED_END)) {
+    return true;
+  }
+  if (addr >= mmap::IO_REGISTERS_START) {
+    return false;  // I/O and high RAM, which the CPU keeps to during DMA
+  }
+  // The other bus is free: VRAM has its own, and everything else shares the
+  // external one.
+  return util::in_range(addr, mmap::VRAM_START, mmap::VRAM_END) ==
+         util::in_range(dma_source_, mmap::VRAM_START, mmap::VRAM_END);
+}
+
+void Cpu::trace_instruction_() {
+  TraceRecord record;
+  record.a = a.value();
+  record.f = f.value();
+  record.b = b.value();
+  record.c = c.value();
+  record.d = d.value();
+  record.e = e.value();
+  record.h = h.value();
+  record.l = l.value();
+  record.sp = sp.value();
+  record.pc = pc.value();
+  record.cycles = cycles_;
+  // Off the bus, so that tracing neither trips read watchpoints nor sees
+  // what an accurate DMA would show the CPU instead of the code.
+  for (word_t i = 0; i < 4; ++i) {
+    record.pcmem[i] = bus_read_(static_cast<word_t>(pc.value() + i));
+  }
+  trace_->record(record);
 }
 
 mcycles_t Cpu::tick() {
+  mcycles_t cycles = execute_();
+  if (dma_active_ && cycles != STOPPED) {
+    dma_tick_(cycles);
+  }
+  return cycles;
+}
+
+mcycles_t Cpu::execute_() {
   check_interrupts();
 
   if (halted_ || stopped_) {
+    BUGME_PROFILE(profiler_.halted(4));
     return 1;
   }
 
+  if (traps_ != nullptr &&
+      (traps_[pc.value() >> 8] & Debugger::TRAP_EXEC) &&
+      debugger_->on_exec_(pc.value())) {
+    return STOPPED;
+  }
+
+  if (trace_) {
+    trace_instruction_();
+  }
+  ++instructions_;
+
   // word_t old_pc = pc.value();
+  BUGME_PROFILE(word_t profiled_pc = pc.value());
   byte_t opcode = read_(pc.value());
   next_byte();
   if (opcode == 0x00) {
@@ -321,6 +473,8 @@ mcycles_t Cpu::tick() {
       cycles = opcode::BRANCHED_CYCLES[opcode];
     }
     cycles = opcode::CYCLES[opcode];
+    BUGME_PROFILE(profiler_.instruction(bank_(profiled_pc), profiled_pc,
+                                        opcode, false, cycles * 4));
     /*if (old_pc == pc.value() && opcode != 0x00) {
       log_error("Upcoming tight loop detected. Exiting.");
       exit(2);
@@ -331,6 +485,9 @@ mcycles_t Cpu::tick() {
     log_debug("[cpu] 0x%04X: %s (0xcb 0x%x)", pc.value() - 2,
               opcode::CB_NAMES[opcode].c_str(), opcode);
     cb_op(opcode);
+    BUGME_PROFILE(profiler_.instruction(bank_(profiled_pc), profiled_pc,
+                                        opcode, true,
+                                        opcode::CB_CYCLES[opcode] * 4));
     return opcode::CB_CYCLES[opcode];
   }
 }
@@ -351,38 +508,93 @@ void Cpu::reset() {
   stopped_ = false;
   halted_ = false;
   did_branch_ = false;
+  dma_active_ = false;
+}
+
+void Cpu::save_state(CpuState &state) const {
+  state.a = a.value();
+  state.b = b.value();
+  state.c = c.value();
+  state.d = d.value();
+  state.e = e.value();
+  state.f = f.value();
+  state.h = h.value();
+  state.l = l.value();
+  state.sp = sp.value();
+  state.pc = pc.value();
+  state.interrupt_master_enable = interrupt_master_enable;
+  state.interrupt_enable = interrupts_.enable();
+  state.interrupt_flag = interrupts_.flag();
+  state.boot_rom_control = boot_rom_control.value();
+  state.stopped = stopped_;
+  state.halted = halted_;
+  state.did_branch = did_branch_;
+  state.halt_bug_no_step_mode = halt_bug_no_step_mode_;
+  state.dma_active = dma_active_;
+  state.dma_started = dma_started_;
+  state.dma_source = dma_source_;
+  state.dma_done = static_cast<byte_t>(dma_done_);
+}
+
+void Cpu::load_state(const CpuState &state) {
+  a.set(state.a);
+  b.set(state.b);
+  c.set(state.c);
+  d.set(state.d);
+  e.set(state.e);
+  f.set(state.f);
+  h.set(state.h);
+  l.set(state.l);
+  sp.set(state.sp);
+  pc.set(state.pc);
+  interrupt_master_enable = state.interrupt_master_enable;
+  interrupts_.set_enable(state.interrupt_enable);
+  interrupts_.set_flag(state.interrupt_flag);
+  boot_rom_control.set(state.boot_rom_control);
+  stopped_ = state.stopped;
+  halted_ = state.halted;
+  did_branch_ = state.did_branch;
+  halt_bug_no_step_mode_ = state.halt_bug_no_step_mode;
+  dma_active_ = state.dma_active;
+  dma_started_ = state.dma_started;
+  dma_source_ = state.dma_source;
+  dma_done_ = state.dma_done;
 }
 
 void Cpu::check_interrupts() {
-  byte_t fired_interrupts = interrupt_flag.value() & interrupt_enable.value();
+  byte_t fired_interrupts = interrupts_.pending();
   if (!fired_interrupts) {
     return;
   }
 
+  BUGME_EVENT(if (timeline_ && halted_) timeline_->end(Track::Cpu));
   if (interrupt_master_enable) {
     push(pc);
 
     if ((fired_interrupts >> 0) & 1) {
-      interrupt_flag.clear_bit(0);
+      interrupts_.acknowledge(Interrupt::VBLANK);
       pc.set(interrupt_vectors::VBLANK);
       interrupt_master_enable = false;
     } else if ((fired_interrupts >> 1) & 1) {
-      interrupt_flag.clear_bit(1);
+      interrupts_.acknowledge(Interrupt::LCD_STAT);
       pc.set(interrupt_vectors::LCDC_STATUS);
       interrupt_master_enable = false;
     } else if ((fired_interrupts >> 2) & 1) {
-      interrupt_flag.clear_bit(2);
+      interrupts_.acknowledge(Interrupt::TIMER);
       pc.set(interrupt_vectors::TIMER);
       interrupt_master_enable = false;
     } else if ((fired_interrupts >> 3) & 1) {
       pc.set(interrupt_vectors::SERIAL);
-      interrupt_flag.clear_bit(3);
+      interrupts_.acknowledge(Interrupt::SERIAL);
       interrupt_master_enable = false;
     } else if ((fired_interrupts >> 4) & 1) {
       pc.set(interrupt_vectors::JOYPAD);
-      interrupt_flag.clear_bit(4);
+      interrupts_.acknowledge(Interrupt::JOYPAD);
       interrupt_master_enable = false;
     }
+    BUGME_PROFILE(profiler_.call(0, pc.value()));
+    BUGME_EVENT(if (timeline_) timeline_->interrupt(
+        (pc.value() - interrupt_vectors::VBLANK) / 8));
   } else if (halted_) {
     halt_bug_no_step_mode_ = true;
   }
@@ -390,6 +602,15 @@ void Cpu::check_interrupts() {
   halted_ = false;  // unhalt now that we found an interrupt
 }
 
+#ifdef BUGME_PROFILER
+std::size_t Cpu::bank_(word_t addr) const {
+  if (util::in_range(addr, 0x4000, mmap::CARTRIDGE_ROM_END)) {
+    return cartridge_.rom_bank();
+  }
+  return 0;
+}
+#endif
+
 byte_t Cpu::next_byte() {
   byte_t byte = read_(pc.value());
   if (halt_bug_no_step_mode_) {
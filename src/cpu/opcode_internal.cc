@@ -400,7 +400,10 @@ void Cpu::sbc(ByteRegister &reg) {
 
 void Cpu::stop() { stopped_ = true; }
 
-void Cpu::halt() { halted_ = true; }
+void Cpu::halt() {
+  halted_ = true;
+  BUGME_EVENT(if (timeline_) timeline_->begin(Track::Cpu, Event::Halt));
+}
 
 void Cpu::jr() {
   std::int16_t offset = static_cast<std::int8_t>(next_byte());
@@ -666,7 +669,11 @@ void Cpu::push(const WordRegister &reg) {
   write_(sp.value(), reg.low());
 }
 
-void Cpu::ret() { pop(pc); }
+void Cpu::ret() {
+  pop(pc);
+  BUGME_PROFILE(profiler_.ret());
+  BUGME_EVENT(if (timeline_) timeline_->ret());
+}
 
 void Cpu::ret_if(bool condition) {
   if (condition) {
@@ -692,6 +699,8 @@ void Cpu::call() {
   word_t jp_addr = next_word();
   push(pc);
   pc.set(jp_addr);
+  BUGME_PROFILE(profiler_.call(bank_(jp_addr), jp_addr));
+  BUGME_EVENT(if (timeline_) timeline_->call());
 }
 
 void Cpu::call_if(bool condition) {
@@ -733,6 +742,8 @@ void Cpu::cpl() {
 void Cpu::rst(const word_t addr) {
   push(pc);
   pc.set(addr);
+  BUGME_PROFILE(profiler_.call(0, addr));
+  BUGME_EVENT(if (timeline_) timeline_->call());
 }
 
 void Cpu::daa() {
@@ -1,3 +1,479 @@
 #include "debug.hh"
 
-namespace bugme {}
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "cartridge.hh"
+#include "cpu.hh"
+#include "mmap.hh"
+#include "opcode_cycles.hh"
+#include "opcode_names.hh"
+#include "util.hh"
+
+namespace bugme {
+
+namespace {
+inline const char *const HELP =
+    "Numbers are hexadecimal, optionally prefixed with $ or 0x.\n"
+    "  c                      continue\n"
+    "  s [n]                  step n instructions (1)\n"
+    "  n                      step over calls\n"
+    "  b addr[:bank]          break at addr, in any or one ROM bank\n"
+    "  w first[-last] [r|w|rw]  watch reads and/or writes (w)\n"
+    "  d id                   delete a breakpoint or watchpoint\n"
+    "  l                      list breakpoints and watchpoints\n"
+    "  r                      show registers\n"
+    "  x addr [length]        dump memory (40)\n"
+    "  u [addr] [count]       disassemble (at pc, 8)\n"
+    "  q                      quit\n"
+    "An empty line repeats the last command.\n";
+
+bool parse_number(const std::string &text, unsigned long &value) {
+  std::size_t start = 0;
+  if (text.rfind("$", 0) == 0) {
+    start = 1;
+  } else if (text.rfind("0x", 0) == 0 || text.rfind("0X", 0) == 0) {
+    start = 2;
+  }
+  if (start == text.size()) {
+    return false;
+  }
+  char *end = nullptr;
+  value = std::strtoul(text.c_str() + start, &end, 16);
+  return *end == '\0';
+}
+
+bool parse_address(const std::string &text, word_t &addr) {
+  unsigned long value;
+  if (!parse_number(text, value) || value > 0xFFFF) {
+    return false;
+  }
+  addr = static_cast<word_t>(value);
+  return true;
+}
+
+/** \return Where name has operand as a word of its own, or npos. */
+std::size_t find_operand(const std::string &name, const std::string &operand) {
+  for (std::size_t i = name.find(operand); i != std::string::npos;
+       i = name.find(operand, i + 1)) {
+    std::size_t after = i + operand.size();
+    if ((i == 0 || !std::isalnum(static_cast<unsigned char>(name[i - 1]))) &&
+        (after == name.size() ||
+         !std::isalnum(static_cast<unsigned char>(name[after])))) {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+}  // namespace
+
+Debugger::Debugger(Cpu &cpu) : cpu_(cpu) {}
+
+void Debugger::interrupt() {
+  if (pending_.empty()) {
+    pending_ = "interrupted";
+  }
+  arm_();
+}
+
+bool Debugger::prompt() {
+  char line[256];
+  for (;;) {
+    std::printf("(bugme) ");
+    std::fflush(stdout);
+    if (std::fgets(line, sizeof(line), stdin) == nullptr) {
+      std::printf("\n");
+      return false;
+    }
+    std::string command(line);
+    while (!command.empty() &&
+           std::isspace(static_cast<unsigned char>(command.back()))) {
+      command.pop_back();
+    }
+    if (command.empty()) {
+      command = last_command_;
+    } else {
+      last_command_ = command;
+    }
+
+    switch (command_(command)) {
+      case Action::Resume:
+        return true;
+      case Action::Quit:
+        return false;
+      case Action::Stay:
+        break;
+    }
+  }
+}
+
+unsigned int Debugger::add_breakpoint(word_t addr,
+                                      std::optional<std::size_t> bank) {
+  breakpoints_.push_back({next_id_, addr, bank});
+  arm_();
+  return next_id_++;
+}
+
+unsigned int Debugger::add_watchpoint(word_t first, word_t last, bool read,
+                                      bool write) {
+  watchpoints_.push_back({next_id_, first, last, read, write});
+  arm_();
+  return next_id_++;
+}
+
+bool Debugger::remove(unsigned int id) {
+  for (auto it = breakpoints_.begin(); it != breakpoints_.end(); ++it) {
+    if (it->id == id) {
+      breakpoints_.erase(it);
+      arm_();
+      return true;
+    }
+  }
+  for (auto it = watchpoints_.begin(); it != watchpoints_.end(); ++it) {
+    if (it->id == id) {
+      watchpoints_.erase(it);
+      arm_();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Debugger::on_exec_(word_t pc) {
+  if (!pending_.empty()) {
+    return stop_(pending_);
+  }
+  // Resuming from a breakpoint executes the instruction it stopped before.
+  bool resumed = resumed_at_ == pc;
+  resumed_at_.reset();
+
+  if (stepping_) {
+    if (steps_ == 0) {
+      return stop_("");
+    }
+    --steps_;
+  }
+  if (over_pc_ && pc == *over_pc_ && cpu_.sp.value() >= over_sp_) {
+    return stop_("");
+  }
+  if (!resumed) {
+    if (const Breakpoint *breakpoint = breakpoint_at_(pc)) {
+      return stop_("breakpoint " + std::to_string(breakpoint->id));
+    }
+  }
+  return false;
+}
+
+void Debugger::on_read_(word_t addr) {
+  if (!pending_.empty()) {
+    return;
+  }
+  for (const Watchpoint &watchpoint : watchpoints_) {
+    if (watchpoint.read &&
+        util::in_range(addr, watchpoint.first, watchpoint.last)) {
+      char reason[64];
+      std::snprintf(reason, sizeof(reason),
+                    "watchpoint %u: read $%02X from $%04X", watchpoint.id,
+                    cpu_.bus_read_(addr), addr);
+      pending_ = reason;
+      arm_();
+      return;
+    }
+  }
+}
+
+void Debugger::on_write_(word_t addr, byte_t byte) {
+  if (!pending_.empty()) {
+    return;
+  }
+  for (const Watchpoint &watchpoint : watchpoints_) {
+    if (watchpoint.write &&
+        util::in_range(addr, watchpoint.first, watchpoint.last)) {
+      char reason[64];
+      std::snprintf(reason, sizeof(reason),
+                    "watchpoint %u: write $%02X to $%04X (was $%02X)",
+                    watchpoint.id, byte, addr, cpu_.bus_read_(addr));
+      pending_ = reason;
+      arm_();
+      return;
+    }
+  }
+}
+
+Debugger::Action Debugger::command_(const std::string &line) {
+  std::istringstream in(line);
+  std::string name;
+  in >> name;
+  std::vector<std::string> args;
+  for (std::string arg; in >> arg;) {
+    args.push_back(arg);
+  }
+
+  if (name.empty()) {
+    return Action::Stay;
+  } else if (name == "c" || name == "continue") {
+    resume_(0);
+    return Action::Resume;
+  } else if (name == "s" || name == "step") {
+    unsigned long steps = 1;
+    if (!args.empty() && (!parse_number(args[0], steps) || steps == 0)) {
+      std::printf("usage: s [n]\n");
+      return Action::Stay;
+    }
+    resume_(static_cast<unsigned int>(steps));
+    return Action::Resume;
+  } else if (name == "n" || name == "next") {
+    step_over_();
+    return Action::Resume;
+  } else if (name == "b" || name == "break") {
+    std::string addr_text = args.empty() ? "" : args[0];
+    std::string bank_text;
+    std::size_t colon = addr_text.find(':');
+    if (colon != std::string::npos) {
+      bank_text = addr_text.substr(colon + 1);
+      addr_text.resize(colon);
+    }
+    word_t addr;
+    unsigned long bank = 0;
+    if (!parse_address(addr_text, addr) ||
+        (colon != std::string::npos && !parse_number(bank_text, bank))) {
+      std::printf("usage: b addr[:bank]\n");
+      return Action::Stay;
+    }
+    std::optional<std::size_t> in_bank;
+    if (colon != std::string::npos) {
+      in_bank = static_cast<std::size_t>(bank);
+    }
+    unsigned int id = add_breakpoint(addr, in_bank);
+    std::printf("breakpoint %u at $%04X\n", id, addr);
+  } else if (name == "w" || name == "watch") {
+    std::string first_text = args.empty() ? "" : args[0];
+    std::string last_text = first_text;
+    std::size_t dash = first_text.find('-');
+    if (dash != std::string::npos) {
+      last_text = first_text.substr(dash + 1);
+      first_text.resize(dash);
+    }
+    std::string mode = args.size() > 1 ? args[1] : "w";
+    word_t first, last;
+    if (!parse_address(first_text, first) || !parse_address(last_text, last) ||
+        last < first || (mode != "r" && mode != "w" && mode != "rw")) {
+      std::printf("usage: w first[-last] [r|w|rw]\n");
+      return Action::Stay;
+    }
+    unsigned int id =
+        add_watchpoint(first, last, mode != "w", mode != "r");
+    std::printf("watchpoint %u on $%04X-$%04X\n", id, first, last);
+  } else if (name == "d" || name == "delete") {
+    if (args.empty() ||
+        !remove(static_cast<unsigned int>(
+            std::strtoul(args[0].c_str(), nullptr, 10)))) {
+      std::printf("no such breakpoint or watchpoint\n");
+    }
+  } else if (name == "l" || name == "list") {
+    for (const Breakpoint &breakpoint : breakpoints_) {
+      std::printf("%3u  break  $%04X", breakpoint.id, breakpoint.addr);
+      if (breakpoint.bank) {
+        std::printf(" in bank %zu", *breakpoint.bank);
+      }
+      std::printf("\n");
+    }
+    for (const Watchpoint &watchpoint : watchpoints_) {
+      std::printf("%3u  watch  $%04X-$%04X %s%s\n", watchpoint.id,
+                  watchpoint.first, watchpoint.last,
+                  watchpoint.read ? "r" : "", watchpoint.write ? "w" : "");
+    }
+  } else if (name == "r" || name == "regs") {
+    print_registers_();
+  } else if (name == "x") {
+    word_t addr;
+    unsigned long length = 0x40;
+    if (args.empty() || !parse_address(args[0], addr) ||
+        (args.size() > 1 && !parse_number(args[1], length))) {
+      std::printf("usage: x addr [length]\n");
+      return Action::Stay;
+    }
+    print_memory_(addr, static_cast<unsigned int>(length));
+  } else if (name == "u") {
+    word_t addr = cpu_.pc.value();
+    unsigned long count = 8;
+    if ((!args.empty() && !parse_address(args[0], addr)) ||
+        (args.size() > 1 && !parse_number(args[1], count))) {
+      std::printf("usage: u [addr] [count]\n");
+      return Action::Stay;
+    }
+    print_disassembly_(addr, static_cast<unsigned int>(count));
+  } else if (name == "q" || name == "quit") {
+    return Action::Quit;
+  } else if (name == "h" || name == "help") {
+    std::printf("%s", HELP);
+  } else {
+    std::printf("unknown command %s; h for help\n", name.c_str());
+  }
+  return Action::Stay;
+}
+
+void Debugger::resume_(unsigned int steps) {
+  stopped_ = false;
+  stepping_ = steps > 0;
+  steps_ = steps;
+  resumed_at_ = cpu_.pc.value();
+  arm_();
+}
+
+void Debugger::step_over_() {
+  word_t pc = cpu_.pc.value();
+  byte_t opcode = cpu_.bus_read_(pc);
+  // CALL, CALL cc and RST
+  bool call = opcode == 0xCD || (opcode & 0xE7) == 0xC4 ||
+              (opcode & 0xC7) == 0xC7;
+  if (!call) {
+    resume_(1);
+    return;
+  }
+  over_pc_ = static_cast<word_t>(pc + opcode::LENGTHS[opcode]);
+  over_sp_ = cpu_.sp.value();
+  resume_(0);
+}
+
+bool Debugger::stop_(std::string reason) {
+  stopped_ = true;
+  pending_.clear();
+  stepping_ = false;
+  steps_ = 0;
+  over_pc_.reset();
+  arm_();
+
+  if (!reason.empty()) {
+    std::printf("%s\n", reason.c_str());
+  }
+  print_disassembly_(cpu_.pc.value(), 1);
+  return true;
+}
+
+void Debugger::arm_() {
+  std::memset(traps_, (stepping_ || !pending_.empty()) ? TRAP_EXEC : 0,
+              sizeof(traps_));
+  for (const Breakpoint &breakpoint : breakpoints_) {
+    traps_[breakpoint.addr >> 8] |= TRAP_EXEC;
+  }
+  for (const Watchpoint &watchpoint : watchpoints_) {
+    byte_t flags = static_cast<byte_t>((watchpoint.read ? TRAP_READ : 0) |
+                                       (watchpoint.write ? TRAP_WRITE : 0));
+    for (unsigned int page = watchpoint.first >> 8;
+         page <= static_cast<unsigned int>(watchpoint.last >> 8); ++page) {
+      traps_[page] |= flags;
+    }
+  }
+  if (over_pc_) {
+    traps_[*over_pc_ >> 8] |= TRAP_EXEC;
+  }
+}
+
+const Debugger::Breakpoint *Debugger::breakpoint_at_(word_t pc) const {
+  for (const Breakpoint &breakpoint : breakpoints_) {
+    if (breakpoint.addr == pc &&
+        (!breakpoint.bank || *breakpoint.bank == bank_(pc))) {
+      return &breakpoint;
+    }
+  }
+  return nullptr;
+}
+
+std::size_t Debugger::bank_(word_t addr) const {
+  if (util::in_range(addr, 0x4000, mmap::CARTRIDGE_ROM_END)) {
+    return cpu_.cartridge_.rom_bank();
+  }
+  return 0;
+}
+
+void Debugger::print_registers_() const {
+  const FlagRegister &f = cpu_.f;
+  std::printf(
+      "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X "
+      "SP:%04X PC:%04X\n"
+      "flags:%c%c%c%c IME:%d IE:%02X IF:%02X bank:%zu cycles:%llu%s\n",
+      cpu_.a.value(), f.value(), cpu_.b.value(), cpu_.c.value(),
+      cpu_.d.value(), cpu_.e.value(), cpu_.h.value(), cpu_.l.value(),
+      cpu_.sp.value(), cpu_.pc.value(), f.zero_flag() ? 'Z' : '-',
+      f.subtract_flag() ? 'N' : '-', f.half_carry_flag() ? 'H' : '-',
+      f.carry_flag() ? 'C' : '-', cpu_.interrupt_master_enable ? 1 : 0,
+      cpu_.interrupts_.enable(), cpu_.interrupts_.flag(),
+      cpu_.cartridge_.rom_bank(),
+      static_cast<unsigned long long>(cpu_.cycles_),
+      cpu_.halted_ ? " halted" : "");
+}
+
+void Debugger::print_memory_(word_t addr, unsigned int length) const {
+  for (unsigned int row = 0; row < length; row += 16) {
+    word_t start = static_cast<word_t>(addr + row);
+    std::printf("%04X ", start);
+    for (unsigned int i = row; i < row + 16 && i < length; ++i) {
+      std::printf(" %02X", cpu_.bus_read_(static_cast<word_t>(addr + i)));
+    }
+    std::printf("\n");
+  }
+}
+
+word_t Debugger::print_disassembly_(word_t addr, unsigned int count) const {
+  for (unsigned int i = 0; i < count; ++i) {
+    word_t length;
+    std::string text = disassemble_(addr, length);
+    std::printf("%c %04X ", addr == cpu_.pc.value() ? '>' : ' ', addr);
+    for (word_t b = 0; b < 3; ++b) {
+      if (b < length) {
+        std::printf(" %02X", cpu_.bus_read_(static_cast<word_t>(addr + b)));
+      } else {
+        std::printf("   ");
+      }
+    }
+    std::printf("  %s\n", text.c_str());
+    addr = static_cast<word_t>(addr + length);
+  }
+  return addr;
+}
+
+std::string Debugger::disassemble_(word_t addr, word_t &length) const {
+  auto at = [&](word_t offset) {
+    return cpu_.bus_read_(static_cast<word_t>(addr + offset));
+  };
+  byte_t opcode = at(0);
+  if (opcode == 0xCB) {
+    length = 2;
+    return opcode::CB_NAMES[at(1)];
+  }
+  // Illegal opcodes have no length in the table; they take up one byte.
+  length = opcode::LENGTHS[opcode] == 0 ? 1 : opcode::LENGTHS[opcode];
+  std::string name = opcode::NAMES[opcode];
+
+  char operand[8];
+  if (length == 3) {
+    std::snprintf(operand, sizeof(operand), "$%04X", util::fuse(at(2), at(1)));
+    std::size_t i = find_operand(name, "nn");
+    if (i != std::string::npos) {
+      name.replace(i, 2, operand);
+    }
+  } else if (length == 2) {
+    byte_t n = at(1);
+    if (opcode == 0x18 || (opcode & 0xE7) == 0x20) {
+      // JR: show where it jumps to
+      std::snprintf(operand, sizeof(operand), "$%04X",
+                    static_cast<word_t>(addr + 2 +
+                                        static_cast<signed_byte_t>(n)));
+    } else {
+      std::snprintf(operand, sizeof(operand), "$%02X", n);
+    }
+    std::size_t i = find_operand(name, "n");
+    if (i != std::string::npos) {
+      name.replace(i, 1, operand);
+    } else if (opcode == 0xF8) {
+      name += std::string("+") + operand;  // LD HL,SP+n
+    }
+  }
+  return name;
+}
+
+}  // namespace bugme
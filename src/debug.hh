@@ -1,10 +1,140 @@
 #ifndef BUGME_DEBUG_HH
 #define BUGME_DEBUG_HH
 
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "types.hh"
+
 namespace bugme {
-class Debug {
-  Debug() = default;
-  virtual ~Debug() = default;
+
+class Cpu;
+
+/**
+ * An interactive debugger: breakpoints on PC (and ROM bank), watchpoints on
+ * reads and writes of address ranges, stepping, and dumps of the registers,
+ * memory and disassembly, driven by commands read from stdin.
+ *
+ * It costs the CPU next to nothing while no breakpoint or watchpoint is near.
+ * The debugger keeps trap flags per 256-byte page of the address space, and
+ * the CPU only calls into it for an instruction or an access on a flagged
+ * page; everywhere else, a table lookup is all it pays, and without a
+ * debugger, not even that. Stepping and watchpoint hits, which need to stop
+ * before whatever instruction comes next, flag every page for as long as
+ * that takes.
+ *
+ * The machine stops before the instruction at a breakpoint, and after the
+ * instruction which hit a watchpoint.
+ *
+ * \see Machine::enable_debugger
+ */
+class Debugger : public Noncopyable {
+ public:
+  /** Flags in traps(). */
+  static constexpr byte_t TRAP_EXEC = 0x01;
+  static constexpr byte_t TRAP_READ = 0x02;
+  static constexpr byte_t TRAP_WRITE = 0x04;
+
+  explicit Debugger(Cpu &cpu);
+
+  /** \return Whether the machine is stopped, waiting on prompt(). */
+  bool stopped() const { return stopped_; }
+
+  /** Stops the machine before its next instruction. */
+  void interrupt();
+
+  /**
+   * Reads commands from stdin and runs them, until one resumes the machine.
+   *
+   * \return false if the user quit.
+   */
+  bool prompt();
+
+  /**
+   * \param bank The ROM bank, for addresses in 0x4000-0x7FFF; or none, to
+   *        break in any bank.
+   * \return The breakpoint's number.
+   */
+  unsigned int add_breakpoint(word_t addr,
+                              std::optional<std::size_t> bank = {});
+  /** \return The watchpoint's number. */
+  unsigned int add_watchpoint(word_t first, word_t last, bool read,
+                              bool write);
+  /** \return false if there is no breakpoint or watchpoint numbered id. */
+  bool remove(unsigned int id);
+
+  /** The trap flags, one byte per page, which the CPU consults. */
+  const byte_t *traps() const { return traps_; }
+
+ private:
+  friend class Cpu;
+
+  struct Breakpoint {
+    unsigned int id;
+    word_t addr;
+    std::optional<std::size_t> bank;
+  };
+
+  struct Watchpoint {
+    unsigned int id;
+    word_t first, last;
+    bool read, write;
+  };
+
+  enum class Action { Stay, Resume, Quit };
+
+  /**
+   * Called before the instruction at pc, on a page flagged TRAP_EXEC.
+   *
+   * \return Whether to stop before it.
+   */
+  bool on_exec_(word_t pc);
+  /** Called before an access to addr, on a page flagged to trap it. */
+  void on_read_(word_t addr);
+  void on_write_(word_t addr, byte_t byte);
+
+  Action command_(const std::string &line);
+  /** Lets the machine run on, stepping steps instructions if not 0. */
+  void resume_(unsigned int steps);
+  /** Runs on until the instruction after this one, over any call. */
+  void step_over_();
+  bool stop_(std::string reason);
+  /** Recomputes traps_ from the breakpoints, watchpoints and stepping. */
+  void arm_();
+
+  /** \return The breakpoint at pc, in the current bank, if there is one. */
+  const Breakpoint *breakpoint_at_(word_t pc) const;
+  std::size_t bank_(word_t addr) const;
+
+  void print_registers_() const;
+  void print_memory_(word_t addr, unsigned int length) const;
+  /** Prints count instructions from addr. \return The address after them. */
+  word_t print_disassembly_(word_t addr, unsigned int count) const;
+  std::string disassemble_(word_t addr, word_t &length) const;
+
+  Cpu &cpu_;
+  byte_t traps_[0x100] = {};
+
+  std::vector<Breakpoint> breakpoints_;
+  std::vector<Watchpoint> watchpoints_;
+  unsigned int next_id_ = 1;
+
+  bool stopped_ = false;
+  /** Why to stop before the next instruction, if it is to. */
+  std::string pending_;
+  /** Instructions left to step, while stepping. */
+  unsigned int steps_ = 0;
+  bool stepping_ = false;
+  /** Where a step over a call comes back to, if one is underway. */
+  std::optional<word_t> over_pc_;
+  word_t over_sp_ = 0;
+  /** The breakpoint just stopped at, which is not to stop us again. */
+  std::optional<word_t> resumed_at_;
+
+  std::string last_command_;
 };
+
 }  // namespace bugme
 #endif
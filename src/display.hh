@@ -3,14 +3,16 @@
 
 #include <vector>
 
+#include "types.hh"
+
 namespace bugme {
 
-enum class Color;
+enum class Color : byte_t;
 
 class Display {
  public:
   virtual ~Display() = default;
-  virtual void draw(std::vector<Color> &) = 0;
+  virtual void draw(const std::vector<Color> &) = 0;
 };
 
 }  // namespace bugme
@@ -10,6 +10,7 @@ namespace exit {
 inline exitno_t EXIT_ERROR = 0;
 inline exitno_t EXIT_WINDOW_CLOSE = 1;
 inline exitno_t EXIT_SIGINT = 2;
+inline exitno_t EXIT_MOVIE_END = 3;
 }  // namespace exit
 
 namespace error {
@@ -3,23 +3,51 @@
 #include <SDL.h>
 #include <SDL_syswm.h>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 
 #include "cartridge.hh"
+#include "color.hh"
 #include "constants.hh"
-#include "cpu.hh"
 #include "joypad.hh"
 #include "log.hh"
-#include "memory.hh"
 #include "options.hh"
-#include "ppu.hh"
+#include "rom_index.hh"
 #include "sdl_display.hh"
-#include "timer.hh"
+#include "timeline.hh"
+#include "util.hh"
 
 namespace bugme {
 
+namespace {
+inline const unsigned int AUDIO_SAMPLE_RATE = 48000;
+
+/** How far the audio resampling ratio may stray from nominal. */
+inline const double MAX_RATE_ADJUSTMENT = 0.005;
+
+/**
+ * The share of the audio queue's relative error added to the standing rate
+ * adjustment each frame: enough to settle on the display's rate within
+ * seconds, little enough to ride out the jitter of the device's reads.
+ */
+inline const double RATE_INTEGRAL_GAIN = 0.0002;
+
+std::unique_ptr<SdlAudio> open_audio(const Options &options) {
+  if (!options.audio || options.headless) {
+    return nullptr;
+  }
+  auto audio = std::make_unique<SdlAudio>(AUDIO_SAMPLE_RATE);
+  return audio->good() ? std::move(audio) : nullptr;
+}
+}  // namespace
+
 Gbc::Gbc(CliOptions &cli_options)
     : cli_options_(cli_options),
+      audio_(open_audio(cli_options.options)),
       window_(SDL_Init(SDL_INIT_VIDEO) < 0 || cli_options_.options.headless
                   ? nullptr
                   : SDL_CreateWindow(
@@ -29,28 +57,66 @@ Gbc::Gbc(CliOptions &cli_options)
                             SDL_WINDOW_RESIZABLE)),
       renderer_(window_ == nullptr
                     ? nullptr
-                    : SDL_CreateRenderer(window_, -1,
-                                         SDL_RENDERER_ACCELERATED |
-                                             SDL_RENDERER_PRESENTVSYNC)),
+                    : SDL_CreateRenderer(
+                          window_, -1,
+                          SDL_RENDERER_ACCELERATED |
+                              (syncs_to_audio_() ? 0
+                                                 : SDL_RENDERER_PRESENTVSYNC))),
       texture_(renderer_ == nullptr
                    ? nullptr
                    : SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_ARGB8888,
                                        SDL_TEXTUREACCESS_STREAMING,
                                        GAMEBOY_WIDTH, GAMEBOY_HEIGHT)),
-      cartridge(read_rom(cli_options.rom_filename)),
-      memory(),
+      machine_(read_rom(cli_options.rom_filename),
+               get_save_filename(cli_options.rom_filename),
+               cli_options.options.rtc_clock),
       display(renderer_, texture_),
-      ppu([&](std::vector<Color> &buffer) {
-        if (!cli_options.options.headless) {
-          process_events_();
-          display.draw(buffer);
-        }
-      }),
-      timer(),
-      joypad(),
-      cpu(memory, cartridge, ppu, timer, joypad) {}
+      state_filename_(std::filesystem::path(cli_options.rom_filename)
+                          .replace_extension(".state")) {
+  if (cli_options.options.rewind_budget > 0) {
+    rewind_ = std::make_unique<RewindBuffer>(cli_options.options.rewind_budget);
+    rewind_state_.resize(machine_.state_size());
+  }
+  if (cli_options.options.debug) {
+    if (cli_options.options.run_ahead > 0) {
+      // Frames run ahead are thrown away, and any stop in them with them.
+      log_warn("[gbc] run-ahead is off while debugging");
+      cli_options.options.run_ahead = 0;
+    }
+    machine_.enable_debugger().interrupt();
+  }
+  if (cli_options.options.run_ahead > 0) {
+    run_ahead_state_.resize(machine_.state_size());
+  }
+  machine_.set_rendering(renders_real_frames_());
+  machine_.set_accurate_dma(cli_options.options.accurate_dma);
+  if (cli_options.options.print_serial) {
+    machine_.set_serial_output([](byte_t byte) {
+      std::fputc(byte, stdout);
+      std::fflush(stdout);
+    });
+  }
+
+  if (!cli_options.options.trace.empty()) {
+    trace_ = std::make_unique<TraceWriter>(cli_options.options.trace);
+    if (trace_->good()) {
+      machine_.set_trace(trace_.get(), cli_options.options.trace_doctor);
+    }
+  }
+
+  if (audio_) {
+    machine_.set_sample_rate(audio_->sample_rate());
+    audio_samples_.resize(audio_->sample_rate() / 10 * 2);
+    // Three frames' worth: enough to ride out scheduling hiccups.
+    audio_target_ = audio_->sample_rate() / 20;
+  } else if (cli_options.options.sync == Sync::Audio &&
+             !cli_options.options.headless) {
+    log_warn("[gbc] no audio to sync to, syncing to video instead");
+  }
+}
 
 Gbc::~Gbc() {
+  audio_.reset();
   SDL_DestroyTexture(texture_);
   SDL_DestroyRenderer(renderer_);
   SDL_DestroyWindow(window_);
@@ -75,14 +141,336 @@ int Gbc::run() {
       log_set_level(LogLevel::Error);
   }
 
-  mcycles_t cycles;
+  if (!start_movie_()) {
+    return 1;
+  }
+
+  if (!cli_options_.options.load_state.empty() &&
+      !load_state_file(cli_options_.options.load_state)) {
+    return 1;
+  }
+
+#ifndef BUGME_HOST_STATS
+  if (cli_options_.options.stats) {
+    log_warn("[gbc] no stats to show; build with -DBUGME_HOST_STATS=ON");
+  }
+#endif
+  if (!cli_options_.options.timeline.empty()) {
+#ifdef BUGME_TIMELINE
+    machine_.timeline().start_recording();
+#else
+    log_warn("[gbc] no timeline recorded; build with -DBUGME_TIMELINE=ON");
+#endif
+  }
+
+  BUGME_EVENT(std::uint32_t frame = 0);
   while (!should_exit_) {
-    cycles = cpu.tick();
-    ppu.tick(cycles * 4);
-    timer.tick(cycles * 4);
+    {
+      BUGME_STATS(HostStats::Scope scope(machine_.host_stats(),
+                                         Subsystem::Emulation));
+      BUGME_EVENT(Timeline::Scope span(machine_.timeline(), Event::Frame,
+                                       frame++));
+      machine_.run_frame();
+    }
+    Debugger *debugger = machine_.debugger();
+    if (debugger != nullptr && debugger->stopped()) {
+      should_exit_ = !debugger->prompt();
+      continue;
+    }
+    end_frame_();
+    BUGME_STATS(report_stats_());
+  }
+
+  if (movie_writer_) {
+    movie_writer_->finish(frame_cycles_, frame_hash_);
+  }
+
+  if (!cli_options_.options.profile.empty()) {
+#ifdef BUGME_PROFILER
+    machine_.profiler().write(cli_options_.options.profile);
+#else
+    log_warn("[gbc] no profile written; build with -DBUGME_PROFILER=ON");
+#endif
+  }
+#ifdef BUGME_HOST_STATS
+  if (cli_options_.options.stats) {
+    machine_.host_stats().write_totals(stdout);
   }
+#endif
+#ifdef BUGME_TIMELINE
+  if (!cli_options_.options.timeline.empty()) {
+    machine_.timeline().write(cli_options_.options.timeline);
+  }
+#endif
 
-  return 0;
+  return movie_desynced_ ? 1 : 0;
+}
+
+void Gbc::end_frame_() {
+  frame_cycles_ = machine_.cycles();
+  if (audio_) {
+    std::size_t frames =
+        machine_.read_samples(audio_samples_.data(), audio_samples_.size() / 2);
+    audio_->push(audio_samples_.data(), frames);
+  }
+  if (movie_writer_ || movie_reader_) {
+    const std::vector<Color> &frame = machine_.frame_buffer();
+    frame_hash_ = util::fnv1a(reinterpret_cast<const byte_t *>(frame.data()),
+                              frame.size());
+  }
+  if (!cli_options_.options.headless) {
+    process_events_();
+    if (cli_options_.options.run_ahead == 0) {
+      draw_();
+    }
+  }
+
+  if (movie_reader_ && movie_reader_->done(frame_cycles_)) {
+    finish_replay_();
+    return;
+  }
+
+  // Requests from the frontend are deferred to here, between instructions and
+  // outside of Ppu::tick, where the machine state is consistent.
+  switch (pending_state_action_) {
+    case StateAction::NONE:
+      break;
+    case StateAction::SAVE:
+      save_state_file(state_filename_);
+      break;
+    case StateAction::LOAD:
+      if (movie_writer_ || movie_reader_) {
+        log_warn("[gbc] cannot load a save state while a movie is in use");
+        break;
+      }
+      load_state_file(state_filename_);
+      break;
+  }
+  pending_state_action_ = StateAction::NONE;
+
+  if (rewind_) {
+    if (rewinding_) {
+      // Step back one snapshot; the next frame is emulated from there so that
+      // there is something to display.
+      if (rewind_->pop(rewind_state_.data())) {
+        machine_.load_state(rewind_state_.data(), rewind_state_.size());
+      }
+      frames_since_snapshot_ = 0;
+    } else if (++frames_since_snapshot_ >=
+               cli_options_.options.rewind_interval) {
+      frames_since_snapshot_ = 0;
+      machine_.save_state(rewind_state_.data());
+      rewind_->push(rewind_state_.data(), rewind_state_.size());
+    }
+  }
+
+  apply_input_();
+
+  if (cli_options_.options.run_ahead > 0) {
+    run_ahead_();
+  }
+
+  if (audio_) {
+    sync_audio_();
+  }
+}
+
+void Gbc::sync_audio_() {
+  BUGME_STATS(HostStats::Scope scope(machine_.host_stats(), Subsystem::Sync));
+  BUGME_EVENT(Timeline::Scope span(machine_.timeline(), Event::Sync));
+  if (syncs_to_audio_()) {
+    // Emulating faster than the device plays would only overflow the queue,
+    // so wait for it to drain back to the target. That alone keeps it there.
+    while (audio_->queued() > audio_target_ && !should_exit_) {
+      SDL_Delay(1);
+    }
+    return;
+  }
+
+  // Under vsync, nudge the resampling ratio so that the queue settles on its
+  // target: a little more sound per frame while it runs low, a little less
+  // while it runs high. The display's rate differs from the Gameboy's
+  // 59.73 Hz, so holding the queue steady takes a standing adjustment, which
+  // the error is integrated into; the nudge alone would only hold it where
+  // the error is large enough to make up the difference.
+  double fill = static_cast<double>(audio_->queued());
+  double target = static_cast<double>(audio_target_);
+  double error = std::clamp((target - fill) / target, -1.0, 1.0);
+  rate_integral_ = std::clamp(rate_integral_ + RATE_INTEGRAL_GAIN * error,
+                              -MAX_RATE_ADJUSTMENT, MAX_RATE_ADJUSTMENT);
+  double adjustment =
+      std::clamp(MAX_RATE_ADJUSTMENT * error + rate_integral_,
+                 -MAX_RATE_ADJUSTMENT, MAX_RATE_ADJUSTMENT);
+  machine_.set_rate_adjustment(1.0 + adjustment);
+}
+
+bool Gbc::syncs_to_audio_() const {
+  return audio_ && cli_options_.options.sync == Sync::Audio;
+}
+
+void Gbc::run_ahead_() {
+  // Emulate the next few frames with the input just sampled, show the last
+  // one, then put the real machine back. Anything the game does in those
+  // frames is undone by the restore; writes to battery-backed RAM go to a
+  // private copy, so that they never reach the save file.
+  const unsigned int frames = cli_options_.options.run_ahead;
+  {
+    BUGME_STATS(HostStats::Scope scope(machine_.host_stats(),
+                                       Subsystem::Emulation));
+    BUGME_EVENT(Timeline::Scope span(machine_.timeline(), Event::RunAhead,
+                                     frames));
+    // Only the real machine's instructions belong in a trace, and only its
+    // sound in the output.
+    machine_.set_speculative(true);
+    machine_.save_state(run_ahead_state_.data());
+    machine_.set_trace(nullptr);
+    for (unsigned int i = 1; i <= frames; ++i) {
+      machine_.set_rendering(i == frames);
+      machine_.run_frame();
+    }
+  }
+  if (!cli_options_.options.headless) {
+    draw_();
+  }
+
+  machine_.set_rendering(renders_real_frames_());
+  machine_.load_state(run_ahead_state_.data(), run_ahead_state_.size());
+  machine_.set_speculative(false);
+  if (trace_ && trace_->good()) {
+    machine_.set_trace(trace_.get(), cli_options_.options.trace_doctor);
+  }
+}
+
+bool Gbc::renders_real_frames_() const {
+  // A movie hashes every real frame, so those are rendered regardless.
+  return cli_options_.options.run_ahead == 0 || movie_writer_ || movie_reader_;
+}
+
+void Gbc::apply_input_() {
+  if (movie_reader_) {
+    byte_t buttons;
+    while (movie_reader_->next(machine_.cycles(), buttons)) {
+      machine_.set_buttons(buttons);
+    }
+    return;
+  }
+
+  if (input_buttons_ == machine_.buttons()) {
+    return;
+  }
+  machine_.set_buttons(input_buttons_);
+  if (movie_writer_) {
+    movie_writer_->write(machine_.cycles(), input_buttons_);
+  }
+}
+
+bool Gbc::start_movie_() {
+  Options &options = cli_options_.options;
+  if (options.record_movie.empty() && options.play_movie.empty()) {
+    return true;
+  }
+
+  // Movies start from power on, and anything that rewrites the machine state
+  // part way through would make them impossible to replay.
+  if (!options.load_state.empty()) {
+    log_error("[gbc] movies cannot start from a save state");
+    return false;
+  }
+  if (rewind_) {
+    log_warn("[gbc] rewind is disabled while a movie is in use");
+    rewind_.reset();
+  }
+  if (has_rtc(machine_.header().cartridge_type) &&
+      options.rtc_clock != RtcClock::Emulated) {
+    log_warn("[gbc] the real-time clock follows host time, so the movie will "
+             "not replay exactly; use --rtc-clock emulated");
+  }
+
+  const CartridgeHeader &cartridge_header = machine_.header();
+  word_t global_checksum = util::fuse(cartridge_header.global_checksum[0],
+                                      cartridge_header.global_checksum[1]);
+
+  if (!options.play_movie.empty()) {
+    movie_reader_ = std::make_unique<MovieReader>(options.play_movie);
+    if (!movie_reader_->good()) {
+      return false;
+    }
+
+    const MovieFileHeader &header = movie_reader_->header();
+    if (!cartridge_header.matches(header.title, header.global_checksum)) {
+      log_error("[gbc] movie %s belongs to another rom",
+                options.play_movie.c_str());
+      return false;
+    }
+    if (header.rtc_clock != static_cast<byte_t>(options.rtc_clock)) {
+      log_warn("[gbc] movie was recorded with a different --rtc-clock");
+    }
+
+    // Frames shown during replay are exactly the movie's frames.
+    if (options.run_ahead > 0) {
+      log_warn("[gbc] run-ahead is disabled while replaying a movie");
+      options.run_ahead = 0;
+    }
+    machine_.set_rendering(true);
+    return true;
+  }
+
+  MovieFileHeader header = {};
+  std::memcpy(header.title, cartridge_header.title, sizeof(header.title));
+  header.global_checksum = global_checksum;
+  header.rtc_clock = static_cast<byte_t>(options.rtc_clock);
+  movie_writer_ = std::make_unique<MovieWriter>(options.record_movie, header);
+  machine_.set_rendering(true);
+  return movie_writer_->good();
+}
+
+void Gbc::finish_replay_() {
+  const MovieFileHeader &header = movie_reader_->header();
+  movie_desynced_ = frame_hash_ != header.frame_hash;
+  if (movie_desynced_) {
+    log_error("[gbc] movie desynced: frame hash %016llx, expected %016llx",
+              static_cast<unsigned long long>(frame_hash_),
+              static_cast<unsigned long long>(header.frame_hash));
+  }
+
+  std::printf("movie: %llu cycles, frame hash %016llx, %s\n",
+              static_cast<unsigned long long>(frame_cycles_),
+              static_cast<unsigned long long>(frame_hash_),
+              movie_desynced_ ? "mismatch" : "match");
+  exit(exit::EXIT_MOVIE_END);
+}
+
+bool Gbc::save_state_file(const std::string &filename) const {
+  // A vector's storage is suitably aligned for the state structs.
+  std::vector<byte_t> buffer(machine_.state_size());
+  machine_.save_state(buffer.data());
+
+  std::ofstream s(filename, std::ios_base::binary | std::ios_base::trunc);
+  s.write(reinterpret_cast<const char *>(buffer.data()),
+          static_cast<std::streamsize>(buffer.size()));
+  if (!s.good()) {
+    log_error("[gbc] cannot write save state %s", filename.c_str());
+    return false;
+  }
+
+  log_info("[gbc] saved state to %s", filename.c_str());
+  return true;
+}
+
+bool Gbc::load_state_file(const std::string &filename) {
+  std::vector<byte_t> buffer;
+  if (!util::read_file(filename, buffer)) {
+    log_error("[gbc] cannot read save state %s", filename.c_str());
+    return false;
+  }
+
+  if (!machine_.load_state(buffer.data(), buffer.size())) {
+    log_error("[gbc] cannot load save state %s", filename.c_str());
+    return false;
+  }
+
+  log_info("[gbc] loaded state from %s", filename.c_str());
+  return true;
 }
 
 void Gbc::exit(exitno_t exit_code) {
@@ -113,7 +501,36 @@ static Button get_button(int key) {
   return Button::NONE;
 }
 
+void Gbc::draw_() {
+  {
+    BUGME_STATS(HostStats::Scope scope(machine_.host_stats(),
+                                       Subsystem::Render));
+    BUGME_EVENT(Timeline::Scope span(machine_.timeline(), Event::Render));
+    display.render(machine_.frame_buffer());
+  }
+  BUGME_STATS(HostStats::Scope scope(machine_.host_stats(),
+                                     Subsystem::Present));
+  BUGME_EVENT(Timeline::Scope span(machine_.timeline(), Event::Present));
+  display.present();
+}
+
+#ifdef BUGME_HOST_STATS
+void Gbc::report_stats_() {
+  if (!machine_.host_stats().end_frame() || !cli_options_.options.stats) {
+    return;
+  }
+  const std::string &line = machine_.host_stats().line();
+  if (cli_options_.options.headless) {
+    std::printf("%s\n", line.c_str());
+  } else {
+    SDL_SetWindowTitle(window_, ("gbc | " + line).c_str());
+  }
+}
+#endif
+
 void Gbc::process_events_() {
+  BUGME_STATS(HostStats::Scope scope(machine_.host_stats(), Subsystem::Events));
+  BUGME_EVENT(Timeline::Scope span(machine_.timeline(), Event::Input));
   SDL_Event event;
 
   while (SDL_PollEvent(&event) != 0) {
@@ -122,13 +539,27 @@ void Gbc::process_events_() {
         if (event.key.repeat == true) {
           break;
         }
-        joypad.button_down(get_button(event.key.keysym.sym));
+        if (event.key.keysym.sym == SDLK_F5) {
+          pending_state_action_ = StateAction::SAVE;
+        } else if (event.key.keysym.sym == SDLK_F7) {
+          pending_state_action_ = StateAction::LOAD;
+        } else if (event.key.keysym.sym == SDLK_r) {
+          rewinding_ = true;
+        } else if (event.key.keysym.sym == SDLK_F12 &&
+                   machine_.debugger() != nullptr) {
+          machine_.debugger()->interrupt();
+        }
+        input_buttons_ |= button_mask(get_button(event.key.keysym.sym));
         break;
       case SDL_KEYUP:
         if (event.key.repeat == true) {
           break;
         }
-        joypad.button_up(get_button(event.key.keysym.sym));
+        if (event.key.keysym.sym == SDLK_r) {
+          rewinding_ = false;
+        }
+        input_buttons_ &= static_cast<byte_t>(
+            ~button_mask(get_button(event.key.keysym.sym)));
         break;
       case SDL_WINDOWEVENT:
         if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
@@ -140,6 +571,16 @@ void Gbc::process_events_() {
   };
 }
 
+std::string Gbc::get_save_filename(const std::string &rom_filename) const {
+  // Movies must start from the same cartridge RAM every time, so they run
+  // with blank, unsaved RAM.
+  if (!cli_options_.options.record_movie.empty() ||
+      !cli_options_.options.play_movie.empty()) {
+    return "";
+  }
+  return std::filesystem::path(rom_filename).replace_extension(".sav");
+}
+
 std::vector<byte_t> Gbc::read_rom(const std::string &filename) const {
   std::ifstream s(filename.c_str(), std::ios_base::binary | std::ios_base::ate);
   if (!s.good()) {
@@ -148,6 +589,7 @@ std::vector<byte_t> Gbc::read_rom(const std::string &filename) const {
 
   std::ifstream::pos_type position = s.tellg();
   ssize_t file_size = static_cast<ssize_t>(position);
+  check_rom_index_(filename, static_cast<std::size_t>(file_size));
   std::vector<char> file_contents(file_size);
 
   s.seekg(0, std::ios::beg);
@@ -160,4 +602,34 @@ std::vector<byte_t> Gbc::read_rom(const std::string &filename) const {
   return std::vector<byte_t>(file_contents.begin(), file_contents.end());
 }
 
+void Gbc::check_rom_index_(const std::string &filename,
+                           std::size_t file_size) const {
+  if (cli_options_.options.rom_index.empty()) {
+    return;
+  }
+
+  RomIndex index(cli_options_.options.rom_index);
+  const RomIndexEntry *entry = index.find(filename);
+  if (entry == nullptr) {
+    log_warn("[gbc] %s is not in the rom index", filename.c_str());
+    return;
+  }
+
+  if (entry->file_size != file_size) {
+    log_warn("[gbc] rom index entry for %s is stale, rescan the library",
+             filename.c_str());
+    return;
+  }
+
+  log_info("[gbc] rom index: %s, %u KB rom, %u KB ram",
+           get_readable_mbc_mode(entry->cartridge_type).c_str(),
+           entry->rom_size / 1024, entry->ram_size / 1024);
+  if (!entry->header_checksum_ok()) {
+    log_warn("[gbc] header checksum mismatch, the boot rom will lock up");
+  }
+  if (!entry->global_checksum_ok()) {
+    log_warn("[gbc] global checksum mismatch, the rom may be corrupt");
+  }
+}
+
 }  // namespace bugme
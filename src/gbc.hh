@@ -5,14 +5,13 @@
 #include <string>
 #include <vector>
 
-#include "cartridge.hh"
-#include "cpu.hh"
 #include "error.hh"
-#include "joypad.hh"
-#include "memory.hh"
-#include "ppu.hh"
+#include "machine.hh"
+#include "movie.hh"
+#include "rewind.hh"
+#include "sdl_audio.hh"
 #include "sdl_display.hh"
-#include "timer.hh"
+#include "trace.hh"
 #include "types.hh"
 
 struct SDL_Window;
@@ -24,18 +23,16 @@ namespace bugme {
 struct CliOptions;
 
 /**
- * Monolith class encompassing all gbc functionality.
+ * The SDL frontend, driving a single Machine.
  *
- * Instantiating this class will initialize all subcomponents of gbc, namely:
- *   - Cpu
- *   - Mmu and Cartridge
- *   - Ppu
- *   - Timer
- *   - Joypad
+ * Instantiating this class loads the ROM into a Machine, and opens a window
+ * for it unless running headless. On top of the machine, this adds the
+ * frontend features: input, save state files, rewind, run-ahead and movies.
  *
+ * \see Machine, for the emulated hardware
  * \see CliOptions, for configuration options
  */
-class Gbc : public Noncopyable, Debuggable {
+class Gbc : public Noncopyable {
  public:
   /**
    * ctor
@@ -59,25 +56,73 @@ class Gbc : public Noncopyable, Debuggable {
    */
   void exit(exitno_t exit_code);
 
+  bool save_state_file(const std::string &filename) const;
+  bool load_state_file(const std::string &filename);
+
  private:
+  enum class StateAction { NONE, SAVE, LOAD };
+
   CliOptions &cli_options_;
 
+  /** Opened first, as whether it exists decides how the display syncs. */
+  std::unique_ptr<SdlAudio> audio_;
+  std::vector<std::int16_t> audio_samples_;
+  /** The number of sample frames sync_audio_() keeps queued. */
+  std::size_t audio_target_ = 0;
+  /** The standing part of the resampling adjustment, under vsync. */
+  double rate_integral_ = 0.0;
+
   SDL_Window *window_;
   SDL_Renderer *renderer_;
   SDL_Texture *texture_;
 
-  Cartridge cartridge;
-  Memory memory;
+  Machine machine_;
   SdlDisplay display;
-  Ppu ppu;
-  Timer timer;
-  Joypad joypad;
-  Cpu cpu;
 
   bool should_exit_ = false;
+  StateAction pending_state_action_ = StateAction::NONE;
+  std::string state_filename_;
+
+  std::unique_ptr<RewindBuffer> rewind_;
+  std::vector<byte_t> rewind_state_;
+  unsigned int frames_since_snapshot_ = 0;
+  bool rewinding_ = false;
+
+  std::vector<byte_t> run_ahead_state_;
 
+  /** Buttons held on the host, applied to the joypad at frame boundaries. */
+  byte_t input_buttons_ = 0;
+
+  std::unique_ptr<TraceWriter> trace_;
+
+  std::unique_ptr<MovieWriter> movie_writer_;
+  std::unique_ptr<MovieReader> movie_reader_;
+  /** The hash of the last real frame, kept while a movie is in use. */
+  std::uint64_t frame_hash_ = 0;
+  /** The T-cycle count at the end of the last real frame. */
+  std::uint64_t frame_cycles_ = 0;
+  bool movie_desynced_ = false;
+
+  void end_frame_();
+  void sync_audio_();
+  /** \return Whether the audio device, rather than vsync, paces emulation. */
+  bool syncs_to_audio_() const;
+  void run_ahead_();
+  /** \return Whether real frames, as opposed to run-ahead frames, are drawn. */
+  bool renders_real_frames_() const;
+  void apply_input_();
+  bool start_movie_();
+  void finish_replay_();
   void process_events_();
+  /** Renders and presents the machine's frame. */
+  void draw_();
+#ifdef BUGME_HOST_STATS
+  void report_stats_();
+#endif
   std::vector<byte_t> read_rom(const std::string &filename) const;
+  std::string get_save_filename(const std::string &rom_filename) const;
+  void check_rom_index_(const std::string &filename,
+                        std::size_t file_size) const;
 };
 
 }  // namespace bugme
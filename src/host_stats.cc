@@ -0,0 +1,99 @@
+#include "host_stats.hh"
+
+#include <algorithm>
+
+namespace bugme {
+
+namespace {
+/** A second, at the Gameboy's 59.73 frames per second. */
+inline const std::uint64_t WINDOW_FRAMES = 60;
+
+inline const unsigned int OVERHEAD_TRIALS = 1000;
+}  // namespace
+
+HostStats::HostStats() {
+  std::uint64_t overhead = UINT64_MAX;
+  for (unsigned int i = 0; i < OVERHEAD_TRIALS; ++i) {
+    std::uint64_t start = now();
+    overhead = std::min(overhead, now() - start);
+  }
+  overhead_ = overhead;
+}
+
+void HostStats::schedule_sample_() {
+  // xorshift32, for a gap uniform in [1, 2 * SAMPLE_INTERVAL - 1].
+  random_ ^= random_ << 13;
+  random_ ^= random_ >> 17;
+  random_ ^= random_ << 5;
+  steps_to_sample_ = 1 + random_ % (2 * SAMPLE_INTERVAL - 1);
+}
+
+bool HostStats::end_frame() {
+  std::uint64_t time = now();
+  std::uint64_t frame_ticks = time - frame_start_;
+  frame_start_ = time;
+
+  for (std::size_t i = 0; i < static_cast<std::size_t>(Subsystem::COUNT);
+       ++i) {
+    window_[i] += frame_[i];
+    totals_[i] += frame_[i];
+    frame_[i] = 0;
+  }
+  window_ticks_ += frame_ticks;
+  total_ticks_ += frame_ticks;
+  ++total_frames_;
+
+  if (++window_frames_ < WINDOW_FRAMES) {
+    return false;
+  }
+  line_ = format_(window_, window_ticks_, window_frames_);
+  for (std::uint64_t &counter : window_) {
+    counter = 0;
+  }
+  window_ticks_ = 0;
+  window_frames_ = 0;
+  return true;
+}
+
+void HostStats::write_totals(std::FILE *file) const {
+  std::fprintf(file, "%llu frames in %.3fs: %s\n",
+               static_cast<unsigned long long>(total_frames_),
+               static_cast<double>(total_ticks_) * ns_per_tick_() / 1e9,
+               format_(totals_, total_ticks_, total_frames_).c_str());
+}
+
+double HostStats::ns_per_tick_() const {
+  std::uint64_t ticks = now() - start_;
+  return ticks > 0 ? static_cast<double>(now_ns() - start_ns_) /
+                         static_cast<double>(ticks)
+                   : 1.0;
+}
+
+std::string HostStats::format_(const Counters &counters,
+                               std::uint64_t frame_ticks,
+                               std::uint64_t frames) const {
+  double ms_per_tick = ns_per_tick_() / 1e6;
+  auto ms_per_frame = [&](std::uint64_t ticks) {
+    return frames > 0 ? static_cast<double>(ticks) * ms_per_tick /
+                            static_cast<double>(frames)
+                      : 0.0;
+  };
+  auto ms = [&](Subsystem subsystem) {
+    return ms_per_frame(counters[static_cast<std::size_t>(subsystem)]);
+  };
+  double frame_ms = ms_per_frame(frame_ticks);
+
+  char line[256];
+  std::snprintf(line, sizeof(line),
+                "%.2f ms/frame (%.1f fps) | emulation %.2f (cpu %.2f ppu %.2f "
+                "timer %.2f) | render %.2f | present %.2f | events %.2f | "
+                "sync %.2f",
+                frame_ms, frame_ms > 0 ? 1000.0 / frame_ms : 0.0,
+                ms(Subsystem::Emulation), ms(Subsystem::Cpu),
+                ms(Subsystem::Ppu), ms(Subsystem::Timer),
+                ms(Subsystem::Render), ms(Subsystem::Present),
+                ms(Subsystem::Events), ms(Subsystem::Sync));
+  return line;
+}
+
+}  // namespace bugme
@@ -0,0 +1,179 @@
+#ifndef BUGME_HOST_STATS_HH
+#define BUGME_HOST_STATS_HH
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "types.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Wraps a statement which feeds HostStats, so that it disappears from builds
+ * without BUGME_HOST_STATS (cmake -DBUGME_HOST_STATS=ON).
+ */
+#ifdef BUGME_HOST_STATS
+#define BUGME_STATS(statement) statement
+#else
+#define BUGME_STATS(statement)
+#endif
+
+namespace bugme {
+
+/** Where host time goes. The first three are within Emulation. */
+enum class Subsystem {
+  Cpu,
+  Ppu,
+  Timer,
+  Emulation,
+  Render,
+  Present,
+  Events,
+  Sync,
+  COUNT,
+};
+
+/**
+ * Accounts host time to subsystems, per frame and over the whole run.
+ *
+ * Frame-level work is timed whole, with a Scope. Instructions are far too
+ * short and many for that, so Machine::step only times one in
+ * SAMPLE_INTERVAL of them on average, with a Sample, and scales the result
+ * up. The gaps between samples are random, since a fixed one would alias
+ * with the game's loops and the PPU's line timing. Time is
+ * read from the TSC where there is one, which costs a few nanoseconds, and
+ * the cost of reading it is measured once and taken off every lap, so that
+ * it is not scaled up along with the laps.
+ *
+ * \see Machine::host_stats, which exists only in builds with BUGME_HOST_STATS
+ */
+class HostStats : public Noncopyable {
+ public:
+  /** Average steps between sampled ones. */
+  static constexpr unsigned int SAMPLE_INTERVAL = 64;
+
+  HostStats();
+
+  /** \return The current time, in ticks of the fastest clock available. */
+  static std::uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+  }
+
+  static std::uint64_t now_ns() {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+  }
+
+  /** Times its own lifetime. */
+  class Scope : public Noncopyable {
+   public:
+    Scope(HostStats &stats, Subsystem subsystem)
+        : stats_(stats), subsystem_(subsystem), start_(now()) {}
+    ~Scope() { stats_.add(subsystem_, now() - start_); }
+
+   private:
+    HostStats &stats_;
+    Subsystem subsystem_;
+    std::uint64_t start_;
+  };
+
+  /**
+   * Times the consecutive parts of a step, if this step is due to be
+   * sampled: each lap() accounts the time since the previous one.
+   */
+  class Sample : public Noncopyable {
+   public:
+    explicit Sample(HostStats &stats)
+        : stats_(stats),
+          active_(--stats.steps_to_sample_ == 0),
+          last_(active_ ? now() : 0) {}
+
+    ~Sample() {
+      if (active_) {
+        stats_.schedule_sample_();
+      }
+    }
+
+    void lap(Subsystem subsystem) {
+      if (active_) {
+        std::uint64_t time = now();
+        std::uint64_t ticks = time - last_;
+        ticks = ticks > stats_.overhead_ ? ticks - stats_.overhead_ : 0;
+        stats_.add(subsystem, ticks * SAMPLE_INTERVAL);
+        last_ = time;
+      }
+    }
+
+   private:
+    HostStats &stats_;
+    bool active_;
+    std::uint64_t last_;
+  };
+
+  void add(Subsystem subsystem, std::uint64_t ticks) {
+    frame_[static_cast<std::size_t>(subsystem)] += ticks;
+  }
+
+  /**
+   * Closes the current frame, adding it to the totals and to the averages
+   * that line() reports.
+   *
+   * \return true once a second's worth of frames has been averaged, i.e.
+   *         when line() has something new to say.
+   */
+  bool end_frame();
+
+  /**
+   * \return Per-frame averages over the last second, e.g. "16.74 ms/frame
+   *         (59.7 fps) | emulation 2.10 (cpu 1.21 ppu 0.74 timer 0.09) |
+   *         render 0.12 | present 14.30 | events 0.02 | sync 0.00".
+   */
+  const std::string &line() const { return line_; }
+
+  /** Writes per-frame averages over the whole run. */
+  void write_totals(std::FILE *file) const;
+
+ private:
+  typedef std::uint64_t Counters[static_cast<std::size_t>(Subsystem::COUNT)];
+
+  void schedule_sample_();
+  /** \return The nanoseconds per tick, as measured over the run so far. */
+  double ns_per_tick_() const;
+  std::string format_(const Counters &counters, std::uint64_t frame_ticks,
+                      std::uint64_t frames) const;
+
+  /** The ticks it takes to read the clock. */
+  std::uint64_t overhead_ = 0;
+  std::uint64_t start_ = now();
+  std::uint64_t start_ns_ = now_ns();
+
+  unsigned int steps_to_sample_ = SAMPLE_INTERVAL;
+  std::uint32_t random_ = 0x9E3779B9;
+  Counters frame_ = {};
+  std::uint64_t frame_start_ = start_;
+
+  Counters window_ = {};
+  std::uint64_t window_ticks_ = 0;
+  std::uint64_t window_frames_ = 0;
+
+  Counters totals_ = {};
+  std::uint64_t total_ticks_ = 0;
+  std::uint64_t total_frames_ = 0;
+
+  std::string line_;
+};
+
+}  // namespace bugme
+
+#endif
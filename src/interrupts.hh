@@ -1,7 +1,7 @@
 #ifndef BUGME_INTERRUPTS_HH
 #define BUGME_INTERRUPTS_HH
 
-#include "register.hh"
+#include "types.hh"
 
 namespace bugme {
 
@@ -13,16 +13,50 @@ enum class Interrupt {
   JOYPAD = 4,
 };
 
-/* clang-format off */
-class InterruptFlag : public ControlRegister {
-public:
-  CONTROL_FLAG(4, joypad_interrupt_request)
-  CONTROL_FLAG(3, serial_interrupt_request)
-  CONTROL_FLAG(2, timer_interrupt_request)
-  CONTROL_FLAG(1, lcd_stat_interrupt_request)
-  CONTROL_FLAG(0, vblank_interrupt_request)
+/**
+ * IF (0xFF0F) and IE (0xFFFF): the interrupt lines from the PPU, timer,
+ * serial port and joypad to the CPU.
+ *
+ * Each of those components holds a reference to the machine's one instance,
+ * and raises an interrupt by setting its bit directly. The interrupts both
+ * requested and enabled are kept up to date as either register changes, so
+ * that the CPU, which checks before every instruction, reads a single byte.
+ */
+class Interrupts : public Noncopyable {
+ public:
+  /** Sets interrupt's bit in IF. */
+  void request(Interrupt interrupt) { set_flag(flag_ | bit_(interrupt)); }
+  /** Clears interrupt's bit in IF, as the CPU does on servicing it. */
+  void acknowledge(Interrupt interrupt) {
+    set_flag(flag_ & static_cast<byte_t>(~bit_(interrupt)));
+  }
+
+  byte_t flag() const { return flag_; }
+  void set_flag(byte_t flag) {
+    flag_ = flag;
+    pending_ = flag_ & enable_ & ALL;
+  }
+
+  byte_t enable() const { return enable_; }
+  void set_enable(byte_t enable) {
+    enable_ = enable;
+    pending_ = flag_ & enable_ & ALL;
+  }
+
+  /** \return The interrupts requested and enabled, as IF bits. */
+  byte_t pending() const { return pending_; }
+
+ private:
+  static constexpr byte_t ALL = 0x1F;
+
+  static byte_t bit_(Interrupt interrupt) {
+    return static_cast<byte_t>(1 << static_cast<int>(interrupt));
+  }
+
+  byte_t flag_ = 0;
+  byte_t enable_ = 0;
+  byte_t pending_ = 0;
 };
-/* clang-format on */
 
 }  // namespace bugme
 #endif
@@ -1,7 +1,11 @@
 #include "joypad.hh"
 
+#include "util.hh"
+
 namespace bugme {
-Joypad::Joypad() { joyp.set(0xFF); }
+Joypad::Joypad(Interrupts &interrupts) : interrupts_(interrupts) {
+  joyp.set(0xFF);
+}
 
 void Joypad::button_down(Button button) {
   switch (button) {
@@ -34,7 +38,7 @@ void Joypad::button_down(Button button) {
   }
 
   joyp.update_joyp_();
-  joypad_interrupt_request();
+  interrupts_.request(Interrupt::JOYPAD);
 }
 
 void Joypad::button_up(Button button) {
@@ -68,7 +72,46 @@ void Joypad::button_up(Button button) {
   }
 
   joyp.update_joyp_();
-  joypad_interrupt_request();
+  interrupts_.request(Interrupt::JOYPAD);
+}
+
+byte_t Joypad::buttons() const {
+  return static_cast<byte_t>((joyp.up_ << 0) | (joyp.down_ << 1) |
+                             (joyp.left_ << 2) | (joyp.right_ << 3) |
+                             (joyp.a_ << 4) | (joyp.b_ << 5) |
+                             (joyp.select_ << 6) | (joyp.start_ << 7));
+}
+
+void Joypad::set_buttons(byte_t buttons) {
+  byte_t changed = static_cast<byte_t>(buttons ^ this->buttons());
+  for (int i = static_cast<int>(Button::Up);
+       i <= static_cast<int>(Button::Start); ++i) {
+    Button button = static_cast<Button>(i);
+    if (changed & button_mask(button)) {
+      if (buttons & button_mask(button)) {
+        button_down(button);
+      } else {
+        button_up(button);
+      }
+    }
+  }
+}
+
+void Joypad::save_state(JoypadState &state) const {
+  state.joyp = joyp.value();
+  state.buttons = buttons();
+}
+
+void Joypad::load_state(const JoypadState &state) {
+  joyp.up_ = util::get_bit(state.buttons, 0);
+  joyp.down_ = util::get_bit(state.buttons, 1);
+  joyp.left_ = util::get_bit(state.buttons, 2);
+  joyp.right_ = util::get_bit(state.buttons, 3);
+  joyp.a_ = util::get_bit(state.buttons, 4);
+  joyp.b_ = util::get_bit(state.buttons, 5);
+  joyp.select_ = util::get_bit(state.buttons, 6);
+  joyp.start_ = util::get_bit(state.buttons, 7);
+  joyp.ControlRegister::set(state.joyp);
 }
 
 }  // namespace bugme
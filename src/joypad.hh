@@ -4,12 +4,21 @@
 #include <memory>
 
 #include "bus.hh"
+#include "interrupts.hh"
 #include "register.hh"
+#include "savestate.hh"
 #include "types.hh"
 
 namespace bugme {
 enum class Button { NONE, Up, Down, Left, Right, A, B, Select, Start };
 
+/** \return The bit for button in a button mask, or 0 for Button::NONE. */
+inline byte_t button_mask(Button button) {
+  return button == Button::NONE
+             ? 0
+             : static_cast<byte_t>(1 << (static_cast<int>(button) - 1));
+}
+
 class JoypControl : public ControlRegister {
   CONTROL_FLAG(5, select_action_buttons)     // 0 = selected
   CONTROL_FLAG(4, select_direction_buttons)  // 0 = selected
@@ -43,38 +52,36 @@ class JoypControl : public ControlRegister {
     }
   }
 
-  bool up_, down_, left_, right_, a_, b_, select_, start_ = false;
+  bool up_ = false, down_ = false, left_ = false, right_ = false, a_ = false,
+       b_ = false, select_ = false, start_ = false;
 };
 
 class Joypad;
 
 struct JoypadBus : Bus<Joypad> {
   JoypControl joyp;
-
-  std::function<void()> joypad_interrupt_request_cb = nullptr;
-
-  void register_joypad_interrupt_request_cb(std::function<void()> cb) {
-    joypad_interrupt_request_cb = cb;
-  }
-
-  void joypad_interrupt_request() {
-    if (joypad_interrupt_request_cb) {
-      joypad_interrupt_request_cb();
-    } else {
-      log_error("No joypad interrupt request callback has been registered!");
-    }
-  }
 };
 
 class Joypad : public JoypadBus {
  public:
-  Joypad();
+  explicit Joypad(Interrupts &interrupts);
 
   void button_down(Button button);
   void button_up(Button button);
 
+  /** \return The held buttons, as a mask of button_mask() bits. */
+  byte_t buttons() const;
+
+  /** Presses and releases buttons to match a mask of button_mask() bits. */
+  void set_buttons(byte_t buttons);
+
+  void save_state(JoypadState &state) const;
+  void load_state(const JoypadState &state);
+
  private:
   void update_joyp_();
+
+  Interrupts &interrupts_;
 };
 }  // namespace bugme
 #endif
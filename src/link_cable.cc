@@ -0,0 +1,75 @@
+#include "link_cable.hh"
+
+namespace bugme {
+
+byte_t LinkCable::transfer(unsigned int end, byte_t byte,
+                           std::uint64_t time) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  Port &self = ports_[end];
+  Port &peer = ports_[1 - end];
+  if (!peer.plugged) {
+    return 0xFF;
+  }
+
+  // The peer is driving a transfer of its own, and waiting on us.
+  if (peer.offer) {
+    byte_t received = *peer.offer;
+    peer.offer.reset();
+    peer.offering.store(false, std::memory_order_release);
+    peer.reply = byte;
+    cv_.notify_all();
+    return received;
+  }
+
+  self.offer = byte;
+  self.offer_time.store(time, std::memory_order_relaxed);
+  self.offering.store(true, std::memory_order_release);
+  cv_.notify_all();
+  cv_.wait(lock, [&]() { return self.reply || !peer.plugged; });
+
+  self.offer.reset();
+  self.offering.store(false, std::memory_order_release);
+  byte_t received = self.reply.value_or(0xFF);
+  self.reply.reset();
+  return received;
+}
+
+std::optional<byte_t> LinkCable::receive(unsigned int end, byte_t byte,
+                                         std::uint64_t time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Port &peer = ports_[1 - end];
+  if (!peer.offer) {
+    return std::nullopt;
+  }
+
+  std::int64_t late = static_cast<std::int64_t>(time) - offer_time_(end);
+  if (late > 0) {
+    skew_.store(skew_.load(std::memory_order_relaxed) +
+                    (end == 0 ? -late : late),
+                std::memory_order_relaxed);
+  }
+
+  byte_t received = *peer.offer;
+  peer.offer.reset();
+  peer.offering.store(false, std::memory_order_release);
+  peer.reply = byte;
+  cv_.notify_all();
+  return received;
+}
+
+void LinkCable::plug(unsigned int end) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ports_[end].plugged = true;
+}
+
+void LinkCable::unplug(unsigned int end) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Port &self = ports_[end];
+  self.plugged = false;
+  self.offer.reset();
+  self.offering.store(false, std::memory_order_release);
+  self.reply.reset();
+  cv_.notify_all();
+}
+
+}  // namespace bugme
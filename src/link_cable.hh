@@ -0,0 +1,96 @@
+#ifndef BUGME_LINK_CABLE_HH
+#define BUGME_LINK_CABLE_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+#include "types.hh"
+
+namespace bugme {
+
+/**
+ * Connects the serial ports of two machines, each run on its own thread.
+ *
+ * The machines are not kept in step instruction by instruction: each runs
+ * freely, and the two threads meet only when a byte crosses the cable. The
+ * side whose clock drives a transfer blocks, once it completes, until the
+ * other side has caught up to the cycle it completed at, and taken the byte
+ * in exchange for its own; the other side checks for that with a couple of
+ * atomic loads per instruction. A side which is ahead instead takes the byte
+ * late, and the cable remembers by how much, mapping later transfers onto
+ * its timeline with the same skew, so that they arrive as far apart as they
+ * were sent. Games waiting on a link are spinning on SC or halted until the
+ * serial interrupt anyway, so the skew goes unnoticed, and both machines run
+ * at full speed between transfers.
+ *
+ * If both sides drive a transfer at once, they simply swap bytes. A side
+ * which is unplugged (e.g. because its thread is done) reads as 0xFF, and
+ * releases the other side if it is blocked.
+ *
+ * \see Machine::plug
+ */
+class LinkCable : public Noncopyable {
+ public:
+  LinkCable() = default;
+
+  /**
+   * Sends a byte, driven by end's clock, and waits for the other end to take
+   * it.
+   *
+   * \param time The T-cycle the transfer completed at.
+   * \return The byte received in exchange.
+   */
+  byte_t transfer(unsigned int end, byte_t byte, std::uint64_t time);
+
+  /**
+   * \return Whether the other end has a byte waiting for end to take, as of
+   *         T-cycle time.
+   */
+  bool offered(unsigned int end, std::uint64_t time) const {
+    return ports_[1 - end].offering.load(std::memory_order_acquire) &&
+           offer_time_(end) <= static_cast<std::int64_t>(time);
+  }
+
+  /**
+   * Takes the byte offered to end, if there is one, handing byte back in
+   * exchange.
+   *
+   * \param time The T-cycle, on end's clock, at which it is taken.
+   */
+  std::optional<byte_t> receive(unsigned int end, byte_t byte,
+                                std::uint64_t time);
+
+  void plug(unsigned int end);
+  void unplug(unsigned int end);
+
+ private:
+  struct Port {
+    bool plugged = false;
+    std::optional<byte_t> offer;
+    std::optional<byte_t> reply;
+    /** Mirror offer.has_value() and its time, for polling without the lock. */
+    std::atomic<bool> offering = false;
+    std::atomic<std::uint64_t> offer_time = 0;
+  };
+
+  /** \return When the byte offered to end was sent, on end's clock. */
+  std::int64_t offer_time_(unsigned int end) const {
+    std::int64_t sent = static_cast<std::int64_t>(
+        ports_[1 - end].offer_time.load(std::memory_order_relaxed));
+    std::int64_t skew = skew_.load(std::memory_order_relaxed);
+    return end == 0 ? sent - skew : sent + skew;
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  Port ports_[2];
+  /** End 1's clock minus end 0's, as of the last byte taken late. */
+  std::atomic<std::int64_t> skew_ = 0;
+};
+
+}  // namespace bugme
+
+#endif
@@ -16,12 +16,377 @@
 
 #include "log.hh"
 
-#include <cstdarg>
-
-#include "string_utils.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 namespace bugme {
 Logger global_logger;
+
+namespace {
+thread_local Logger *thread_logger = nullptr;
+
+/** Messages which may be waiting to be written at once. */
+inline const std::size_t RING_SIZE = 1024;
+/** How often the log thread looks for messages when not asked to flush. */
+inline const std::chrono::milliseconds POLL_INTERVAL(10);
+
+/** Messages each call site may log per second. */
+inline const unsigned int SITE_LIMIT = 20;
+/** Call sites rate limited. Any beyond are not. */
+inline const std::size_t SITES = 512;
+inline const std::size_t SITE_PROBES = 8;
+
+/** A call site, known by its format string. */
+struct Site {
+  std::atomic<const char *> fmt = nullptr;
+  /** The second counted in. */
+  std::atomic<std::int64_t> second = -1;
+  std::atomic<unsigned int> count = 0;
+  std::atomic<unsigned int> suppressed = 0;
+};
+
+const char *level_color(LogLevel level) {
+  switch (level) {
+    case LogLevel::Trace:
+      return COLOR_TRACE;
+    case LogLevel::Debug:
+      return COLOR_DEBUG;
+    case LogLevel::Unimplemented:
+      return COLOR_UNIMPLEMENTED;
+    case LogLevel::Info:
+      return COLOR_INFO;
+    case LogLevel::Warning:
+      return COLOR_WARNING;
+    case LogLevel::Error:
+      return COLOR_ERROR;
+  }
+  return "";
+}
+
+/**
+ * A bounded queue of records, to which any thread may log, drained by one
+ * thread of its own. Producers claim a slot by advancing the enqueue position,
+ * and publish it through the slot's sequence number, so that they never wait
+ * on each other or on the log thread.
+ */
+class LogQueue {
+ public:
+  /** Never destroyed, so that logging during exit stays safe. */
+  static LogQueue &get() {
+    static LogQueue *queue = []() {
+      auto *q = new LogQueue();
+      std::atexit([]() { get().exit_(); });
+      return q;
+    }();
+    return *queue;
+  }
+
+  /** \return A slot to fill in, or null if the ring is full. */
+  LogRecord *claim() {
+    std::size_t position = enqueue_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &slot = slots_[position & (RING_SIZE - 1)];
+      std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence - position);
+      if (diff == 0) {
+        if (enqueue_.compare_exchange_weak(position, position + 1,
+                                           std::memory_order_relaxed)) {
+          slot.record.position = position;
+          return &slot.record;
+        }
+      } else if (diff < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      } else {
+        position = enqueue_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void publish(LogRecord *record) {
+    slots_[record->position & (RING_SIZE - 1)].sequence.store(
+        record->position + 1, std::memory_order_release);
+  }
+
+  void flush() {
+    std::size_t target = enqueue_.load(std::memory_order_acquire);
+    if (dequeued_.load(std::memory_order_acquire) >= target) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    flush_requested_ = true;
+    cv_.notify_all();
+    cv_.wait(lock, [&]() {
+      return dequeued_.load(std::memory_order_acquire) >= target;
+    });
+  }
+
+  /** \return The call site for fmt, or null if there is no room for it. */
+  Site *site(const char *fmt) {
+    auto hash = static_cast<std::size_t>(
+        (reinterpret_cast<std::uintptr_t>(fmt) >> 3) * 0x9E3779B97F4A7C15ull);
+    for (std::size_t i = 0; i < SITE_PROBES; ++i) {
+      Site &site = sites_[(hash + i) & (SITES - 1)];
+      const char *seen = site.fmt.load(std::memory_order_relaxed);
+      if (seen == nullptr &&
+          site.fmt.compare_exchange_strong(seen, fmt,
+                                           std::memory_order_relaxed)) {
+        return &site;
+      }
+      if (seen == fmt) {
+        return &site;
+      }
+    }
+    return nullptr;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<std::size_t> sequence;
+    LogRecord record;
+  };
+
+  LogQueue() : slots_(std::make_unique<Slot[]>(RING_SIZE)) {
+    for (std::size_t i = 0; i < RING_SIZE; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    std::thread([this]() { run_(); }).detach();
+  }
+
+  void run_() {
+    std::size_t position = 0;
+    while (true) {
+      while (true) {
+        Slot &slot = slots_[position & (RING_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+          break;
+        }
+        write_(slot.record);
+        slot.sequence.store(position + RING_SIZE, std::memory_order_release);
+        dequeued_.store(++position, std::memory_order_release);
+      }
+
+      std::size_t dropped = dropped_.load(std::memory_order_relaxed);
+      if (dropped != reported_drops_) {
+        std::fprintf(stderr, "%s| %s[log] %zu messages dropped\n",
+                     COLOR_WARNING, COLOR_RESET, dropped - reported_drops_);
+        reported_drops_ = dropped;
+      }
+      std::fflush(stdout);
+      std::fflush(stderr);
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.notify_all();
+      cv_.wait_for(lock, POLL_INTERVAL, [this]() { return flush_requested_; });
+      flush_requested_ = false;
+    }
+  }
+
+  void write_(const LogRecord &record) {
+    line_.clear();
+    line_ += level_color(record.level);
+    line_ += "| ";
+    line_ += COLOR_RESET;
+    line_ += record.name;
+    format_(record);
+    if (record.suppressed > 0) {
+      line_ += " (and ";
+      line_ += std::to_string(record.suppressed);
+      line_ += " more like it, suppressed)";
+    }
+    line_ += '\n';
+    std::fwrite(line_.data(), 1, line_.size(),
+                record.level < LogLevel::Error ? stdout : stderr);
+  }
+
+  /** Formats the record as printf would have, one conversion at a time. */
+  void format_(const LogRecord &record) {
+    unsigned int next_arg = 0;
+    auto arg = [&]() -> const LogRecord::Arg * {
+      return next_arg < record.arg_count ? &record.args[next_arg++] : nullptr;
+    };
+    auto as_signed = [](const LogRecord::Arg *a) -> long long {
+      switch (a == nullptr ? LogRecord::Type::String : a->type) {
+        case LogRecord::Type::Signed:
+          return a->i;
+        case LogRecord::Type::Unsigned:
+          return static_cast<long long>(a->u);
+        case LogRecord::Type::Double:
+          return static_cast<long long>(a->d);
+        case LogRecord::Type::Pointer:
+          return static_cast<long long>(reinterpret_cast<std::intptr_t>(a->p));
+        case LogRecord::Type::String:
+          break;
+      }
+      return 0;
+    };
+
+    char buffer[512];
+    for (const char *p = record.fmt; *p != '\0'; ++p) {
+      if (*p != '%') {
+        line_ += *p;
+        continue;
+      }
+      if (p[1] == '%') {
+        line_ += '%';
+        ++p;
+        continue;
+      }
+
+      // The conversion, less its length modifier, which is applied below.
+      std::string spec = "%";
+      const char *q = p + 1;
+      while (*q != '\0' && std::strchr("-+ #0", *q) != nullptr) {
+        spec += *q++;
+      }
+      for (bool precision = false;; precision = true) {
+        if (*q == '*') {
+          spec += std::to_string(static_cast<int>(as_signed(arg())));
+          ++q;
+        } else {
+          while (*q >= '0' && *q <= '9') {
+            spec += *q++;
+          }
+        }
+        if (precision || *q != '.') {
+          break;
+        }
+        spec += *q++;
+      }
+      std::string length;
+      while (*q != '\0' && std::strchr("hljztL", *q) != nullptr) {
+        length += *q++;
+      }
+      if (*q == '\0') {
+        break;
+      }
+      char conversion = *q;
+      p = q;
+
+      const LogRecord::Arg *a = arg();
+      if (a == nullptr) {
+        line_ += "(?)";
+        continue;
+      }
+      switch (conversion) {
+        case 'd':
+        case 'i': {
+          long long value = as_signed(a);
+          if (length == "hh") {
+            value = static_cast<signed char>(value);
+          } else if (length == "h") {
+            value = static_cast<short>(value);
+          } else if (length.empty()) {
+            value = static_cast<int>(value);
+          } else if (length == "l") {
+            value = static_cast<long>(value);
+          }
+          std::snprintf(buffer, sizeof(buffer), (spec + "lld").c_str(), value);
+          break;
+        }
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X': {
+          auto value = static_cast<unsigned long long>(as_signed(a));
+          if (length == "hh") {
+            value = static_cast<unsigned char>(value);
+          } else if (length == "h") {
+            value = static_cast<unsigned short>(value);
+          } else if (length.empty()) {
+            value = static_cast<unsigned int>(value);
+          } else if (length == "l") {
+            value = static_cast<unsigned long>(value);
+          }
+          std::snprintf(buffer, sizeof(buffer),
+                        (spec + "ll" + conversion).c_str(), value);
+          break;
+        }
+        case 'c':
+          std::snprintf(buffer, sizeof(buffer), (spec + "c").c_str(),
+                        static_cast<int>(as_signed(a)));
+          break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+          std::snprintf(buffer, sizeof(buffer), (spec + conversion).c_str(),
+                        a->type == LogRecord::Type::Double
+                            ? a->d
+                            : static_cast<double>(as_signed(a)));
+          break;
+        case 's':
+          if (a->type == LogRecord::Type::String) {
+            std::string s(record.text + a->s.offset, a->s.length);
+            std::snprintf(buffer, sizeof(buffer), (spec + "s").c_str(),
+                          s.c_str());
+          } else {
+            std::snprintf(buffer, sizeof(buffer), "(?)");
+          }
+          break;
+        case 'p':
+          std::snprintf(buffer, sizeof(buffer), (spec + "p").c_str(),
+                        a->type == LogRecord::Type::Pointer ? a->p : nullptr);
+          break;
+        default:
+          std::snprintf(buffer, sizeof(buffer), "%%%c", conversion);
+      }
+      line_ += buffer;
+    }
+  }
+
+  /** Writes what is left, and what rate limiting kept back. */
+  void exit_() {
+    flush();
+    for (Site &site : sites_) {
+      unsigned int suppressed = site.suppressed.exchange(0);
+      const char *fmt = site.fmt.load();
+      if (suppressed > 0 && fmt != nullptr) {
+        std::fprintf(stdout, "%s| %s[log] %u more like \"%s\", suppressed\n",
+                     COLOR_INFO, COLOR_RESET, suppressed, fmt);
+      }
+    }
+    std::fflush(stdout);
+  }
+
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<std::size_t> enqueue_ = 0;
+  alignas(64) std::atomic<std::size_t> dequeued_ = 0;
+  std::atomic<std::size_t> dropped_ = 0;
+  std::size_t reported_drops_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool flush_requested_ = false;
+
+  Site sites_[SITES];
+  /** The line being formatted, kept to reuse its memory. */
+  std::string line_;
+};
+}  // namespace
+
+Logger &current_logger() {
+  return thread_logger != nullptr ? *thread_logger : global_logger;
+}
+
+ScopedLogger::ScopedLogger(Logger &logger) : previous_(thread_logger) {
+  thread_logger = &logger;
+}
+
+ScopedLogger::~ScopedLogger() { thread_logger = previous_; }
+
 const char *COLOR_TRACE = "\033[1;30m";
 const char *COLOR_DEBUG = "\033[1;37m";
 const char *COLOR_UNIMPLEMENTED = "\033[1;35m";
@@ -30,21 +395,65 @@ const char *COLOR_WARNING = "\033[1;33m";
 const char *COLOR_ERROR = "\033[1;31m";
 const char *COLOR_RESET = "\033[0m";
 
-void Logger::log(LogLevel level, const char *fmt, ...) {
-  if (!should_log(level)) {
-    return;
+void LogRecord::add_string(Arg &arg, const char *s, std::size_t length) {
+  if (s == nullptr) {
+    s = "(null)";
+    length = SIZE_MAX;
   }
+  std::size_t room = TEXT_SIZE - text_used;
+  length = length == SIZE_MAX ? strnlen(s, room) : std::min(length, room);
+  std::memcpy(text + text_used, s, length);
+  arg.type = Type::String;
+  arg.s.offset = text_used;
+  arg.s.length = static_cast<std::uint16_t>(length);
+  text_used = static_cast<std::uint16_t>(text_used + length);
+}
 
-  va_list args;
-  va_start(args, fmt);
-  std::string msg = str_format(fmt, args);
-  va_end(args);
+LogRecord *Logger::begin_(LogLevel level, const char *fmt) {
+  LogQueue &queue = LogQueue::get();
+  unsigned int suppressed = 0;
+  Site *site = queue.site(fmt);
+  if (site != nullptr) {
+    auto second = std::chrono::duration_cast<std::chrono::seconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count();
+    std::int64_t seen = site->second.load(std::memory_order_relaxed);
+    if (seen != second &&
+        site->second.compare_exchange_strong(seen, second,
+                                             std::memory_order_relaxed)) {
+      site->count.store(0, std::memory_order_relaxed);
+      suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+    }
+    if (site->count.fetch_add(1, std::memory_order_relaxed) >= SITE_LIMIT) {
+      site->suppressed.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+  }
 
-  fprintf((level < LogLevel::Error) ? stdout : stderr, "%s| %s%s\n",
-          level_color(level), COLOR_RESET, msg.c_str());
+  LogRecord *record = queue.claim();
+  if (record == nullptr) {
+    if (site != nullptr) {
+      site->suppressed.fetch_add(suppressed, std::memory_order_relaxed);
+    }
+    return nullptr;
+  }
+  record->level = level;
+  record->fmt = fmt;
+  record->suppressed = suppressed;
+  record->arg_count = 0;
+  record->text_used = 0;
+  std::size_t length = std::min(name.size(), LogRecord::NAME_SIZE - 1);
+  std::memcpy(record->name, name.data(), length);
+  record->name[length] = '\0';
+  return record;
+}
 
+void Logger::commit_(LogRecord *record) {
+  LogLevel level = record->level;
+  LogQueue &queue = LogQueue::get();
+  queue.publish(record);
   if (level == LogLevel::Error) {
-    // exit(-1);
+    queue.flush();
   }
 }
 
@@ -61,24 +470,8 @@ bool Logger::should_log(LogLevel level) const {
   return enabled && (current_level <= level);
 }
 
-inline const char *Logger::level_color(LogLevel level) const {
-  switch (level) {
-    case LogLevel::Trace:
-      return COLOR_TRACE;
-    case LogLevel::Debug:
-      return COLOR_DEBUG;
-    case LogLevel::Unimplemented:
-      return COLOR_UNIMPLEMENTED;
-    case LogLevel::Info:
-      return COLOR_INFO;
-    case LogLevel::Warning:
-      return COLOR_WARNING;
-    case LogLevel::Error:
-      return COLOR_ERROR;
-  }
-  return "";
-}
+void log_set_level(LogLevel level) { current_logger().set_level(level); }
 
-void log_set_level(LogLevel level) { global_logger.set_level(level); }
+void log_flush() { LogQueue::get().flush(); }
 
 }  // namespace bugme
@@ -17,7 +17,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <type_traits>
 
 namespace bugme {
 
@@ -30,11 +33,116 @@ enum class LogLevel {
   Error,
 };
 
+/**
+ * A message as captured where it was logged: the format string, which must
+ * outlive the program (a literal), and the arguments, with strings copied in
+ * (and truncated if they do not fit). It is formatted later, on the log
+ * thread.
+ */
+struct LogRecord {
+  static constexpr std::size_t MAX_ARGS = 10;
+  static constexpr std::size_t NAME_SIZE = 32;
+  static constexpr std::size_t TEXT_SIZE = 160;
+
+  enum class Type : std::uint8_t { Signed, Unsigned, Double, Pointer, String };
+  struct Arg {
+    Type type;
+    union {
+      long long i;
+      unsigned long long u;
+      double d;
+      const void *p;
+      /** Where a string lies in text. */
+      struct {
+        std::uint16_t offset;
+        std::uint16_t length;
+      } s;
+    };
+  };
+
+  /** The record's place in the ring. */
+  std::size_t position;
+  LogLevel level;
+  const char *fmt;
+  /** Messages from this call site dropped by rate limiting, until now. */
+  unsigned int suppressed;
+  std::uint8_t arg_count;
+  std::uint16_t text_used;
+  char name[NAME_SIZE];
+  Arg args[MAX_ARGS];
+  char text[TEXT_SIZE];
+
+  template <typename T>
+  void add(const T &value) {
+    if (arg_count == MAX_ARGS) {
+      return;
+    }
+    Arg &arg = args[arg_count++];
+    if constexpr (std::is_same_v<T, std::string>) {
+      add_string(arg, value.data(), value.size());
+    } else if constexpr (std::is_array_v<T>) {
+      add_string(arg, value, SIZE_MAX);
+    } else if constexpr (std::is_same_v<T, char *> ||
+                         std::is_same_v<T, const char *>) {
+      add_string(arg, value, value == nullptr ? 0 : SIZE_MAX);
+    } else if constexpr (std::is_enum_v<T>) {
+      arg.type = Type::Signed;
+      arg.i = static_cast<long long>(value);
+    } else if constexpr (std::is_floating_point_v<T>) {
+      arg.type = Type::Double;
+      arg.d = static_cast<double>(value);
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+      arg.type = Type::Signed;
+      arg.i = value;
+    } else if constexpr (std::is_integral_v<T>) {
+      arg.type = Type::Unsigned;
+      arg.u = value;
+    } else if constexpr (std::is_pointer_v<std::decay_t<T>>) {
+      arg.type = Type::Pointer;
+      arg.p = value;
+    } else {
+      static_assert(std::is_same_v<T, void>, "cannot log this type");
+    }
+  }
+
+  /** \param length The length of s, or SIZE_MAX if it is null terminated. */
+  void add_string(Arg &arg, const char *s, std::size_t length);
+};
+
+/**
+ * Sends messages to stdout (or stderr, for errors) without formatting or
+ * writing them on the calling thread.
+ *
+ * log() only checks the level, captures its arguments into a slot of a
+ * preallocated lock-free ring shared by all loggers, and returns: it neither
+ * allocates nor blocks. A background thread formats and writes what it finds
+ * in the ring. Errors are the exception, and wait until they have been
+ * written, since they are often followed by an exit.
+ *
+ * Each call site (each format string) may log a few messages a second; the
+ * rest are counted, and the count is reported with its next message, or at
+ * exit. If the ring fills, messages are dropped, and the drop is reported.
+ */
 class Logger {
  public:
   Logger() = default;
 
-  void log(LogLevel level, const char *fmt, ...);
+  /** \param name Prefixed to every message, to tell instances apart. */
+  explicit Logger(const std::string &name) : name(name + " ") {}
+
+  template <typename... Args>
+  void log(LogLevel level, const char *fmt, const Args &...args) {
+    if (!should_log(level)) {
+      return;
+    }
+    LogRecord *record = begin_(level, fmt);
+    if (record == nullptr) {
+      return;
+    }
+    (record->add(args), ...);
+    commit_(record);
+  }
+
   void set_level(LogLevel level);
 
   void enable_tracing();
@@ -42,14 +150,41 @@ class Logger {
 
  private:
   bool should_log(LogLevel level) const;
-  const char *level_color(LogLevel level) const;
 
+  /** \return A record to fill in, or null if the message is dropped. */
+  LogRecord *begin_(LogLevel level, const char *fmt);
+  void commit_(LogRecord *record);
+
+  std::string name;
   LogLevel current_level = LogLevel::Debug;
   bool enabled = true;
   bool tracing_enabled = false;
 };
 
 extern Logger global_logger;
+
+/**
+ * \return The logger that log_* messages go to on the calling thread:
+ *         global_logger, unless a ScopedLogger is active.
+ */
+extern Logger &current_logger();
+
+/**
+ * Routes log_* messages on the calling thread to another logger for the
+ * lifetime of this object. This lets many machines in one process each have
+ * their own logger, without any of them touching global_logger.
+ */
+class ScopedLogger {
+ public:
+  explicit ScopedLogger(Logger &logger);
+  ~ScopedLogger();
+
+  ScopedLogger(const ScopedLogger &) = delete;
+  ScopedLogger &operator=(const ScopedLogger &) = delete;
+
+ private:
+  Logger *previous_;
+};
 extern const char *COLOR_TRACE;
 extern const char *COLOR_DEBUG;
 extern const char *COLOR_UNIMPLEMENTED;
@@ -58,14 +193,17 @@ extern const char *COLOR_WARNING;
 extern const char *COLOR_ERROR;
 extern const char *COLOR_RESET;
 
-#define log_trace(...) global_logger.log(LogLevel::Trace, ##__VA_ARGS__);
-#define log_debug(...) global_logger.log(LogLevel::Debug, ##__VA_ARGS__);
+#define log_trace(...) current_logger().log(LogLevel::Trace, ##__VA_ARGS__);
+#define log_debug(...) current_logger().log(LogLevel::Debug, ##__VA_ARGS__);
 #define log_unimplemented(...) \
-  global_logger.log(LogLevel::Unimplemented, ##__VA_ARGS__);
-#define log_info(...) global_logger.log(LogLevel::Info, ##__VA_ARGS__);
-#define log_warn(...) global_logger.log(LogLevel::Warning, ##__VA_ARGS__);
-#define log_error(...) global_logger.log(LogLevel::Error, ##__VA_ARGS__);
+  current_logger().log(LogLevel::Unimplemented, ##__VA_ARGS__);
+#define log_info(...) current_logger().log(LogLevel::Info, ##__VA_ARGS__);
+#define log_warn(...) current_logger().log(LogLevel::Warning, ##__VA_ARGS__);
+#define log_error(...) current_logger().log(LogLevel::Error, ##__VA_ARGS__);
 
 extern void log_set_level(LogLevel level);
+
+/** Waits until every message logged so far has been written. */
+extern void log_flush();
 }  // namespace bugme
 #endif
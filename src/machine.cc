@@ -0,0 +1,183 @@
+#include "machine.hh"
+
+#include <cstring>
+#include <utility>
+
+#include "log.hh"
+#include "mmap.hh"
+#include "savestate.hh"
+#include "util.hh"
+
+namespace bugme {
+
+namespace {
+/** Offsets of each section of a save state. \see SaveStateHeader */
+inline const std::size_t MACHINE_STATE_OFFSET = sizeof(SaveStateHeader);
+inline const std::size_t CARTRIDGE_RAM_OFFSET =
+    MACHINE_STATE_OFFSET + sizeof(MachineState);
+}  // namespace
+
+Machine::Machine(std::vector<byte_t> rom, const std::string &save_filename,
+                 RtcClock rtc_clock)
+    : Machine(std::make_shared<const std::vector<byte_t>>(std::move(rom)),
+              save_filename, rtc_clock) {}
+
+Machine::Machine(std::shared_ptr<const std::vector<byte_t>> rom,
+                 const std::string &save_filename, RtcClock rtc_clock)
+    : rtc_clock_(rtc_clock),
+      cartridge(std::move(rom), save_filename, rtc_clock, cycles_),
+      memory(),
+      interrupts(),
+      ppu(memory, interrupts, frame_sink_),
+      timer(interrupts, cycles_),
+      joypad(interrupts),
+      serial(interrupts, cycles_),
+      apu(cycles_),
+      cpu(memory, cartridge, interrupts, ppu, timer, joypad, serial, apu,
+          cycles_) {
+#ifdef BUGME_TIMELINE
+  ppu.set_timeline(&timeline_);
+  cpu.set_timeline(&timeline_);
+#endif
+}
+
+std::unique_ptr<Machine> Machine::fork() {
+  auto child =
+      std::make_unique<Machine>(cartridge.rom(), std::string(), rtc_clock_);
+  child->cycles_ = cycles_;
+  child->frame_ready_ = frame_ready_;
+
+  // The registers of the remaining components are few enough to copy.
+  CpuState cpu_state;
+  cpu.save_state(cpu_state);
+  child->cpu.load_state(cpu_state);
+  TimerState timer_state;
+  timer.save_state(timer_state);
+  child->timer.load_state(timer_state);
+  JoypadState joypad_state;
+  joypad.save_state(joypad_state);
+  child->joypad.load_state(joypad_state);
+  ApuState apu_state;
+  apu.save_state(apu_state);
+  child->apu.load_state(apu_state);
+  SerialState serial_state;
+  serial.save_state(serial_state);
+  child->serial.load_state(serial_state);
+
+  // Memory is one flat block, small enough that copying it outright costs
+  // less than tracking which of its pages either machine dirties.
+  MemoryState memory_state;
+  memory.save_state(memory_state);
+  child->memory.load_state(memory_state);
+
+  child->cartridge.share(cartridge);
+  child->ppu.share(ppu);
+  return child;
+}
+
+bool Machine::step() {
+  BUGME_STATS(HostStats::Sample sample(host_stats_));
+  mcycles_t cycles = cpu.tick();
+  if (cycles == Cpu::STOPPED) {
+    return true;
+  }
+  BUGME_STATS(sample.lap(Subsystem::Cpu));
+  ppu.tick(cycles * 4);
+  BUGME_STATS(sample.lap(Subsystem::Ppu));
+  serial.tick(cycles * 4);
+  cycles_ += cycles * 4;
+  if (cycles_ >= timer.next_event()) {
+    timer.update();
+  }
+  BUGME_STATS(sample.lap(Subsystem::Timer));
+
+  if (frame_ready_) {
+    frame_ready_ = false;
+    return true;
+  }
+  return false;
+}
+
+void Machine::run_frame() {
+  while (!step()) {
+  }
+}
+
+Debugger &Machine::enable_debugger() {
+  if (!debugger_) {
+    debugger_ = std::make_unique<Debugger>(cpu);
+    cpu.set_debugger(debugger_.get());
+  }
+  return *debugger_;
+}
+
+const byte_t *Machine::memory_page(word_t addr) const {
+  if (!util::in_range(addr, mmap::WORK_RAM_START, mmap::WORK_RAM_END) &&
+      !util::in_range(addr, mmap::ZERO_PAGE_START, mmap::ZERO_PAGE_END)) {
+    return nullptr;
+  }
+  return memory.page(addr);
+}
+
+std::size_t Machine::state_size() const {
+  return CARTRIDGE_RAM_OFFSET + cartridge.state_ram_size();
+}
+
+void Machine::save_state(byte_t *buffer) const {
+  SaveStateHeader &header = *reinterpret_cast<SaveStateHeader *>(buffer);
+  std::memcpy(header.magic, SAVESTATE_MAGIC, sizeof(header.magic));
+  header.version = SAVESTATE_VERSION;
+  header.size = static_cast<std::uint32_t>(state_size());
+  std::memcpy(header.title, cartridge.header().title, sizeof(header.title));
+  header.global_checksum = util::fuse(cartridge.header().global_checksum[0],
+                                      cartridge.header().global_checksum[1]);
+
+  MachineState &state =
+      *reinterpret_cast<MachineState *>(buffer + MACHINE_STATE_OFFSET);
+  state.cycles = cycles_;
+  cpu.save_state(state.cpu);
+  memory.save_state(state.memory);
+  ppu.save_state(state.ppu);
+  timer.save_state(state.timer);
+  joypad.save_state(state.joypad);
+  apu.save_state(state.apu);
+  serial.save_state(state.serial);
+  cartridge.save_state(state.cartridge, buffer + CARTRIDGE_RAM_OFFSET);
+}
+
+bool Machine::load_state(const byte_t *buffer, std::size_t size) {
+  if (size < CARTRIDGE_RAM_OFFSET) {
+    log_warn("[machine] save state is truncated");
+    return false;
+  }
+
+  const SaveStateHeader &header =
+      *reinterpret_cast<const SaveStateHeader *>(buffer);
+  if (std::memcmp(header.magic, SAVESTATE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != SAVESTATE_VERSION) {
+    log_warn("[machine] incompatible save state");
+    return false;
+  }
+  if (header.size != state_size() || size < header.size ||
+      !cartridge.header().matches(header.title, header.global_checksum)) {
+    log_warn("[machine] save state belongs to another rom");
+    return false;
+  }
+
+  const MachineState &state =
+      *reinterpret_cast<const MachineState *>(buffer + MACHINE_STATE_OFFSET);
+  cycles_ = state.cycles;
+  cpu.load_state(state.cpu);
+  memory.load_state(state.memory);
+  ppu.load_state(state.ppu);
+  timer.load_state(state.timer);
+  joypad.load_state(state.joypad);
+  apu.load_state(state.apu);
+  serial.load_state(state.serial);
+  cartridge.load_state(state.cartridge, buffer + CARTRIDGE_RAM_OFFSET);
+  BUGME_EVENT(timeline_.reset_machine());
+  BUGME_PROFILE(cpu.profiler().reset_stack());
+  return true;
+}
+
+}  // namespace bugme
@@ -0,0 +1,251 @@
+#ifndef BUGME_MACHINE_HH
+#define BUGME_MACHINE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "apu.hh"
+#include "cartridge.hh"
+#include "cpu.hh"
+#include "debug.hh"
+#include "host_stats.hh"
+#include "interrupts.hh"
+#include "joypad.hh"
+#include "memory.hh"
+#include "ppu.hh"
+#include "serial.hh"
+#include "timeline.hh"
+#include "timer.hh"
+#include "types.hh"
+
+namespace bugme {
+
+enum class Color : byte_t;
+
+/**
+ * The emulated hardware of a single Gameboy, with no frontend attached.
+ *
+ * A Machine holds no references to global state and performs no I/O other
+ * than through its cartridge's save file, so any number of them may be run
+ * concurrently, each on at most one thread at a time.
+ *
+ * \see Gbc, for the SDL frontend
+ */
+class Machine : public Noncopyable {
+ public:
+  /**
+   * Constructor.
+   *
+   * \param rom The cartridge ROM.
+   * \param save_filename Where to persist battery-backed RAM, or empty to
+   *        keep it in memory only.
+   * \param rtc_clock The time source for the cartridge real-time clock.
+   */
+  Machine(std::vector<byte_t> rom, const std::string &save_filename,
+          RtcClock rtc_clock);
+
+  /** \param rom The cartridge ROM, shared with other machines. */
+  Machine(std::shared_ptr<const std::vector<byte_t>> rom,
+          const std::string &save_filename, RtcClock rtc_clock);
+
+  /**
+   * Clones this machine, for exploring alternative futures of it.
+   *
+   * The clone shares the ROM, and the cartridge RAM, whose pages are copied
+   * only once either machine writes to them. The rest of the memory (work
+   * RAM, VRAM, OAM and high RAM) is a single block of some 16 KB, which is
+   * copied outright. Forking is therefore cheap. The clone keeps its
+   * cartridge RAM in memory only; if this machine has a save file, that RAM
+   * is copied rather than shared.
+   *
+   * The clone may be run on another thread than this machine. It is not
+   * plugged into any link cable, and has no debugger.
+   */
+  std::unique_ptr<Machine> fork();
+
+  /**
+   * Emulates a single instruction.
+   *
+   * \return true if a frame was completed by this instruction, or if the
+   *         debugger stopped the machine before it.
+   */
+  bool step();
+
+  /** Emulates up to the end of the next frame, or until the debugger stops. */
+  void run_frame();
+
+  /**
+   * \return The most recently completed frame. The reference remains valid,
+   *         and its contents unchanged, until the next frame is completed.
+   */
+  const std::vector<Color> &frame_buffer() const { return ppu.frame_buffer(); }
+
+  /**
+   * Gives direct access to work RAM and high RAM, a page of
+   * Memory::PAGE_SIZE bytes at a time.
+   *
+   * \param addr An address in work RAM (0xC000-0xDFFF) or high RAM
+   *        (0xFF80-0xFFFE).
+   * \return The start of the page holding addr, or nullptr if addr is
+   *         outside those ranges. The pointer is valid for the machine's
+   *         lifetime; the bytes it points at change as the machine runs or
+   *         loads a state.
+   */
+  const byte_t *memory_page(word_t addr) const;
+
+  /** \see Cpu::set_accurate_dma */
+  void set_accurate_dma(bool enabled) { cpu.set_accurate_dma(enabled); }
+
+  /** \see Ppu::set_rendering */
+  void set_rendering(bool enabled) { ppu.set_rendering(enabled); }
+
+  /**
+   * Enables sound output at sample_rate samples per second, or disables it
+   * if sample_rate is 0. Output is disabled by default, and costs next to
+   * nothing while it is.
+   */
+  void set_sample_rate(unsigned int sample_rate) {
+    apu.set_sample_rate(sample_rate);
+  }
+
+  /** \see Apu::set_rate_adjustment */
+  void set_rate_adjustment(double ratio) { apu.set_rate_adjustment(ratio); }
+
+  /** \see Apu::read_samples */
+  std::size_t read_samples(std::int16_t *out, std::size_t frames) {
+    return apu.read_samples(out, frames);
+  }
+
+  /**
+   * Marks the frames emulated from here on as speculative: they will be
+   * undone by loading the state saved before them, and until then should
+   * leave no trace outside the machine.
+   *
+   * \see Apu::set_speculative
+   * \see Cartridge::set_speculative
+   * \see Profiler::set_suspended
+   */
+  void set_speculative(bool speculative) {
+    apu.set_speculative(speculative);
+    cartridge.set_speculative(speculative);
+    BUGME_PROFILE(cpu.profiler().set_suspended(speculative));
+  }
+
+  /**
+   * Plugs the serial port into one end (0 or 1) of a link cable, whose other
+   * end is plugged into a machine running on another thread. The machine
+   * must be unplugged, or destroyed, before the cable is.
+   */
+  void plug(LinkCable &cable, unsigned int end) { serial.plug(cable, end); }
+
+  /** Unplugs the serial port, releasing the other machine if it waits on us. */
+  void unplug() { serial.unplug(); }
+
+  /** \see Serial::register_output_cb */
+  void set_serial_output(std::function<void(byte_t)> cb) {
+    serial.register_output_cb(std::move(cb));
+  }
+
+  /**
+   * Attaches a debugger, if none is yet, which stops the machine at its
+   * breakpoints and watchpoints. Without one, the machine pays nothing for
+   * the possibility.
+   */
+  Debugger &enable_debugger();
+  /** \return The debugger, or nullptr if none is attached. */
+  Debugger *debugger() { return debugger_.get(); }
+
+  /** \see Cpu::set_trace */
+  void set_trace(TraceWriter *trace, bool stub_ly = false) {
+    cpu.set_trace(trace, stub_ly);
+  }
+
+  /** \return The held buttons, as a mask of button_mask() bits. */
+  byte_t buttons() const { return joypad.buttons(); }
+  void set_buttons(byte_t buttons) { joypad.set_buttons(buttons); }
+
+  /** \return T-cycles elapsed since power on. */
+  std::uint64_t cycles() const { return cycles_; }
+
+  /** \see Cpu::instructions */
+  std::uint64_t instructions() const { return cpu.instructions(); }
+
+  const CartridgeHeader &header() const { return cartridge.header(); }
+
+#ifdef BUGME_PROFILER
+  const Profiler &profiler() const { return cpu.profiler(); }
+#endif
+
+#ifdef BUGME_HOST_STATS
+  /** Host time spent in each part of step(), and by the frontend. */
+  HostStats &host_stats() { return host_stats_; }
+#endif
+
+#ifdef BUGME_TIMELINE
+  /**
+   * Where this machine marks its scanlines, VBlank, HALT and interrupt
+   * handlers, and where the frontend may mark its own work between them.
+   */
+  Timeline &timeline() { return timeline_; }
+#endif
+
+  /** \return The size, in bytes, of a save state of this machine. */
+  std::size_t state_size() const;
+
+  /**
+   * Captures the complete machine state.
+   *
+   * \param buffer Where to write the state. Must hold state_size() bytes and
+   *        be aligned to 8 bytes.
+   */
+  void save_state(byte_t *buffer) const;
+
+  /**
+   * Restores the complete machine state.
+   *
+   * \param buffer A state written by save_state(), aligned to 8 bytes.
+   * \param size The size of buffer, in bytes.
+   * \return false (leaving the machine untouched) if buffer is not a
+   *         compatible save state for the loaded ROM.
+   */
+  bool load_state(const byte_t *buffer, std::size_t size);
+
+ private:
+  /** T-cycles elapsed since power on. */
+  std::uint64_t cycles_ = 0;
+  bool frame_ready_ = false;
+  RtcClock rtc_clock_;
+#ifdef BUGME_HOST_STATS
+  HostStats host_stats_;
+#endif
+#ifdef BUGME_TIMELINE
+  Timeline timeline_;
+#endif
+
+  /** Hands the PPU's frames to step(), by way of frame_ready_. */
+  struct FrameReady {
+    bool &ready;
+    void operator()(std::vector<Color> &) { ready = true; }
+  };
+  FrameReady frame_sink_{frame_ready_};
+
+  Cartridge cartridge;
+  Memory memory;
+  Interrupts interrupts;
+  Ppu ppu;
+  Timer timer;
+  Joypad joypad;
+  Serial serial;
+  Apu apu;
+  Cpu cpu;
+  std::unique_ptr<Debugger> debugger_;
+};
+
+}  // namespace bugme
+
+#endif
@@ -1,11 +1,22 @@
 #include "memory.hh"
 
-namespace bugme {
+#include <cstddef>
+
+#include "mmap.hh"
+#include "util.hh"
 
-Memory::Memory() : memory_(std::vector<byte_t>(0x10000)) {}
+namespace bugme {
 
-byte_t Memory::read(word_t addr) const { return memory_.at(addr); }
+static_assert(offsetof(MemoryState, high_ram) ==
+                  offsetof(MemoryState, io) + sizeof(MemoryState::io),
+              "0xFF00-0xFFFF must be one page");
 
-void Memory::write(word_t addr, byte_t byte) { memory_.at(addr) = byte; }
+const byte_t *Memory::page(word_t addr) const {
+  if (util::in_range(addr, mmap::WORK_RAM_START, mmap::WORK_RAM_END)) {
+    return regions_.work_ram +
+           ((addr - mmap::WORK_RAM_START) & ~(PAGE_SIZE - 1));
+  }
+  return regions_.io;
+}
 
 }  // namespace bugme
@@ -1,22 +1,62 @@
 #ifndef BUGME_MEMORY_HH
 #define BUGME_MEMORY_HH
 
-#include <vector>
+#include <cstddef>
 
+#include "savestate.hh"
 #include "types.hh"
 
 namespace bugme {
 
+/**
+ * The machine's own memory: video RAM, work RAM, OAM, the I/O registers that
+ * no component holds, and high RAM.
+ *
+ * It is all one fixed-size block, held inline and laid out as its save state,
+ * so saving, loading or forking it is a single copy of some 16 KB. Accessors
+ * take offsets into their region and do not check them: the CPU has already
+ * decoded the address to get there.
+ */
 class Memory : public Noncopyable {
  public:
-  Memory();
+  /** \see page */
+  static constexpr std::size_t PAGE_SIZE = 0x100;
+
+  Memory() = default;
   virtual ~Memory() = default;
 
-  byte_t read(word_t addr) const;
-  void write(word_t addr, byte_t byte);
+  /** 0x8000-0x9FFF */
+  byte_t *vram() { return regions_.vram; }
+  const byte_t *vram() const { return regions_.vram; }
+  /** 0xC000-0xDFFF, which 0xE000-0xFDFF echoes. */
+  byte_t *work_ram() { return regions_.work_ram; }
+  const byte_t *work_ram() const { return regions_.work_ram; }
+  /** 0xFE00-0xFE9F */
+  byte_t *oam() { return regions_.oam; }
+  const byte_t *oam() const { return regions_.oam; }
+  /** 0xFEA0-0xFEFF */
+  byte_t *unused() { return regions_.unused; }
+  const byte_t *unused() const { return regions_.unused; }
+  /** 0xFF00-0xFF7F */
+  byte_t *io() { return regions_.io; }
+  const byte_t *io() const { return regions_.io; }
+  /** 0xFF80-0xFFFF */
+  byte_t *high_ram() { return regions_.high_ram; }
+  const byte_t *high_ram() const { return regions_.high_ram; }
+
+  /**
+   * \param addr An address in work RAM (0xC000-0xDFFF) or in the last page
+   *        (0xFF00-0xFFFF).
+   * \return The PAGE_SIZE bytes holding addr, starting at addr rounded down
+   *         to a multiple of PAGE_SIZE.
+   */
+  const byte_t *page(word_t addr) const;
+
+  void save_state(MemoryState &state) const { state = regions_; }
+  void load_state(const MemoryState &state) { regions_ = state; }
 
  private:
-  std::vector<byte_t> memory_;
+  MemoryState regions_ = {};
 };
 
 }  // namespace bugme
@@ -43,6 +43,11 @@ namespace joypad {
 inline const word_t JOYP = 0xFF00;
 }  // namespace joypad
 
+namespace serial {
+inline const word_t SB = 0xFF01;
+inline const word_t SC = 0xFF02;
+}  // namespace serial
+
 namespace timer {
 inline const word_t DIV = 0xFF04;
 inline const word_t TIMA = 0xFF05;
@@ -50,6 +55,33 @@ inline const word_t TMA = 0xFF06;
 inline const word_t TAC = 0xFF07;
 }  // namespace timer
 
+namespace apu {
+inline const word_t START = 0xFF10;
+inline const word_t NR10 = 0xFF10;
+inline const word_t NR11 = 0xFF11;
+inline const word_t NR12 = 0xFF12;
+inline const word_t NR13 = 0xFF13;
+inline const word_t NR14 = 0xFF14;
+inline const word_t NR21 = 0xFF16;
+inline const word_t NR22 = 0xFF17;
+inline const word_t NR23 = 0xFF18;
+inline const word_t NR24 = 0xFF19;
+inline const word_t NR30 = 0xFF1A;
+inline const word_t NR31 = 0xFF1B;
+inline const word_t NR32 = 0xFF1C;
+inline const word_t NR33 = 0xFF1D;
+inline const word_t NR34 = 0xFF1E;
+inline const word_t NR41 = 0xFF20;
+inline const word_t NR42 = 0xFF21;
+inline const word_t NR43 = 0xFF22;
+inline const word_t NR44 = 0xFF23;
+inline const word_t NR50 = 0xFF24;
+inline const word_t NR51 = 0xFF25;
+inline const word_t NR52 = 0xFF26;
+inline const word_t WAVE_RAM_START = 0xFF30;
+inline const word_t END = 0xFF3F;
+}  // namespace apu
+
 namespace ppu {
 inline const word_t LCD_CONTROL = 0xFF40;
 inline const word_t LCD_STATUS = 0xFF41;
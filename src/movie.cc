@@ -0,0 +1,95 @@
+#include "movie.hh"
+
+#include <cstring>
+
+#include "log.hh"
+
+namespace bugme {
+
+MovieWriter::MovieWriter(const std::string &filename,
+                         const MovieFileHeader &header)
+    : filename_(filename),
+      stream_(filename, std::ios_base::binary | std::ios_base::trunc),
+      header_(header) {
+  std::memcpy(header_.magic, MOVIE_MAGIC, sizeof(header_.magic));
+  header_.version = MOVIE_VERSION;
+  header_.event_count = 0;
+
+  // Reserve room for the header; it is rewritten once the movie is finished.
+  stream_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+  if (!stream_.good()) {
+    log_error("[movie] cannot write %s", filename_.c_str());
+  }
+}
+
+MovieWriter::~MovieWriter() {
+  if (!finished_) {
+    finish(header_.end_cycles, header_.frame_hash);
+  }
+}
+
+void MovieWriter::write(std::uint64_t cycles, byte_t buttons) {
+  MovieEvent event = {};
+  event.cycles = cycles;
+  event.buttons = buttons;
+  stream_.write(reinterpret_cast<const char *>(&event), sizeof(event));
+  ++header_.event_count;
+}
+
+void MovieWriter::finish(std::uint64_t end_cycles, std::uint64_t frame_hash) {
+  finished_ = true;
+  header_.end_cycles = end_cycles;
+  header_.frame_hash = frame_hash;
+
+  stream_.seekp(0, std::ios::beg);
+  stream_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+  stream_.flush();
+  if (!stream_.good()) {
+    log_error("[movie] cannot write %s", filename_.c_str());
+    return;
+  }
+
+  log_info("[movie] recorded %u events over %llu cycles to %s",
+           header_.event_count,
+           static_cast<unsigned long long>(header_.end_cycles),
+           filename_.c_str());
+}
+
+MovieReader::MovieReader(const std::string &filename) {
+  std::ifstream s(filename, std::ios_base::binary | std::ios_base::ate);
+  if (!s.good()) {
+    log_error("[movie] cannot read %s", filename.c_str());
+    return;
+  }
+
+  std::size_t file_size = static_cast<std::size_t>(s.tellg());
+  s.seekg(0, std::ios::beg);
+  s.read(reinterpret_cast<char *>(&header_), sizeof(header_));
+  if (!s.good() ||
+      std::memcmp(header_.magic, MOVIE_MAGIC, sizeof(header_.magic)) != 0 ||
+      header_.version != MOVIE_VERSION ||
+      file_size <
+          sizeof(header_) + header_.event_count * sizeof(MovieEvent)) {
+    log_error("[movie] %s is not a compatible movie", filename.c_str());
+    return;
+  }
+
+  events_.resize(header_.event_count);
+  s.read(reinterpret_cast<char *>(events_.data()),
+         static_cast<std::streamsize>(events_.size() * sizeof(MovieEvent)));
+  good_ = s.good();
+  if (!good_) {
+    log_error("[movie] cannot read %s", filename.c_str());
+  }
+}
+
+bool MovieReader::next(std::uint64_t cycles, byte_t &buttons) {
+  if (position_ == events_.size() || events_[position_].cycles > cycles) {
+    return false;
+  }
+
+  buttons = events_[position_++].buttons;
+  return true;
+}
+
+}  // namespace bugme
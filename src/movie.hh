@@ -0,0 +1,120 @@
+#ifndef BUGME_MOVIE_HH
+#define BUGME_MOVIE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "types.hh"
+
+namespace bugme {
+
+/**
+ * A single change of joypad state.
+ *
+ * Input is only applied at frame boundaries, so an event is stamped with the
+ * T-cycle count at the end of the frame on which it took effect. Replaying it
+ * at the same cycle count reproduces the run exactly.
+ */
+struct MovieEvent {
+  std::uint64_t cycles;
+  /** Bitmask of held buttons, in the layout of JoypadState::buttons. */
+  byte_t buttons;
+  byte_t reserved[7];
+};
+static_assert(sizeof(MovieEvent) == 16);
+
+/**
+ * On-disk layout of an input movie:
+ *
+ *   MovieFileHeader
+ *   MovieEvent[event_count], in increasing order of cycles
+ *
+ * Movies always start from power on, with blank cartridge RAM: save files are
+ * neither read nor written while a movie is in use.
+ */
+struct MovieFileHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t event_count;
+  /** Identifies the ROM that the movie belongs to. */
+  byte_t title[16];
+  word_t global_checksum;
+  byte_t rtc_clock;  // RtcClock the movie was recorded with
+  byte_t reserved[13];
+  /** T-cycle count of the last frame of the recording. */
+  std::uint64_t end_cycles;
+  /** FNV-1a of the frame buffer of that frame. */
+  std::uint64_t frame_hash;
+};
+static_assert(sizeof(MovieFileHeader) == 64);
+
+inline const char MOVIE_MAGIC[8] = {'B', 'U', 'G', 'M', 'E', 'M', 'O', 'V'};
+inline const std::uint32_t MOVIE_VERSION = 1;
+
+/** Streams input events to a movie file as they are recorded. */
+class MovieWriter : public Noncopyable {
+ public:
+  /**
+   * \param filename Where to write the movie. Any existing file is replaced.
+   * \param header Describes the ROM; event_count, end_cycles and frame_hash
+   *        are filled in by finish().
+   */
+  MovieWriter(const std::string &filename, const MovieFileHeader &header);
+
+  /** Finishes the movie if finish() was never called. */
+  ~MovieWriter();
+
+  bool good() const { return stream_.good(); }
+
+  void write(std::uint64_t cycles, byte_t buttons);
+
+  /**
+   * Records where the movie ends, and rewrites the header.
+   *
+   * \param end_cycles The T-cycle count of the last frame.
+   * \param frame_hash The hash of the last frame.
+   */
+  void finish(std::uint64_t end_cycles, std::uint64_t frame_hash);
+
+ private:
+  std::string filename_;
+  std::ofstream stream_;
+  MovieFileHeader header_;
+  bool finished_ = false;
+};
+
+/** Reads back a movie file, and hands out its events in order. */
+class MovieReader : public Noncopyable {
+ public:
+  /** Loads the whole movie. On failure, good() is false. */
+  explicit MovieReader(const std::string &filename);
+
+  bool good() const { return good_; }
+
+  const MovieFileHeader &header() const { return header_; }
+
+  /**
+   * Retrieves the next event due at or before the given cycle count.
+   *
+   * \param cycles The current T-cycle count.
+   * \param buttons Receives the event's button mask.
+   * \return false if no event is due.
+   */
+  bool next(std::uint64_t cycles, byte_t &buttons);
+
+  /** \return true once the replay has reached the end of the recording. */
+  bool done(std::uint64_t cycles) const { return cycles >= header_.end_cycles; }
+
+ private:
+  MovieFileHeader header_ = {};
+  std::vector<MovieEvent> events_;
+  std::size_t position_ = 0;
+  bool good_ = false;
+};
+
+}  // namespace bugme
+
+#endif
@@ -73,7 +73,7 @@ static const std::string NAMES[256] = {
     "DEC SP",
     "INC A",
     "DEC A",
-    "LDA,n",
+    "LD A,n",
     "CCF",
 
     "LD B,B",
@@ -219,7 +219,7 @@ static const std::string NAMES[256] = {
     "CALL NZ,nn",
     "PUSH BC",
     "ADD A,n",
-    "RST ",
+    "RST 0x00",
     "RET Z",
     "RET",
     "JP Z,nn",
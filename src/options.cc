@@ -1,5 +1,6 @@
 #include "options.hh"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -28,6 +29,46 @@ CliOptions get_cli_options(int argc, char *argv[]) {
       ++i;
     } else if (flags[i] == "--headless") {
       cliOptions.options.headless = true;
+    } else if (flags[i] == "--no-audio") {
+      cliOptions.options.audio = false;
+    } else if (flags[i] == "--sync" && i + 1 < flags.size()) {
+      cliOptions.options.sync =
+          flags[++i] == "audio" ? Sync::Audio : Sync::Video;
+    } else if (flags[i] == "--rom-index" && i + 1 < flags.size()) {
+      cliOptions.options.rom_index = flags[++i];
+    } else if (flags[i] == "--load-state" && i + 1 < flags.size()) {
+      cliOptions.options.load_state = flags[++i];
+    } else if (flags[i] == "--rewind" && i + 1 < flags.size()) {
+      int megabytes = std::max(0, std::atoi(flags[++i].c_str()));
+      cliOptions.options.rewind_budget =
+          static_cast<std::size_t>(megabytes) * 1024 * 1024;
+    } else if (flags[i] == "--rewind-interval" && i + 1 < flags.size()) {
+      cliOptions.options.rewind_interval =
+          static_cast<unsigned int>(std::max(1, std::atoi(flags[++i].c_str())));
+    } else if (flags[i] == "--run-ahead" && i + 1 < flags.size()) {
+      cliOptions.options.run_ahead =
+          static_cast<unsigned int>(std::max(0, std::atoi(flags[++i].c_str())));
+    } else if (flags[i] == "--record" && i + 1 < flags.size()) {
+      cliOptions.options.record_movie = flags[++i];
+    } else if (flags[i] == "--play" && i + 1 < flags.size()) {
+      cliOptions.options.play_movie = flags[++i];
+    } else if (flags[i] == "--profile" && i + 1 < flags.size()) {
+      cliOptions.options.profile = flags[++i];
+    } else if (flags[i] == "--stats") {
+      cliOptions.options.stats = true;
+    } else if (flags[i] == "--timeline" && i + 1 < flags.size()) {
+      cliOptions.options.timeline = flags[++i];
+    } else if (flags[i] == "--trace" && i + 1 < flags.size()) {
+      cliOptions.options.trace = flags[++i];
+    } else if (flags[i] == "--trace-doctor") {
+      cliOptions.options.trace_doctor = true;
+    } else if (flags[i] == "--accurate-dma") {
+      cliOptions.options.accurate_dma = true;
+    } else if (flags[i] == "--print-serial") {
+      cliOptions.options.print_serial = true;
+    } else if (flags[i] == "--rtc-clock" && i + 1 < flags.size()) {
+      cliOptions.options.rtc_clock =
+          flags[++i] == "emulated" ? RtcClock::Emulated : RtcClock::Host;
     } else {
       log_error("Unknown flag: %s", flags[i].c_str());
     }
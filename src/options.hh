@@ -3,11 +3,59 @@
 
 #include <string>
 
+#include "rtc.hh"
+
 namespace bugme {
+/** What paces emulation in the SDL frontend. */
+enum class Sync {
+  /** The display's refresh: one frame per vsync, at 60 rather than 59.73 Hz. */
+  Video,
+  /** The audio device: emulation waits while enough sound is queued. */
+  Audio
+};
+
 struct Options {
   bool debug = false;
   int verbosity = 0;
   bool headless = false;
+  /** Play sound. Headless runs never do. */
+  bool audio = true;
+  Sync sync = Sync::Video;
+  std::string rom_index;
+  RtcClock rtc_clock = RtcClock::Host;
+  std::string load_state;
+  /** Memory set aside for rewind history, in bytes. 0 disables rewind. */
+  std::size_t rewind_budget = 0;
+  /** How many frames apart rewind snapshots are taken. */
+  unsigned int rewind_interval = 1;
+  /** Frames emulated ahead of the real machine before presenting. */
+  unsigned int run_ahead = 0;
+  /** Input movie to record to, or to replay. */
+  std::string record_movie;
+  std::string play_movie;
+  /** Time OAM DMA, with its bus conflicts, rather than completing it at once. */
+  bool accurate_dma = false;
+  /** Echo bytes sent over the serial port, as test ROMs report results. */
+  bool print_serial = false;
+  /**
+   * Where to write a guest code profile at exit, as prefix.txt and
+   * prefix.folded. Needs a build with BUGME_PROFILER.
+   */
+  std::string profile;
+  /**
+   * Show where host time goes, once a second, and in total at exit. Needs a
+   * build with BUGME_HOST_STATS.
+   */
+  bool stats = false;
+  /**
+   * Where to write a timeline of frames at exit, in the Chrome trace event
+   * format. Needs a build with BUGME_TIMELINE.
+   */
+  std::string timeline;
+  /** Where to write an execution trace, for bugme-tracediff. */
+  std::string trace;
+  /** Trace as gameboy-doctor does, reading LY as 0x90. */
+  bool trace_doctor = false;
 };
 
 struct CliOptions {
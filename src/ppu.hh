@@ -1,14 +1,18 @@
 #ifndef BUGME_PPU_HH
 #define BUGME_PPU_HH
 
-#include <functional>
 #include <memory>
 #include <vector>
 
 #include "bus.hh"
+#include "interrupts.hh"
+#include "memory.hh"
 #include "mmap.hh"
 #include "register.hh"
+#include "savestate.hh"
+#include "timeline.hh"
 #include "types.hh"
+#include "util.hh"
 
 namespace bugme {
 
@@ -42,13 +46,6 @@ public:
 
 class Ppu;
 struct PpuBus : Bus<Ppu> {
-  PpuBus()
-      : vram(std::vector<byte_t>(mmap::VRAM_END - mmap::VRAM_START + 1)),
-        oam(std::vector<byte_t>(mmap::OAM_END - mmap::OAM_START + 1)) {}
-
-  std::vector<byte_t> vram;
-  std::vector<byte_t> oam;
-
   LcdControl lcd_control;         // 0xFF40
   LcdStatus lcd_status;           // 0xFF41
   ByteRegister scroll_y;          // 0xFF42
@@ -61,43 +58,54 @@ struct PpuBus : Bus<Ppu> {
   ByteRegister sprite_palette_1;  // 0xFF49
   ByteRegister window_y;          // 0xFF4A
   ByteRegister window_x;          // 0xFF4B
-
-  std::function<void()> vblank_interrupt_request_cb = nullptr;
-  std::function<void()> lcd_stat_interrupt_request_cb = nullptr;
-
-  void register_vblank_interrupt_request_cb(std::function<void()> cb) {
-    vblank_interrupt_request_cb = cb;
-  }
-
-  void register_lcd_stat_interrupt_request_cb(std::function<void()> cb) {
-    lcd_stat_interrupt_request_cb = cb;
-  }
-
-  void vblank_interrupt_request() {
-    if (vblank_interrupt_request_cb) {
-      vblank_interrupt_request_cb();
-    } else {
-      log_error("No vblank interrupt request callback has been registered!");
-    }
-  }
-
-  void lcd_stat_interrupt_request() {
-    if (lcd_stat_interrupt_request_cb) {
-      lcd_stat_interrupt_request_cb();
-    } else {
-      log_error("No lcd stat interrupt request callback has been registered!");
-    }
-  }
 };
 
-enum class Color;
+enum class Color : byte_t;
+
+/** Receives each frame as the PPU completes it. */
+using FrameSink = util::FunctionRef<void(std::vector<Color> &)>;
+
 class Ppu : public PpuBus {
  public:
-  explicit Ppu(std::function<void(std::vector<Color> &)> draw_fn);
+  /**
+   * \param memory Where VRAM and OAM are read from.
+   * \param frame_sink Which must outlive the PPU.
+   */
+  Ppu(const Memory &memory, Interrupts &interrupts, FrameSink frame_sink);
   virtual ~Ppu() = default;
 
   void tick(tcycles_t cycles);
 
+  /**
+   * Enables or disables drawing to the frame buffer. Timing, registers and
+   * interrupts are unaffected, so frames that are never displayed can be
+   * emulated without paying for their pixels.
+   */
+  void set_rendering(bool enabled) { rendering_ = enabled; }
+
+  /**
+   * \return The most recently completed frame, which is left untouched while
+   *         the next one is drawn.
+   */
+  const std::vector<Color> &frame_buffer() const { return *front_buffer_; }
+
+  void save_state(PpuState &state) const;
+  void load_state(const PpuState &state);
+
+  /**
+   * Makes this PPU identical to other, sharing its frame buffers
+   * copy-on-write rather than copying them. VRAM and OAM belong to Memory.
+   */
+  void share(Ppu &other);
+
+#ifdef BUGME_TIMELINE
+  /** Marks scanlines and VBlank on timeline, which may be null. */
+  void set_timeline(Timeline *timeline) { timeline_ = timeline; }
+#endif
+
+  /** Times the internals directly. \see bench/micro.cc */
+  friend class MicroBench;
+
  private:
   enum class Mode { READ_OAM, READ_VRAM, HBLANK, VBLANK };
 
@@ -107,12 +115,22 @@ class Ppu : public PpuBus {
   void write_window_line_();
   void draw_sprites_();
   void set_pixel_(unsigned int x, unsigned int y, Color color);
+  /** Gives this PPU a frame buffer of its own, if it still shares one. */
+  void own_frame_buffer_(bool copy);
   Color get_color_(byte_t color, const ByteRegister &palette_register) const;
 
+  const Memory &memory_;
+  Interrupts &interrupts_;
   Mode mode_ = Mode::READ_OAM;
   tcycles_t cycles_elapsed_ = 0;
-  std::vector<Color> frame_buffer_;
-  std::function<void(std::vector<Color> &)> draw_fn_;
+  /** Shared with forks until drawn to. \see share */
+  std::shared_ptr<std::vector<Color>> frame_buffer_;
+  std::shared_ptr<std::vector<Color>> front_buffer_;
+  FrameSink frame_sink_;
+  bool rendering_ = true;
+#ifdef BUGME_TIMELINE
+  Timeline *timeline_ = nullptr;
+#endif
 };
 
 }  // namespace bugme
@@ -1,5 +1,7 @@
 #include "ppu.hh"
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 
 #include "color.hh"
@@ -48,11 +50,24 @@ inline const unsigned int SCANLINES_PER_FRAME = 144;
 // inline const unsigned int CLOCKS_PER_FRAME =
 //     (CLOCKS_PER_SCANLINE * SCANLINES_PER_FRAME) + CLOCKS_PER_VBLANK;
 
+/**
+ * The frame every PPU starts out with, on both buffers. Being shared, it is
+ * copied rather than drawn to.
+ */
+std::shared_ptr<std::vector<Color>> blank_frame() {
+  static const std::shared_ptr<std::vector<Color>> frame =
+      std::make_shared<std::vector<Color>>(FRAME_WIDTH_PX * FRAME_HEIGHT_PX);
+  return frame;
+}
+
 }  // namespace
 
-Ppu::Ppu(std::function<void(std::vector<Color> &)> draw_fn)
-    : frame_buffer_(std::vector<Color>(FRAME_WIDTH_PX * FRAME_HEIGHT_PX)),
-      draw_fn_(draw_fn) {}
+Ppu::Ppu(const Memory &memory, Interrupts &interrupts, FrameSink frame_sink)
+    : memory_(memory),
+      interrupts_(interrupts),
+      frame_buffer_(blank_frame()),
+      front_buffer_(blank_frame()),
+      frame_sink_(frame_sink) {}
 
 void Ppu::tick(tcycles_t cycles) {
   cycles_elapsed_ += cycles;
@@ -74,7 +89,7 @@ void Ppu::tick(tcycles_t cycles) {
         if (lcd_status.interrupt_on_hblank() ||
             (lcd_status.interrupt_on_ly_lyc_coincide() &&
              ly_compare.value() == line.value())) {
-          lcd_stat_interrupt_request();
+          interrupts_.request(Interrupt::LCD_STAT);
         }
 
         lcd_status.write_ly_lyc_coincide(ly_compare == line);
@@ -87,10 +102,13 @@ void Ppu::tick(tcycles_t cycles) {
       if (cycles_elapsed_ >= CLOCKS_PER_HBLANK) {
         cycles_elapsed_ %= CLOCKS_PER_HBLANK;
 
-        write_scanline_();
+        if (rendering_) {
+          own_frame_buffer_(true);
+          write_scanline_();
+        }
         line.increment();
         if (line.value() == SCANLINES_PER_FRAME) {
-          vblank_interrupt_request();
+          interrupts_.request(Interrupt::VBLANK);
           set_mode_(Mode::VBLANK);
         } else {
           set_mode_(Mode::READ_OAM);
@@ -106,29 +124,108 @@ void Ppu::tick(tcycles_t cycles) {
         line.increment();
         // Check if we've reached the end of our vblank.
         if (line.value() == SCANLINES_PER_FRAME + SCANLINES_PER_VBLANK) {
-          if (lcd_control.obj_enable()) {
+          if (rendering_ && lcd_control.obj_enable()) {
+            own_frame_buffer_(true);
             draw_sprites_();
           }
 
           // Draw the completed frame buffer now.
-          draw_fn_(frame_buffer_);
+          frame_buffer_.swap(front_buffer_);
+          frame_sink_(*front_buffer_);
 
           // Reset the PPU to the first scanline.
           line.reset();
           set_mode_(Mode::READ_OAM);
 
           // Wipe the buffer for the next frame.
-          for (unsigned int px = 0; px < FRAME_WIDTH_PX * FRAME_HEIGHT_PX;
-               ++px) {
-            frame_buffer_.at(px) = Color::WHITE;
-          }
+          own_frame_buffer_(false);
+          std::fill(frame_buffer_->begin(), frame_buffer_->end(),
+                    Color::WHITE);
         }
       }
       break;
   }
 }
 
+void Ppu::save_state(PpuState &state) const {
+  state.lcd_control = lcd_control.value();
+  state.lcd_status = lcd_status.value();
+  state.scroll_y = scroll_y.value();
+  state.scroll_x = scroll_x.value();
+  state.line = line.value();
+  state.ly_compare = ly_compare.value();
+  state.dma_transfer = dma_transfer.value();
+  state.bg_palette = bg_palette.value();
+  state.sprite_palette_0 = sprite_palette_0.value();
+  state.sprite_palette_1 = sprite_palette_1.value();
+  state.window_y = window_y.value();
+  state.window_x = window_x.value();
+  state.mode = static_cast<byte_t>(mode_);
+  state.cycles_elapsed = cycles_elapsed_;
+  std::memcpy(state.frame_buffer, front_buffer_->data(),
+              sizeof(state.frame_buffer));
+}
+
+void Ppu::load_state(const PpuState &state) {
+  lcd_control.set(state.lcd_control);
+  lcd_status.set(state.lcd_status);
+  scroll_y.set(state.scroll_y);
+  scroll_x.set(state.scroll_x);
+  line.set(state.line);
+  ly_compare.set(state.ly_compare);
+  dma_transfer.set(state.dma_transfer);
+  bg_palette.set(state.bg_palette);
+  sprite_palette_0.set(state.sprite_palette_0);
+  sprite_palette_1.set(state.sprite_palette_1);
+  window_y.set(state.window_y);
+  window_x.set(state.window_x);
+  mode_ = static_cast<Mode>(state.mode);
+  cycles_elapsed_ = state.cycles_elapsed;
+  // The front buffer may be shared with a fork, so it is replaced rather
+  // than written through.
+  front_buffer_ = std::make_shared<std::vector<Color>>(
+      FRAME_WIDTH_PX * FRAME_HEIGHT_PX);
+  std::memcpy(front_buffer_->data(), state.frame_buffer,
+              sizeof(state.frame_buffer));
+  own_frame_buffer_(false);
+  std::fill(frame_buffer_->begin(), frame_buffer_->end(), Color::WHITE);
+}
+
+void Ppu::share(Ppu &other) {
+  lcd_control.set(other.lcd_control.value());
+  lcd_status.set(other.lcd_status.value());
+  scroll_y.set(other.scroll_y.value());
+  scroll_x.set(other.scroll_x.value());
+  line.set(other.line.value());
+  ly_compare.set(other.ly_compare.value());
+  dma_transfer.set(other.dma_transfer.value());
+  bg_palette.set(other.bg_palette.value());
+  sprite_palette_0.set(other.sprite_palette_0.value());
+  sprite_palette_1.set(other.sprite_palette_1.value());
+  window_y.set(other.window_y.value());
+  window_x.set(other.window_x.value());
+  mode_ = other.mode_;
+  cycles_elapsed_ = other.cycles_elapsed_;
+  frame_buffer_ = other.frame_buffer_;
+  front_buffer_ = other.front_buffer_;
+  rendering_ = other.rendering_;
+}
+
 void Ppu::set_mode_(Mode mode) {
+#ifdef BUGME_TIMELINE
+  if (timeline_) {
+    if (mode == Mode::READ_OAM) {
+      if (mode_ == Mode::VBLANK) {
+        timeline_->end(Track::Ppu);
+      }
+      timeline_->begin(Track::Ppu, Event::Line, line.value());
+    } else if (mode == Mode::HBLANK) {
+      timeline_->end(Track::Ppu);
+    } else if (mode == Mode::VBLANK) {
+      timeline_->begin(Track::Ppu, Event::VBlank);
+    }
+  }
+#endif
   mode_ = mode;
   switch (mode) {
     case Mode::READ_OAM:
@@ -198,7 +295,7 @@ void Ppu::write_bg_line_() {
 
     unsigned int tile_id_idx = tile_y * TILES_PER_LINE + tile_x;
     word_t tile_id_address = bg_map_base_addr + tile_id_idx;
-    byte_t tile_id = vram.at(tile_id_address);
+    byte_t tile_id = memory_.vram()[tile_id_address];
 
     word_t tile_set_addr =
         tile_set_base_addr +
@@ -206,8 +303,8 @@ void Ppu::write_bg_line_() {
                            : static_cast<std::int8_t>(tile_id) - 128) *
          (8 /* lines */ * 2 /* bytes per line */)) +
         (tile_pixel_y * 2);
-    byte_t pixels0 = vram.at(tile_set_addr);
-    byte_t pixels1 = vram.at(tile_set_addr + 1);
+    byte_t pixels0 = memory_.vram()[tile_set_addr];
+    byte_t pixels1 = memory_.vram()[tile_set_addr + 1];
 
     Color color = get_color_(util::fuse_b(pixels1 >> (7 - tile_pixel_x),
                                           pixels0 >> (7 - tile_pixel_x)),
@@ -247,7 +344,7 @@ void Ppu::write_window_line_() {
 
     unsigned int tile_id_idx = tile_y * TILES_PER_LINE + tile_x;
     word_t tile_id_address = bg_map_base_addr + tile_id_idx;
-    byte_t tile_id = vram.at(tile_id_address);
+    byte_t tile_id = memory_.vram()[tile_id_address];
 
     word_t tile_set_addr =
         tile_set_base_addr +
@@ -255,8 +352,8 @@ void Ppu::write_window_line_() {
                            : static_cast<std::int8_t>(tile_id) - 128) *
          (8 /* lines */ * 2 /* bytes per line */)) +
         (tile_pixel_y * 2);
-    byte_t pixels0 = vram.at(tile_set_addr);
-    byte_t pixels1 = vram.at(tile_set_addr + 1);
+    byte_t pixels0 = memory_.vram()[tile_set_addr];
+    byte_t pixels1 = memory_.vram()[tile_set_addr + 1];
 
     Color color = get_color_(util::fuse_b(pixels1 >> (7 - tile_pixel_x),
                                           pixels0 >> (7 - tile_pixel_x)),
@@ -269,8 +366,8 @@ void Ppu::draw_sprites_() {
   for (unsigned int sprite_idx = 0; sprite_idx < 40; ++sprite_idx) {
     word_t sprite_addr = sprite_idx * BYTES_PER_SPRITE_ENTRY;
 
-    byte_t sprite_y = oam.at(sprite_addr);
-    byte_t sprite_x = oam.at(sprite_addr + 1);
+    byte_t sprite_y = memory_.oam()[sprite_addr];
+    byte_t sprite_x = memory_.oam()[sprite_addr + 1];
 
     // Don't draw off-screen sprites.
     if (sprite_y == 0 || sprite_y >= 160) {
@@ -283,8 +380,8 @@ void Ppu::draw_sprites_() {
     sprite_y -= 16;
     sprite_x -= 8;
 
-    byte_t sprite_pattern_idx = oam.at(sprite_addr + 2);
-    byte_t sprite_attrs = oam.at(sprite_addr + 3);
+    byte_t sprite_pattern_idx = memory_.oam()[sprite_addr + 2];
+    byte_t sprite_attrs = memory_.oam()[sprite_addr + 3];
 
     bool palette_num = util::get_bit(sprite_attrs, 4);
 
@@ -304,8 +401,8 @@ void Ppu::draw_sprites_() {
         unsigned int tile_x =
             should_flip_x ? (TILE_LENGTH_PX - _tile_x - 1) : _tile_x;
         word_t tile_pixels_addr = tile_address + (tile_y * 2);
-        byte_t pixels0 = vram.at(tile_pixels_addr);
-        byte_t pixels1 = vram.at(tile_pixels_addr + 1);
+        byte_t pixels0 = memory_.vram()[tile_pixels_addr];
+        byte_t pixels1 = memory_.vram()[tile_pixels_addr + 1];
 
         Color color = get_color_(
             util::fuse_b(pixels1 >> (7 - tile_x), pixels0 >> (7 - tile_x)),
@@ -317,7 +414,15 @@ void Ppu::draw_sprites_() {
 }
 
 void Ppu::set_pixel_(unsigned int x, unsigned int y, Color color) {
-  frame_buffer_.at(y * FRAME_WIDTH_PX + x) = color;
+  frame_buffer_->at(y * FRAME_WIDTH_PX + x) = color;
+}
+
+void Ppu::own_frame_buffer_(bool copy) {
+  if (frame_buffer_.use_count() > 1) {
+    frame_buffer_ = copy ? std::make_shared<std::vector<Color>>(*frame_buffer_)
+                         : std::make_shared<std::vector<Color>>(
+                               FRAME_WIDTH_PX * FRAME_HEIGHT_PX);
+  }
 }
 
 // takes palette into account
@@ -0,0 +1,221 @@
+#include "profiler.hh"
+
+#include <algorithm>
+#include <functional>
+
+#include "log.hh"
+#include "opcode_names.hh"
+
+namespace bugme {
+
+namespace {
+/** Deeper stacks are almost always code that discards return addresses. */
+inline const unsigned int MAX_DEPTH = 128;
+
+inline const word_t BANK_START = 0x4000;
+inline const word_t BANK_SIZE = 0x4000;
+
+double percent(std::uint64_t part, std::uint64_t whole) {
+  return whole > 0 ? 100.0 * static_cast<double>(part) /
+                         static_cast<double>(whole)
+                   : 0.0;
+}
+
+std::string frame_name(std::uint32_t frame) {
+  char name[16];
+  std::snprintf(name, sizeof(name), "%02x:%04x", frame >> 16, frame & 0xFFFF);
+  return name;
+}
+}  // namespace
+
+Profiler::Profiler() : banks_(1) {
+  banks_[0].resize(0x10000);
+  nodes_.emplace_back(0, 0);
+}
+
+void Profiler::instruction(std::size_t bank, word_t pc, byte_t opcode, bool cb,
+                           tcycles_t cycles) {
+  if (suspended_) {
+    return;
+  }
+  if (bank >= banks_.size()) {
+    banks_.resize(bank + 1);
+  }
+  std::vector<Counter> &counters = banks_[bank];
+  if (counters.empty()) {
+    counters.resize(BANK_SIZE);
+  }
+
+  Counter &counter = counters[bank == 0 ? pc : pc - BANK_START];
+  ++counter.count;
+  counter.cycles += cycles;
+  counter.opcode = cb ? (0xCB00 | opcode) : opcode;
+
+  Counter &op = cb ? cb_opcodes_[opcode] : opcodes_[opcode];
+  ++op.count;
+  op.cycles += cycles;
+
+  nodes_[node_].cycles += cycles;
+}
+
+void Profiler::call(std::size_t bank, word_t target) {
+  if (suspended_) {
+    return;
+  }
+  if (depth_ >= MAX_DEPTH) {
+    ++overflow_;
+    return;
+  }
+
+  std::uint32_t frame = static_cast<std::uint32_t>(bank << 16 | target);
+  Node &node = nodes_[node_];
+  auto it = std::find_if(node.children.begin(), node.children.end(),
+                         [&](const auto &child) { return child.first == frame; });
+  if (it != node.children.end()) {
+    node_ = it->second;
+  } else {
+    std::uint32_t child = static_cast<std::uint32_t>(nodes_.size());
+    node.children.emplace_back(frame, child);
+    nodes_.emplace_back(node_, frame);  // invalidates node
+    node_ = child;
+  }
+  ++depth_;
+}
+
+void Profiler::ret() {
+  if (suspended_) {
+    return;
+  }
+  if (overflow_ > 0) {
+    --overflow_;
+  } else if (depth_ > 0) {
+    node_ = nodes_[node_].parent;
+    --depth_;
+  }
+}
+
+void Profiler::reset_stack() {
+  if (suspended_) {
+    return;
+  }
+  node_ = 0;
+  depth_ = 0;
+  overflow_ = 0;
+}
+
+void Profiler::write_report(std::FILE *file) const {
+  struct Hotspot {
+    std::size_t bank;
+    word_t pc;
+    const Counter *counter;
+  };
+  std::vector<Hotspot> hotspots;
+  std::uint64_t instructions = 0, cycles = 0;
+  for (std::size_t bank = 0; bank < banks_.size(); ++bank) {
+    for (std::size_t i = 0; i < banks_[bank].size(); ++i) {
+      const Counter &counter = banks_[bank][i];
+      if (counter.count > 0) {
+        word_t pc = static_cast<word_t>(bank == 0 ? i : i + BANK_START);
+        hotspots.push_back({bank, pc, &counter});
+        instructions += counter.count;
+        cycles += counter.cycles;
+      }
+    }
+  }
+  std::sort(hotspots.begin(), hotspots.end(),
+            [](const Hotspot &a, const Hotspot &b) {
+              return a.counter->cycles > b.counter->cycles;
+            });
+
+  std::uint64_t total_cycles = cycles + halted_cycles_;
+  std::fprintf(file,
+               "%llu instructions, %llu T-cycles executing, %llu T-cycles "
+               "halted (%.1f%%)\n",
+               static_cast<unsigned long long>(instructions),
+               static_cast<unsigned long long>(cycles),
+               static_cast<unsigned long long>(halted_cycles_),
+               percent(halted_cycles_, total_cycles));
+
+  std::fprintf(file, "\n%-8s %-18s %14s %14s %7s\n", "address",
+               "instruction", "count", "cycles", "cycles%");
+  for (const Hotspot &hotspot : hotspots) {
+    word_t opcode = hotspot.counter->opcode;
+    const std::string &name = opcode > 0xFF ? opcode::CB_NAMES[opcode & 0xFF]
+                                            : opcode::NAMES[opcode];
+    std::fprintf(file, "%02zx:%04x  %-18s %14llu %14llu %6.2f%%\n",
+                 hotspot.bank, hotspot.pc, name.c_str(),
+                 static_cast<unsigned long long>(hotspot.counter->count),
+                 static_cast<unsigned long long>(hotspot.counter->cycles),
+                 percent(hotspot.counter->cycles, total_cycles));
+  }
+
+  auto write_opcodes = [&](const char *title, const Counter *counters,
+                           const std::string *names, const char *prefix) {
+    std::vector<unsigned int> order(256);
+    for (unsigned int i = 0; i < 256; ++i) {
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a,
+                                                     unsigned int b) {
+      return counters[a].count > counters[b].count;
+    });
+    std::fprintf(file, "\n%-8s %-18s %14s %14s %7s\n", title, "instruction",
+                 "count", "cycles", "count%");
+    for (unsigned int i : order) {
+      if (counters[i].count == 0) {
+        break;
+      }
+      char label[8];
+      std::snprintf(label, sizeof(label), "%s%02x", prefix, i);
+      std::fprintf(file, "%-8s %-18s %14llu %14llu %6.2f%%\n", label,
+                   names[i].c_str(),
+                   static_cast<unsigned long long>(counters[i].count),
+                   static_cast<unsigned long long>(counters[i].cycles),
+                   percent(counters[i].count, instructions));
+    }
+  };
+  write_opcodes("opcode", opcodes_, opcode::NAMES, "0x");
+  write_opcodes("cb", cb_opcodes_, opcode::CB_NAMES, "0xcb");
+}
+
+void Profiler::write_folded(std::FILE *file) const {
+  std::function<void(std::uint32_t, const std::string &)> write_node =
+      [&](std::uint32_t index, const std::string &stack) {
+        const Node &node = nodes_[index];
+        if (node.cycles > 0) {
+          std::fprintf(file, "%s %llu\n", stack.c_str(),
+                       static_cast<unsigned long long>(node.cycles));
+        }
+        if (node.halted_cycles > 0) {
+          std::fprintf(file, "%s;[halted] %llu\n", stack.c_str(),
+                       static_cast<unsigned long long>(node.halted_cycles));
+        }
+        for (const auto &[frame, child] : node.children) {
+          write_node(child, stack + ";" + frame_name(frame));
+        }
+      };
+  write_node(0, "[top]");
+}
+
+bool Profiler::write(const std::string &prefix) const {
+  std::FILE *report = std::fopen((prefix + ".txt").c_str(), "w");
+  std::FILE *folded = std::fopen((prefix + ".folded").c_str(), "w");
+  bool good = report && folded;
+  if (good) {
+    write_report(report);
+    write_folded(folded);
+    log_info("[profiler] wrote %s.txt and %s.folded", prefix.c_str(),
+             prefix.c_str());
+  } else {
+    log_error("[profiler] cannot write profile %s", prefix.c_str());
+  }
+  if (report) {
+    std::fclose(report);
+  }
+  if (folded) {
+    std::fclose(folded);
+  }
+  return good;
+}
+
+}  // namespace bugme
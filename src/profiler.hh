@@ -0,0 +1,130 @@
+#ifndef BUGME_PROFILER_HH
+#define BUGME_PROFILER_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "types.hh"
+
+/**
+ * Wraps a statement which feeds the profiler, so that it disappears from
+ * builds without BUGME_PROFILER (cmake -DBUGME_PROFILER=ON).
+ */
+#ifdef BUGME_PROFILER
+#define BUGME_PROFILE(statement) statement
+#else
+#define BUGME_PROFILE(statement)
+#endif
+
+namespace bugme {
+
+/**
+ * Counts where guest code spends its time.
+ *
+ * Every instruction executed is counted against its address (qualified by
+ * ROM bank, for the switchable bank) and its opcode. CALL, RST and interrupt
+ * dispatch push onto a shadow call stack, RET and RETI pop it, and cycles
+ * are also counted against the stack they ran under, for flame graphs.
+ * Cycles spent halted are counted separately.
+ *
+ * The Cpu owns one only in builds with BUGME_PROFILER.
+ */
+class Profiler : public Noncopyable {
+ public:
+  Profiler();
+
+  /**
+   * \param bank The ROM bank pc is in, or 0 outside switchable ROM.
+   * \param opcode The opcode, or its second byte if cb is set.
+   * \param cycles T-cycles taken.
+   */
+  void instruction(std::size_t bank, word_t pc, byte_t opcode, bool cb,
+                   tcycles_t cycles);
+
+  void halted(tcycles_t cycles) {
+    if (suspended_) {
+      return;
+    }
+    halted_cycles_ += cycles;
+    nodes_[node_].halted_cycles += cycles;
+  }
+
+  /** Enters a subroutine or interrupt handler at target. */
+  void call(std::size_t bank, word_t target);
+  void ret();
+
+  /**
+   * Ignores everything while suspended is set, e.g. for run-ahead's
+   * speculative frames, which would otherwise be counted as well as the real
+   * ones they foretell.
+   */
+  void set_suspended(bool suspended) { suspended_ = suspended; }
+
+  /**
+   * Empties the call stack, as the machine jumps to a loaded state whose
+   * calls were never seen. While suspended, the state loaded is the one
+   * suspension started from, whose stack is still current, so it is kept.
+   */
+  void reset_stack();
+
+  /**
+   * Writes a report of instructions and opcodes, hottest first.
+   */
+  void write_report(std::FILE *file) const;
+
+  /**
+   * Writes cycles by call stack in the folded format read by flamegraph.pl
+   * and speedscope: one "frame;frame;frame cycles" line per stack, each
+   * frame named bank:address.
+   */
+  void write_folded(std::FILE *file) const;
+
+  /** Writes the report to prefix.txt and the stacks to prefix.folded. */
+  bool write(const std::string &prefix) const;
+
+ private:
+  struct Counter {
+    std::uint64_t count = 0;
+    std::uint64_t cycles = 0;
+    /** The opcode last seen here, with 0xCB00 set for CB opcodes. */
+    word_t opcode = 0;
+  };
+
+  /** A call stack, as a node in the tree of all stacks seen. */
+  struct Node {
+    Node(std::uint32_t parent, std::uint32_t frame)
+        : parent(parent), frame(frame) {}
+
+    std::uint32_t parent;
+    /** The called address, as bank << 16 | address. */
+    std::uint32_t frame;
+    std::uint64_t cycles = 0;
+    std::uint64_t halted_cycles = 0;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> children;
+  };
+
+  /**
+   * Bank 0 is indexed by address, every other bank by address - 0x4000,
+   * and each is allocated when first executed from.
+   */
+  std::vector<std::vector<Counter>> banks_;
+  Counter opcodes_[256];
+  Counter cb_opcodes_[256];
+  std::uint64_t halted_cycles_ = 0;
+
+  std::vector<Node> nodes_;
+  std::uint32_t node_ = 0;
+  unsigned int depth_ = 0;
+  /** Calls made beyond the maximum depth, which RETs unwind first. */
+  unsigned int overflow_ = 0;
+
+  bool suspended_ = false;
+};
+
+}  // namespace bugme
+
+#endif
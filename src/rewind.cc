@@ -0,0 +1,202 @@
+#include "rewind.hh"
+
+#include <algorithm>
+#include <cstring>
+
+namespace bugme {
+
+namespace {
+
+/** The most bytes a varint-encoded std::size_t can take. */
+inline const std::size_t MAX_VARINT_SIZE = 10;
+
+inline byte_t *put_varint(byte_t *out, std::size_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<byte_t>(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<byte_t>(value);
+  return out;
+}
+
+inline const byte_t *get_varint(const byte_t *in, std::size_t &value) {
+  value = 0;
+  for (unsigned int shift = 0;; shift += 7) {
+    byte_t byte = *in++;
+    value |= static_cast<std::size_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return in;
+    }
+  }
+}
+
+/** Loads the i-th word of state, zero-padding past its end. */
+inline std::uint64_t load_word(const byte_t *state, std::size_t size,
+                               std::size_t i) {
+  std::uint64_t word = 0;
+  std::memcpy(&word, state + i * 8, std::min<std::size_t>(8, size - i * 8));
+  return word;
+}
+
+inline std::size_t words_for(std::size_t size) { return (size + 7) / 8; }
+
+/** A delta's size, before and after it in the ring. */
+inline const std::size_t FRAME_OVERHEAD = 2 * sizeof(std::uint64_t);
+
+}  // namespace
+
+RewindBuffer::RewindBuffer(std::size_t budget) : ring_(budget) {}
+
+void RewindBuffer::push(const byte_t *state, std::size_t size) {
+  if (size != state_size_) {
+    clear();
+    state_size_ = size;
+    head_.assign(words_for(size), 0);
+    // Each run of literals costs at most two varints.
+    scratch_.resize(size + 8 + (words_for(size) + 1) * 2 * MAX_VARINT_SIZE);
+  }
+
+  if (!has_head_) {
+    std::memcpy(head_.data(), state, size);
+    has_head_ = true;
+    return;
+  }
+
+  std::uint64_t encoded_size =
+      encode_(head_.data(), state, size, scratch_.data());
+  std::size_t frame_size = encoded_size + FRAME_OVERHEAD;
+  if (frame_size > ring_.size()) {
+    // Too large to ever fit; all we can keep is the newest state.
+    ring_used_ = 0;
+    read_offset_ = 0;
+    write_offset_ = 0;
+    deltas_ = 0;
+    return;
+  }
+
+  while (ring_used_ + frame_size > ring_.size()) {
+    std::size_t oldest = read_size_(read_offset_) + FRAME_OVERHEAD;
+    read_offset_ = (read_offset_ + oldest) % ring_.size();
+    ring_used_ -= oldest;
+    --deltas_;
+  }
+
+  auto *size_bytes = reinterpret_cast<const byte_t *>(&encoded_size);
+  write_ring_(size_bytes, sizeof(encoded_size));
+  write_ring_(scratch_.data(), encoded_size);
+  write_ring_(size_bytes, sizeof(encoded_size));
+  ++deltas_;
+}
+
+bool RewindBuffer::pop(byte_t *state) {
+  if (!has_head_) {
+    return false;
+  }
+
+  std::memcpy(state, head_.data(), state_size_);
+
+  if (deltas_ == 0) {
+    has_head_ = false;
+    return true;
+  }
+
+  // Step the head back to its predecessor, found from the size at its end.
+  std::size_t size_offset = back_(write_offset_, sizeof(std::uint64_t));
+  std::size_t delta_size = read_size_(size_offset);
+  read_ring_(back_(size_offset, delta_size), delta_size, scratch_.data());
+  apply_(scratch_.data(), head_.data(), head_.size());
+
+  write_offset_ = back_(write_offset_, delta_size + FRAME_OVERHEAD);
+  ring_used_ -= delta_size + FRAME_OVERHEAD;
+  --deltas_;
+  return true;
+}
+
+std::size_t RewindBuffer::size() const {
+  return has_head_ ? deltas_ + 1 : 0;
+}
+
+void RewindBuffer::clear() {
+  ring_used_ = 0;
+  read_offset_ = 0;
+  write_offset_ = 0;
+  deltas_ = 0;
+  has_head_ = false;
+}
+
+std::size_t RewindBuffer::encode_(std::uint64_t *from, const byte_t *to,
+                                  std::size_t size, byte_t *out) {
+  const std::size_t words = words_for(size);
+  byte_t *p = out;
+
+  // A sequence of (zero words, literal words, literals...) runs.
+  std::size_t i = 0;
+  while (i < words) {
+    std::size_t zeros_start = i;
+    while (i < words && load_word(to, size, i) == from[i]) {
+      ++i;
+    }
+
+    std::size_t literals_start = i;
+    while (i < words && load_word(to, size, i) != from[i]) {
+      ++i;
+    }
+
+    p = put_varint(p, literals_start - zeros_start);
+    p = put_varint(p, i - literals_start);
+    for (std::size_t j = literals_start; j < i; ++j) {
+      std::uint64_t word = load_word(to, size, j);
+      std::uint64_t delta = from[j] ^ word;
+      std::memcpy(p, &delta, sizeof(delta));
+      p += sizeof(delta);
+      from[j] = word;
+    }
+  }
+
+  return static_cast<std::size_t>(p - out);
+}
+
+void RewindBuffer::apply_(const byte_t *in, std::uint64_t *state,
+                          std::size_t words) {
+  std::size_t i = 0;
+  while (i < words) {
+    std::size_t zeros, literals;
+    in = get_varint(in, zeros);
+    in = get_varint(in, literals);
+    i += zeros;
+    for (std::size_t end = i + literals; i < end; ++i) {
+      std::uint64_t delta;
+      std::memcpy(&delta, in, sizeof(delta));
+      in += sizeof(delta);
+      state[i] ^= delta;
+    }
+  }
+}
+
+void RewindBuffer::write_ring_(const byte_t *data, std::size_t size) {
+  std::size_t first = std::min(size, ring_.size() - write_offset_);
+  std::memcpy(ring_.data() + write_offset_, data, first);
+  std::memcpy(ring_.data(), data + first, size - first);
+
+  write_offset_ = (write_offset_ + size) % ring_.size();
+  ring_used_ += size;
+}
+
+void RewindBuffer::read_ring_(std::size_t offset, std::size_t size,
+                              byte_t *out) const {
+  std::size_t first = std::min(size, ring_.size() - offset);
+  std::memcpy(out, ring_.data() + offset, first);
+  std::memcpy(out + first, ring_.data(), size - first);
+}
+
+std::uint64_t RewindBuffer::read_size_(std::size_t offset) const {
+  std::uint64_t size;
+  read_ring_(offset, sizeof(size), reinterpret_cast<byte_t *>(&size));
+  return size;
+}
+
+std::size_t RewindBuffer::back_(std::size_t offset, std::size_t size) const {
+  return (offset + ring_.size() - size) % ring_.size();
+}
+
+}  // namespace bugme
@@ -0,0 +1,96 @@
+#ifndef BUGME_REWIND_HH
+#define BUGME_REWIND_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "types.hh"
+
+namespace bugme {
+
+/**
+ * A history of save states, for stepping the machine backwards in time.
+ *
+ * Only the most recent state is kept in full. Every older state is stored as
+ * the XOR of itself and its successor, which is almost entirely zeroes from
+ * one frame to the next, and is run-length encoded in units of 8-byte words.
+ * Encoding, and decoding a delta back onto the newest state, are each a
+ * single pass over the state.
+ *
+ * Deltas live in a ring of fixed size: when it fills, the oldest history is
+ * discarded. Each delta is framed by its size on both sides, so that the ring
+ * can be walked from either end without any bookkeeping of its own, and
+ * nothing is allocated after the first push().
+ */
+class RewindBuffer : public Noncopyable {
+ public:
+  /**
+   * \param budget The size of the ring holding encoded deltas, in bytes.
+   */
+  explicit RewindBuffer(std::size_t budget);
+
+  /**
+   * Records a new state as the most recent in the history.
+   *
+   * \param state A save state. If its size differs from the previously pushed
+   *        state, the history is cleared first.
+   * \param size The size of state, in bytes.
+   */
+  void push(const byte_t *state, std::size_t size);
+
+  /**
+   * Removes the most recent state from the history.
+   *
+   * \param state Receives the most recent state. Must hold as many bytes as
+   *        the pushed states.
+   * \return false if the history is empty.
+   */
+  bool pop(byte_t *state);
+
+  /** \return The number of states in the history. */
+  std::size_t size() const;
+
+  void clear();
+
+ private:
+  /**
+   * Writes the encoding of (from ^ to) to out, and sets from = to.
+   *
+   * \param from The previous state, as padded words.
+   * \param to The new state.
+   * \param size The size of to, in bytes.
+   * \return The encoded size, in bytes.
+   */
+  static std::size_t encode_(std::uint64_t *from, const byte_t *to,
+                             std::size_t size, byte_t *out);
+
+  /** XORs an encoded delta onto a state of the given number of words. */
+  static void apply_(const byte_t *in, std::uint64_t *state,
+                     std::size_t words);
+
+  void write_ring_(const byte_t *data, std::size_t size);
+  void read_ring_(std::size_t offset, std::size_t size, byte_t *out) const;
+  /** \return The size field at offset in the ring. */
+  std::uint64_t read_size_(std::size_t offset) const;
+  /** \return offset moved back by size bytes, around the ring. */
+  std::size_t back_(std::size_t offset, std::size_t size) const;
+
+  std::vector<byte_t> ring_;
+  std::size_t ring_used_ = 0;
+  /** Where the oldest delta's frame starts, and the next one will. */
+  std::size_t read_offset_ = 0;
+  std::size_t write_offset_ = 0;
+  std::size_t deltas_ = 0;
+
+  /** The most recent state, padded to a whole number of words. */
+  std::vector<std::uint64_t> head_;
+  std::size_t state_size_ = 0;
+  bool has_head_ = false;
+
+  std::vector<byte_t> scratch_;
+};
+
+}  // namespace bugme
+
+#endif
@@ -0,0 +1,147 @@
+#include "rom_index.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "log.hh"
+#include "util.hh"
+
+namespace bugme {
+
+RomIndex::RomIndex(const std::string &filename) {
+  fd_ = open(filename.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    log_warn("[index] cannot open %s", filename.c_str());
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd_, &st) != 0 ||
+      static_cast<std::size_t>(st.st_size) < sizeof(RomIndexFileHeader)) {
+    log_warn("[index] %s is not a rom index", filename.c_str());
+    return;
+  }
+
+  size_ = static_cast<std::size_t>(st.st_size);
+  void *addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (addr == MAP_FAILED) {
+    log_warn("[index] cannot map %s", filename.c_str());
+    size_ = 0;
+    return;
+  }
+  data_ = static_cast<const byte_t *>(addr);
+
+  const RomIndexFileHeader *header =
+      reinterpret_cast<const RomIndexFileHeader *>(data_);
+  std::size_t expected_size = sizeof(RomIndexFileHeader) +
+                              header->entry_count * sizeof(RomIndexEntry) +
+                              header->strings_size;
+  if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header->version != VERSION || expected_size > size_) {
+    log_warn("[index] %s is not a compatible rom index", filename.c_str());
+    return;
+  }
+
+  // Paths are read straight out of the string table, so a truncated or
+  // corrupt index must be caught here.
+  const RomIndexEntry *entries = reinterpret_cast<const RomIndexEntry *>(
+      data_ + sizeof(RomIndexFileHeader));
+  for (std::size_t i = 0; i < header->entry_count; ++i) {
+    if (entries[i].path_offset > header->strings_size ||
+        entries[i].path_length >
+            header->strings_size - entries[i].path_offset) {
+      log_warn("[index] %s is corrupt", filename.c_str());
+      return;
+    }
+  }
+
+  entries_ = entries;
+  entry_count_ = header->entry_count;
+  strings_ = reinterpret_cast<const char *>(entries_ + entry_count_);
+  log_info("[index] loaded %zu entries from %s", entry_count_,
+           filename.c_str());
+}
+
+RomIndex::~RomIndex() {
+  if (data_ != nullptr) {
+    munmap(const_cast<byte_t *>(data_), size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+const RomIndexEntry *RomIndex::find(const std::string &rom_path) const {
+  std::string canonical = canonical_path(rom_path);
+  std::uint64_t hash = hash_path(canonical);
+
+  const RomIndexEntry *end = entries_ + entry_count_;
+  const RomIndexEntry *it = std::lower_bound(
+      entries_, end, hash, [](const RomIndexEntry &entry, std::uint64_t h) {
+        return entry.path_hash < h;
+      });
+
+  // Step over (unlikely) hash collisions.
+  for (; it != end && it->path_hash == hash; ++it) {
+    if (path(*it) == canonical) {
+      return it;
+    }
+  }
+  return nullptr;
+}
+
+std::string RomIndex::path(const RomIndexEntry &entry) const {
+  return std::string(strings_ + entry.path_offset, entry.path_length);
+}
+
+bool RomIndex::write(const std::string &filename,
+                     std::vector<RomIndexEntry> entries,
+                     const std::vector<std::string> &paths) {
+  std::string strings;
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    entries[i].path_hash = hash_path(paths[i]);
+    entries[i].path_offset = static_cast<std::uint32_t>(strings.size());
+    entries[i].path_length = static_cast<std::uint32_t>(paths[i].size());
+    strings += paths[i];
+  }
+
+  std::sort(entries.begin(), entries.end(),
+            [](const RomIndexEntry &a, const RomIndexEntry &b) {
+              return a.path_hash < b.path_hash;
+            });
+
+  RomIndexFileHeader header = {};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.entry_count = static_cast<std::uint32_t>(entries.size());
+  header.strings_size = static_cast<std::uint32_t>(strings.size());
+
+  std::ofstream out(filename, std::ios_base::binary | std::ios_base::trunc);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(entries.data()),
+            static_cast<std::streamsize>(entries.size() *
+                                         sizeof(RomIndexEntry)));
+  out.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+  return out.good();
+}
+
+std::string RomIndex::canonical_path(const std::string &path) {
+  std::error_code error;
+  std::filesystem::path canonical =
+      std::filesystem::weakly_canonical(path, error);
+  return error ? path : canonical.string();
+}
+
+std::uint64_t RomIndex::hash_path(const std::string &canonical_path) {
+  return util::fnv1a(reinterpret_cast<const byte_t *>(canonical_path.data()),
+                     canonical_path.size());
+}
+
+}  // namespace bugme
@@ -0,0 +1,114 @@
+#ifndef BUGME_ROM_INDEX_HH
+#define BUGME_ROM_INDEX_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "types.hh"
+
+namespace bugme {
+
+/**
+ * A single ROM's entry in a RomIndex.
+ *
+ * Entries are fixed-size and contain everything needed to size a cartridge
+ * without parsing the ROM itself.
+ */
+struct RomIndexEntry {
+  std::uint64_t path_hash;      // FNV-1a of the canonical path
+  std::uint32_t path_offset;    // into the index's string table
+  std::uint32_t path_length;
+  std::uint32_t file_size;      // in bytes
+  std::uint32_t rom_size;       // in bytes, as declared by the header
+  std::uint32_t ram_size;       // in bytes, as declared by the header
+  word_t global_checksum;       // as declared by the header
+  byte_t title[16];
+  byte_t cartridge_type;
+  byte_t header_checksum;       // as declared by the header
+  byte_t flags;
+  byte_t reserved[7];
+
+  static constexpr byte_t HEADER_CHECKSUM_OK = 1 << 0;
+  static constexpr byte_t GLOBAL_CHECKSUM_OK = 1 << 1;
+
+  bool header_checksum_ok() const { return flags & HEADER_CHECKSUM_OK; }
+  bool global_checksum_ok() const { return flags & GLOBAL_CHECKSUM_OK; }
+};
+static_assert(sizeof(RomIndexEntry) == 56);
+
+/**
+ * On-disk layout of an index file:
+ *
+ *   RomIndexFileHeader
+ *   RomIndexEntry[entry_count], sorted by path_hash
+ *   char[strings_size], the string table of paths
+ */
+struct RomIndexFileHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t entry_count;
+  std::uint32_t strings_size;
+  std::uint32_t reserved;
+};
+static_assert(sizeof(RomIndexFileHeader) == 24);
+
+/**
+ * A read-only, memory-mapped index of a ROM library, as produced by bugme-scan.
+ *
+ * Lookups are a binary search over the hashed canonical path of the ROM.
+ */
+class RomIndex : public Noncopyable {
+ public:
+  static constexpr char MAGIC[8] = {'B', 'U', 'G', 'M', 'E', 'I', 'D', 'X'};
+  static constexpr std::uint32_t VERSION = 1;
+
+  /**
+   * Maps the index at filename. If it cannot be read, or any entry's path
+   * lies outside the string table, the index is empty.
+   */
+  explicit RomIndex(const std::string &filename);
+  ~RomIndex();
+
+  /** \return The entry for the ROM at rom_path, or nullptr if not indexed. */
+  const RomIndexEntry *find(const std::string &rom_path) const;
+
+  /** \return The path an entry was indexed under. */
+  std::string path(const RomIndexEntry &entry) const;
+
+  std::size_t size() const { return entry_count_; }
+  bool empty() const { return entry_count_ == 0; }
+
+  /**
+   * Writes an index file from entries and their paths.
+   *
+   * \param filename The output file.
+   * \param entries The entries, in any order. path_hash, path_offset and
+   *        path_length are filled in from paths.
+   * \param paths The canonical path of each entry.
+   * \return true on success.
+   */
+  static bool write(const std::string &filename,
+                    std::vector<RomIndexEntry> entries,
+                    const std::vector<std::string> &paths);
+
+  /** \return The canonical form of path, as used for hashing. */
+  static std::string canonical_path(const std::string &path);
+
+  /** \return The FNV-1a hash of a canonical path. */
+  static std::uint64_t hash_path(const std::string &canonical_path);
+
+ private:
+  int fd_ = -1;
+  const byte_t *data_ = nullptr;
+  std::size_t size_ = 0;
+
+  const RomIndexEntry *entries_ = nullptr;
+  std::size_t entry_count_ = 0;
+  const char *strings_ = nullptr;
+};
+
+}  // namespace bugme
+
+#endif
@@ -0,0 +1,128 @@
+#include "rtc.hh"
+
+#include <ctime>
+
+namespace bugme {
+
+namespace {
+
+/** T-cycles per emulated second. */
+inline const std::uint64_t CYCLES_PER_SECOND = 4194304;
+
+inline const std::uint64_t SECONDS_PER_DAY = 24 * 60 * 60;
+inline const std::uint64_t MAX_DAYS = 512;
+
+/* Days high register (0x0C) bits */
+inline const std::uint32_t DAY_HIGH_BIT = 1 << 0;
+inline const std::uint32_t HALT_BIT = 1 << 6;
+inline const std::uint32_t DAY_CARRY_BIT = 1 << 7;
+
+std::uint64_t host_now() {
+  return static_cast<std::uint64_t>(std::time(nullptr));
+}
+
+/** Advances the five RTC registers by the given number of seconds. */
+void advance(std::uint32_t *registers, std::uint64_t seconds) {
+  std::uint64_t days =
+      registers[3] | ((registers[4] & DAY_HIGH_BIT) ? 0x100 : 0x000);
+  std::uint64_t total = registers[0] + (registers[1] * 60) +
+                        (registers[2] * 60 * 60) + (days * SECONDS_PER_DAY) +
+                        seconds;
+
+  registers[0] = static_cast<std::uint32_t>(total % 60);
+  registers[1] = static_cast<std::uint32_t>((total / 60) % 60);
+  registers[2] = static_cast<std::uint32_t>((total / (60 * 60)) % 24);
+
+  days = total / SECONDS_PER_DAY;
+  if (days >= MAX_DAYS) {
+    registers[4] |= DAY_CARRY_BIT;
+    days %= MAX_DAYS;
+  }
+  registers[3] = static_cast<std::uint32_t>(days & 0xFF);
+  registers[4] = (registers[4] & ~DAY_HIGH_BIT) | (days > 0xFF ? 1 : 0);
+}
+
+}  // namespace
+
+Rtc::Rtc(RtcClock clock, const std::uint64_t &cycles, RtcSaveData *data)
+    : clock_(clock), cycles_(cycles), data_(data), base_cycles_(cycles) {
+  // A fresh save file starts the clock now. An emulated clock always resumes
+  // from the stored registers, ignoring time spent outside the emulator.
+  if (data_->timestamp == 0 || clock_ == RtcClock::Emulated) {
+    data_->timestamp = host_now();
+  }
+}
+
+void Rtc::latch(byte_t byte) {
+  if (last_latch_write_ == 0x00 && byte == 0x01) {
+    rebase_();
+    for (unsigned int i = 0; i < 5; ++i) {
+      data_->latched[i] = data_->registers[i];
+    }
+  }
+  last_latch_write_ = byte;
+}
+
+byte_t Rtc::read(byte_t reg) const {
+  return static_cast<byte_t>(data_->latched[reg - SECONDS]);
+}
+
+void Rtc::write(byte_t reg, byte_t byte) {
+  rebase_();
+  switch (reg) {
+    case SECONDS:
+      data_->registers[0] = byte & 0x3F;
+      // Writing the seconds register also resets the sub-second counter.
+      base_cycles_ = cycles_;
+      break;
+    case MINUTES:
+      data_->registers[1] = byte & 0x3F;
+      break;
+    case HOURS:
+      data_->registers[2] = byte & 0x1F;
+      break;
+    case DAYS_LOW:
+      data_->registers[3] = byte;
+      break;
+    case DAYS_HIGH:
+      data_->registers[4] = byte & (DAY_CARRY_BIT | HALT_BIT | DAY_HIGH_BIT);
+      break;
+  }
+}
+
+void Rtc::sync() { rebase_(); }
+
+void Rtc::rebase_() {
+  std::uint64_t now = host_now();
+  if (is_halted_()) {
+    data_->timestamp = now;
+    base_cycles_ = cycles_;
+    return;
+  }
+
+  if (clock_ == RtcClock::Host) {
+    std::uint64_t elapsed = now > data_->timestamp ? now - data_->timestamp : 0;
+    advance(data_->registers, elapsed);
+    data_->timestamp += elapsed;
+  } else {
+    std::uint64_t elapsed = (cycles_ - base_cycles_) / CYCLES_PER_SECOND;
+    advance(data_->registers, elapsed);
+    // Keep the fractional second so that frequent rebasing loses no time.
+    base_cycles_ += elapsed * CYCLES_PER_SECOND;
+    data_->timestamp = now;
+  }
+}
+
+void Rtc::save_state(CartridgeState &state) const {
+  state.rtc_last_latch_write = last_latch_write_;
+  state.rtc_base_cycles = base_cycles_;
+}
+
+void Rtc::load_state(const CartridgeState &state) {
+  last_latch_write_ = state.rtc_last_latch_write;
+  base_cycles_ = state.rtc_base_cycles;
+}
+
+bool Rtc::is_halted_() const { return data_->registers[4] & HALT_BIT; }
+
+}  // namespace bugme
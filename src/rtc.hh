@@ -0,0 +1,98 @@
+#ifndef BUGME_RTC_HH
+#define BUGME_RTC_HH
+
+#include <cstdint>
+
+#include "savestate.hh"
+#include "types.hh"
+
+namespace bugme {
+
+/** What drives the passage of time for a cartridge real-time clock. */
+enum class RtcClock {
+  /** Wall-clock time, which keeps running while the emulator is closed. */
+  Host,
+  /** Emulated CPU cycles, for deterministic runs. */
+  Emulated,
+};
+
+/**
+ * Persisted state of an MBC3 real-time clock, appended to the cartridge's
+ * save file.
+ *
+ * This is the layout used by most other emulators (BGB, VBA-M, SameBoy), so
+ * save files can be moved between them. Values are little-endian.
+ */
+struct RtcSaveData {
+  std::uint32_t registers[5];
+  std::uint32_t latched[5];
+  std::uint64_t timestamp;  // unix time at which registers were captured
+};
+static_assert(sizeof(RtcSaveData) == 48);
+
+/**
+ * The MBC3 real-time clock.
+ *
+ * Rather than being ticked alongside the CPU, the clock stores its register
+ * values at some base point in time, and only computes the current time when
+ * the game latches the clock or writes to it. As such, it costs nothing while
+ * the game runs.
+ */
+class Rtc : public Noncopyable {
+ public:
+  /** Register select values, as written to the MBC3 RAM bank register. */
+  static constexpr byte_t SECONDS = 0x08;
+  static constexpr byte_t MINUTES = 0x09;
+  static constexpr byte_t HOURS = 0x0A;
+  static constexpr byte_t DAYS_LOW = 0x0B;
+  static constexpr byte_t DAYS_HIGH = 0x0C;
+
+  /**
+   * Constructor.
+   *
+   * \param clock The time source.
+   * \param cycles The machine's T-cycle counter, for RtcClock::Emulated.
+   * \param data Where the clock state lives. Usually this is within the save
+   *        file mapping, so the clock persists with no extra work.
+   */
+  Rtc(RtcClock clock, const std::uint64_t &cycles, RtcSaveData *data);
+
+  /** Handles a write to the latch register (0x6000-0x7FFF). */
+  void latch(byte_t byte);
+
+  /** \return The latched value of the selected register, SECONDS-DAYS_HIGH. */
+  byte_t read(byte_t reg) const;
+
+  /** Sets the selected register, as of now. */
+  void write(byte_t reg, byte_t byte);
+
+  /**
+   * Folds elapsed time into the stored registers, so that the persisted
+   * state is current.
+   */
+  void sync();
+
+  void save_state(CartridgeState &state) const;
+  void load_state(const CartridgeState &state);
+
+  /** Moves the clock state to data, which must already hold a copy of it. */
+  void set_data(RtcSaveData *data) { data_ = data; }
+
+ private:
+  /** Advances the base registers to now. */
+  void rebase_();
+
+  bool is_halted_() const;
+
+  RtcClock clock_;
+  const std::uint64_t &cycles_;
+  RtcSaveData *data_;
+
+  /** The cycle count corresponding to data_->timestamp. */
+  std::uint64_t base_cycles_;
+  byte_t last_latch_write_ = 0xFF;
+};
+
+}  // namespace bugme
+
+#endif
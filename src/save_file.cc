@@ -0,0 +1,120 @@
+#include "save_file.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "log.hh"
+
+namespace bugme {
+
+SaveFile::SaveFile(const std::string &filename, std::size_t size)
+    : filename_(filename), size_(size) {
+  // The file is only ever grown. Anything past size, such as another
+  // emulator's clock data, is left alone, and only the first size bytes are
+  // mapped.
+  fd_ = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  struct stat st;
+  if (fd_ < 0) {
+    log_warn("[save] cannot open %s, progress will not be saved",
+             filename.c_str());
+  } else if (fstat(fd_, &st) != 0) {
+    log_warn("[save] cannot stat %s, progress will not be saved",
+             filename.c_str());
+    close(fd_);
+    fd_ = -1;
+  } else if (static_cast<std::size_t>(st.st_size) < size &&
+             ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+    log_warn("[save] cannot resize %s, progress will not be saved",
+             filename.c_str());
+    close(fd_);
+    fd_ = -1;
+  } else {
+    // ::mmap, as bugme::mmap is the memory map namespace.
+    void *addr =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED) {
+      log_warn("[save] cannot map %s, progress will not be saved",
+               filename.c_str());
+      close(fd_);
+      fd_ = -1;
+    } else {
+      data_ = static_cast<byte_t *>(addr);
+    }
+  }
+
+  if (fd_ < 0) {
+    fallback_.resize(size);
+    data_ = fallback_.data();
+    return;
+  }
+
+  log_info("[save] mapped %zu bytes of %s", size, filename.c_str());
+  SaveFlusher::instance().add(this);
+}
+
+SaveFile::~SaveFile() {
+  if (fd_ < 0) {
+    return;
+  }
+
+  SaveFlusher::instance().remove(this);
+  // Dirty pages of a shared mapping are written back by the kernel after the
+  // mapping goes away; there is no need to block on an msync() here.
+  munmap(data_, size_);
+  close(fd_);
+}
+
+void SaveFile::flush_async_() {
+  if (!dirty_.exchange(false, std::memory_order_relaxed)) {
+    return;
+  }
+
+  if (msync(data_, size_, MS_ASYNC) != 0) {
+    log_warn("[save] msync failed for %s", filename_.c_str());
+  }
+}
+
+SaveFlusher &SaveFlusher::instance() {
+  static SaveFlusher flusher;
+  return flusher;
+}
+
+SaveFlusher::~SaveFlusher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    should_exit_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void SaveFlusher::add(SaveFile *file) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  files_.push_back(file);
+  if (!thread_.joinable()) {
+    thread_ = std::thread([this]() { run_(); });
+  }
+}
+
+void SaveFlusher::remove(SaveFile *file) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  files_.erase(std::remove(files_.begin(), files_.end(), file), files_.end());
+}
+
+void SaveFlusher::run_() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!should_exit_) {
+    cv_.wait_for(lock, FLUSH_INTERVAL, [this]() { return should_exit_; });
+    for (SaveFile *file : files_) {
+      file->flush_async_();
+    }
+  }
+}
+
+}  // namespace bugme
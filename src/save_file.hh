@@ -0,0 +1,108 @@
+#ifndef BUGME_SAVE_FILE_HH
+#define BUGME_SAVE_FILE_HH
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "types.hh"
+
+namespace bugme {
+
+/**
+ * A fixed-size region of memory backed by a memory-mapped file on disk.
+ *
+ * This is used for battery-backed cartridge RAM: the emulator reads and writes
+ * the mapping directly, and the kernel takes care of writing dirty pages back
+ * to the file. Nothing is written synchronously on the emulation thread--the
+ * SaveFlusher periodically issues an asynchronous msync() for every dirty
+ * SaveFile, and tearing down a SaveFile simply unmaps it.
+ *
+ * If the file cannot be mapped, the SaveFile falls back to an anonymous
+ * in-memory buffer so that emulation can proceed (without persistence).
+ */
+class SaveFile : public Noncopyable {
+ public:
+  /**
+   * Opens (creating if necessary) and maps filename.
+   *
+   * \param filename The path of the save file.
+   * \param size The size of the mapping, in bytes. A smaller file is grown
+   *             to this size; a larger one is mapped only up to it, and
+   *             keeps the rest.
+   */
+  SaveFile(const std::string &filename, std::size_t size);
+  ~SaveFile();
+
+  /** \return A pointer to the first byte of the mapping. */
+  byte_t *data() { return data_; }
+  const byte_t *data() const { return data_; }
+
+  /** \return The size of the mapping, in bytes. */
+  std::size_t size() const { return size_; }
+
+  /** \return true if the mapping is backed by the file on disk. */
+  bool is_persistent() const { return fd_ >= 0; }
+
+  /**
+   * Flags the mapping as modified since the last flush.
+   *
+   * This is cheap enough to call on every write to the mapping.
+   */
+  void mark_dirty() { dirty_.store(true, std::memory_order_relaxed); }
+
+ private:
+  friend class SaveFlusher;
+
+  /** Schedules writeback of the mapping if it has been marked dirty. */
+  void flush_async_();
+
+  std::string filename_;
+  std::size_t size_;
+  int fd_ = -1;
+  byte_t *data_ = nullptr;
+  std::vector<byte_t> fallback_;
+  std::atomic<bool> dirty_ = false;
+};
+
+/**
+ * A process-wide background thread which batches writeback of all live
+ * SaveFiles.
+ *
+ * Every interval, each registered SaveFile that has been marked dirty has an
+ * asynchronous msync() scheduled for it. This keeps the emulation thread free
+ * of any disk I/O, and means many emulator instances in one process share a
+ * single flusher rather than each doing their own writes.
+ */
+class SaveFlusher : public Noncopyable {
+ public:
+  /** \return The process-wide flusher. The thread is started lazily. */
+  static SaveFlusher &instance();
+
+  ~SaveFlusher();
+
+  void add(SaveFile *file);
+  void remove(SaveFile *file);
+
+ private:
+  SaveFlusher() = default;
+
+  void run_();
+
+  static constexpr std::chrono::milliseconds FLUSH_INTERVAL{1000};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<SaveFile *> files_;
+  std::thread thread_;
+  bool should_exit_ = false;
+};
+
+}  // namespace bugme
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef BUGME_SAVESTATE_HH
+#define BUGME_SAVESTATE_HH
+
+#include <cstdint>
+
+#include "types.hh"
+
+namespace bugme {
+
+/*
+ * Fixed-layout snapshots of each component of the machine.
+ *
+ * Every struct here is plain data, so that a whole machine can be captured or
+ * restored with a handful of bulk copies. Values are stored in host byte
+ * order; save states are not meant to be portable between architectures.
+ *
+ * Any change to these structs must bump SAVESTATE_VERSION.
+ */
+
+inline const char SAVESTATE_MAGIC[8] = {'B', 'U', 'G', 'M',
+                                       'E', 'S', 'T', 'A'};
+inline const std::uint32_t SAVESTATE_VERSION = 6;
+
+struct CpuState {
+  byte_t a, b, c, d, e, f, h, l;
+  word_t sp, pc;
+  byte_t interrupt_master_enable;
+  byte_t interrupt_enable;
+  byte_t interrupt_flag;
+  byte_t boot_rom_control;
+  byte_t stopped;
+  byte_t halted;
+  byte_t did_branch;
+  byte_t halt_bug_no_step_mode;
+  /** An accurate OAM DMA, if one is underway. \see Cpu::set_accurate_dma */
+  byte_t dma_active, dma_started;
+  word_t dma_source;
+  byte_t dma_done;
+};
+
+/** Also the live layout of Memory, which holds one of these. */
+struct MemoryState {
+  byte_t vram[0x2000];      // 0x8000-0x9FFF
+  byte_t work_ram[0x2000];  // 0xC000-0xDFFF
+  byte_t oam[0xA0];         // 0xFE00-0xFE9F
+  byte_t unused[0x60];      // 0xFEA0-0xFEFF
+  /** 0xFF00-0xFF7F, where no component holds a register. */
+  byte_t io[0x80];
+  /** 0xFF80-0xFFFF; the last byte is IE, which the CPU holds. */
+  byte_t high_ram[0x80];
+};
+
+struct PpuState {
+  byte_t lcd_control, lcd_status, scroll_y, scroll_x, line, ly_compare,
+      dma_transfer, bg_palette, sprite_palette_0, sprite_palette_1, window_y,
+      window_x;
+  byte_t mode;
+  std::uint32_t cycles_elapsed;
+  /** The last completed frame, as Ppu::frame_buffer() returns it. */
+  byte_t frame_buffer[160 * 144];
+};
+
+struct TimerState {
+  /** The cycle at which DIV was last reset, and TIMA as of tima_cycle. */
+  std::uint64_t div_base, tima_cycle;
+  byte_t tima, timer_modulo, timer_control;
+};
+
+struct JoypadState {
+  byte_t joyp;
+  /** Bitmask of held buttons, indexed by Button - 1. */
+  byte_t buttons;
+};
+
+struct SerialState {
+  byte_t data, control;
+  std::uint32_t transfer_cycles;
+};
+
+struct CartridgeState {
+  word_t rom_bank;
+  byte_t ram_bank;
+  byte_t ram_enabled;
+  byte_t banking_mode;
+  byte_t rtc_last_latch_write;
+  std::uint64_t rtc_base_cycles;
+  /** Size of the external RAM (and RTC) data which follows the state. */
+  std::uint32_t ram_size;
+};
+
+struct ApuChannelState {
+  byte_t enabled, dac, length_enabled, volume, envelope_timer, position;
+  word_t length;
+  /** When the channel's waveform next advances, in machine T-cycles. */
+  std::uint64_t next_tick;
+};
+
+struct ApuState {
+  /** 0xFF10-0xFF3F, as last written: the sound registers and wave RAM. */
+  byte_t registers[0x30];
+  ApuChannelState channels[4];
+  byte_t powered, sequencer_step, sweep_enabled, sweep_timer;
+  word_t shadow_frequency, lfsr;
+  /** The T-cycle the APU has been emulated up to. */
+  std::uint64_t time;
+  std::uint64_t next_sequencer_step;
+};
+
+struct MachineState {
+  std::uint64_t cycles;
+  CpuState cpu;
+  MemoryState memory;
+  PpuState ppu;
+  TimerState timer;
+  JoypadState joypad;
+  CartridgeState cartridge;
+  ApuState apu;
+  SerialState serial;
+};
+
+/**
+ * A save state is laid out as:
+ *
+ *   SaveStateHeader
+ *   MachineState
+ *   byte_t[cartridge.ram_size], the cartridge's external RAM and RTC
+ */
+struct SaveStateHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t size;  // of the whole save state, in bytes
+  /** Identifies the ROM that the state belongs to. */
+  byte_t title[16];
+  word_t global_checksum;
+  byte_t reserved[6];
+};
+
+}  // namespace bugme
+
+#endif
@@ -0,0 +1,191 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cartridge.hh"
+#include "log.hh"
+#include "rom_index.hh"
+
+namespace bugme {
+
+namespace {
+
+/** Smallest file that can hold a cartridge header. */
+inline const std::size_t MIN_ROM_SIZE = 0x150;
+
+struct ScanOptions {
+  std::string index_filename;
+  std::vector<std::string> directories;
+  unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+bool is_rom_filename(const std::filesystem::path &path) {
+  std::string extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return extension == ".gb" || extension == ".gbc" || extension == ".sgb";
+}
+
+std::vector<std::string> find_roms(const std::vector<std::string> &dirs) {
+  std::vector<std::string> paths;
+  for (const std::string &dir : dirs) {
+    std::error_code error;
+    auto it = std::filesystem::recursive_directory_iterator(
+        dir, std::filesystem::directory_options::skip_permission_denied,
+        error);
+    if (error) {
+      log_warn("[scan] cannot open directory %s", dir.c_str());
+      continue;
+    }
+
+    for (const auto &entry : it) {
+      if (entry.is_regular_file() && is_rom_filename(entry.path())) {
+        paths.push_back(RomIndex::canonical_path(entry.path().string()));
+      }
+    }
+  }
+
+  // The same ROM may be reachable through several of the given directories.
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+  return paths;
+}
+
+/**
+ * Parses the header of the ROM at path into entry.
+ *
+ * \return false if the file could not be read or is too small to be a ROM.
+ */
+bool scan_rom(const std::string &path, RomIndexEntry &entry) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<std::size_t>(st.st_size) < MIN_ROM_SIZE) {
+    close(fd);
+    return false;
+  }
+
+  std::size_t size = static_cast<std::size_t>(st.st_size);
+  void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  madvise(addr, size, MADV_SEQUENTIAL);
+
+  const byte_t *rom = static_cast<const byte_t *>(addr);
+  CartridgeHeader header;
+  std::memcpy(&header, rom + 0x0100, sizeof(header));
+
+  entry = {};
+  entry.file_size = static_cast<std::uint32_t>(size);
+  entry.rom_size = static_cast<std::uint32_t>(get_rom_size(header));
+  entry.ram_size = static_cast<std::uint32_t>(get_ram_size(header));
+  entry.global_checksum = static_cast<word_t>(
+      (header.global_checksum[0] << 8) | header.global_checksum[1]);
+  std::memcpy(entry.title, header.title, sizeof(entry.title));
+  entry.cartridge_type = header.cartridge_type;
+  entry.header_checksum = header.header_checksum;
+
+  if (compute_header_checksum(rom) == header.header_checksum) {
+    entry.flags |= RomIndexEntry::HEADER_CHECKSUM_OK;
+  }
+  if (compute_global_checksum(rom, size) == entry.global_checksum) {
+    entry.flags |= RomIndexEntry::GLOBAL_CHECKSUM_OK;
+  }
+
+  munmap(addr, size);
+  return true;
+}
+
+ScanOptions get_scan_options(int argc, char **argv) {
+  if (argc < 3) {
+    log_error("usage: bugme-scan <index_file> <rom_dir>... [--threads n]");
+    std::exit(2);
+  }
+
+  ScanOptions options;
+  options.index_filename = argv[1];
+
+  std::vector<std::string> args(argv + 2, argv + argc);
+  for (unsigned int i = 0; i < args.size(); ++i) {
+    if (args[i] == "--threads" && i + 1 < args.size()) {
+      options.threads = std::max(1, std::atoi(args[++i].c_str()));
+    } else {
+      options.directories.push_back(args[i]);
+    }
+  }
+  return options;
+}
+
+}  // namespace
+
+int scan_main(int argc, char **argv) {
+  log_set_level(LogLevel::Info);
+  ScanOptions options = get_scan_options(argc, argv);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::string> paths = find_roms(options.directories);
+
+  std::vector<RomIndexEntry> entries(paths.size());
+  std::vector<char> ok(paths.size(), false);
+
+  // Each worker claims the next unscanned ROM until none are left.
+  std::atomic<std::size_t> next = 0;
+  std::vector<std::thread> workers;
+  for (unsigned int t = 0; t < options.threads; ++t) {
+    workers.emplace_back([&]() {
+      for (std::size_t i = next++; i < paths.size(); i = next++) {
+        ok[i] = scan_rom(paths[i], entries[i]);
+      }
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  std::vector<RomIndexEntry> indexed;
+  std::vector<std::string> indexed_paths;
+  std::size_t bad_checksums = 0;
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    if (!ok[i]) {
+      log_warn("[scan] skipping unreadable rom %s", paths[i].c_str());
+      continue;
+    }
+    if (!entries[i].header_checksum_ok() || !entries[i].global_checksum_ok()) {
+      ++bad_checksums;
+    }
+    indexed.push_back(entries[i]);
+    indexed_paths.push_back(paths[i]);
+  }
+
+  if (!RomIndex::write(options.index_filename, indexed, indexed_paths)) {
+    log_error("[scan] cannot write index %s", options.index_filename.c_str());
+    return 1;
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  log_info("[scan] indexed %zu roms (%zu with bad checksums) in %.3fs "
+           "using %u threads",
+           indexed.size(), bad_checksums, elapsed.count(), options.threads);
+  return 0;
+}
+
+}  // namespace bugme
+
+int main(int argc, char **argv) { return bugme::scan_main(argc, argv); }
@@ -0,0 +1,62 @@
+#include "sdl_audio.hh"
+
+#include <SDL.h>
+
+#include <algorithm>
+
+#include "log.hh"
+
+namespace bugme {
+
+SdlAudio::SdlAudio(unsigned int sample_rate)
+    : sample_rate_(sample_rate), ring_(sample_rate / 5 * 2) {
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+    log_warn("[audio] cannot initialize SDL audio: %s", SDL_GetError());
+    return;
+  }
+
+  SDL_AudioSpec desired = {};
+  desired.freq = static_cast<int>(sample_rate);
+  desired.format = AUDIO_S16SYS;
+  desired.channels = 2;
+  desired.samples = 512;
+  desired.callback = &SdlAudio::callback_;
+  desired.userdata = this;
+
+  SDL_AudioSpec obtained;
+  device_ = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained,
+                                SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+  if (device_ == 0) {
+    log_warn("[audio] cannot open an audio device: %s", SDL_GetError());
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    return;
+  }
+
+  sample_rate_ = static_cast<unsigned int>(obtained.freq);
+  log_info("[audio] playing at %u Hz", sample_rate_);
+  SDL_PauseAudioDevice(device_, 0);
+}
+
+SdlAudio::~SdlAudio() {
+  if (device_ != 0) {
+    SDL_CloseAudioDevice(device_);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+  }
+}
+
+std::size_t SdlAudio::push(const std::int16_t *samples, std::size_t frames) {
+  // Only whole frames, so that left and right never swap places.
+  frames = std::min(frames, (ring_.capacity() - ring_.size()) / 2);
+  return ring_.push(samples, frames * 2) / 2;
+}
+
+void SdlAudio::callback_(void *userdata, std::uint8_t *stream, int len) {
+  SdlAudio &audio = *static_cast<SdlAudio *>(userdata);
+  std::int16_t *out = reinterpret_cast<std::int16_t *>(stream);
+  std::size_t count = static_cast<std::size_t>(len) / sizeof(std::int16_t);
+
+  std::size_t popped = audio.ring_.pop(out, count);
+  std::fill(out + popped, out + count, 0);
+}
+
+}  // namespace bugme
@@ -0,0 +1,56 @@
+#ifndef BUGME_SDL_AUDIO_HH
+#define BUGME_SDL_AUDIO_HH
+
+#include <cstddef>
+#include <cstdint>
+
+#include "audio_ring.hh"
+#include "types.hh"
+
+namespace bugme {
+
+/**
+ * Plays 16-bit stereo samples on the default SDL audio device.
+ *
+ * Samples are handed from the emulator thread to SDL's audio thread through
+ * an AudioRing, so neither waits for the other. If the ring runs dry, the
+ * device plays silence until it is refilled.
+ */
+class SdlAudio : public Noncopyable {
+ public:
+  /**
+   * Opens and starts the device.
+   *
+   * \param sample_rate The requested rate; the device may choose another.
+   *        \see sample_rate()
+   */
+  explicit SdlAudio(unsigned int sample_rate);
+  ~SdlAudio();
+
+  /** \return false if no device could be opened. */
+  bool good() const { return device_ != 0; }
+
+  /** \return The rate the device actually plays at. */
+  unsigned int sample_rate() const { return sample_rate_; }
+
+  /**
+   * Queues interleaved left and right samples, dropping any that do not fit.
+   *
+   * \return The number of sample frames (pairs) queued.
+   */
+  std::size_t push(const std::int16_t *samples, std::size_t frames);
+
+  /** \return The number of sample frames waiting to be played. */
+  std::size_t queued() const { return ring_.size() / 2; }
+
+ private:
+  static void callback_(void *userdata, std::uint8_t *stream, int len);
+
+  std::uint32_t device_ = 0;
+  unsigned int sample_rate_;
+  AudioRing ring_;
+};
+
+}  // namespace bugme
+
+#endif
@@ -12,24 +12,34 @@ namespace bugme {
 SdlDisplay::SdlDisplay(SDL_Renderer *renderer, SDL_Texture *texture)
     : renderer_(renderer), texture_(texture) {}
 
-void SdlDisplay::draw(std::vector<Color> &buffer) {
+void SdlDisplay::draw(const std::vector<Color> &buffer) {
+  render(buffer);
+  present();
+}
+
+void SdlDisplay::render(const std::vector<Color> &buffer) {
   SDL_RenderClear(renderer_);
 
   void *pixels_ptr;
   int pitch;
 
   SDL_LockTexture(texture_, nullptr, &pixels_ptr, &pitch);
-  uint32_t *pixels = static_cast<uint32_t *>(pixels_ptr);
+  convert(buffer, static_cast<uint32_t *>(pixels_ptr));
+  SDL_UnlockTexture(texture_);
+
+  SDL_RenderCopy(renderer_, texture_, nullptr, nullptr);
+}
+
+void SdlDisplay::present() { SDL_RenderPresent(renderer_); }
+
+void SdlDisplay::convert(const std::vector<Color> &buffer,
+                         std::uint32_t *pixels) {
   for (uint y = 0; y < GAMEBOY_HEIGHT; y++) {
     for (uint x = 0; x < GAMEBOY_WIDTH; x++) {
       Color color = buffer.at(y * GAMEBOY_WIDTH + x);
       pixels[y * GAMEBOY_WIDTH + x] = convert_color_(color);
     }
   }
-  SDL_UnlockTexture(texture_);
-
-  SDL_RenderCopy(renderer_, texture_, nullptr, nullptr);
-  SDL_RenderPresent(renderer_);
 }
 
 std::uint32_t SdlDisplay::convert_color_(Color color) {
@@ -14,19 +14,29 @@ struct SDL_Texture;
 
 namespace bugme {
 
-enum class Color;
+enum class Color : byte_t;
 
 class SdlDisplay : public Display, Noncopyable {
  public:
   SdlDisplay(SDL_Renderer *renderer, SDL_Texture *texture);
 
-  void draw(std::vector<Color> &buffer) override;
+  /** Renders and presents buffer. */
+  void draw(const std::vector<Color> &buffer) override;
+
+  /** Converts buffer and copies it to the renderer, without presenting. */
+  void render(const std::vector<Color> &buffer);
+
+  /** Presents what was rendered, waiting for vsync if the renderer does. */
+  void present();
+
+  /** Converts a frame to the texture's ARGB8888 pixels. */
+  static void convert(const std::vector<Color> &buffer, std::uint32_t *pixels);
 
  private:
   SDL_Renderer *renderer_;
   SDL_Texture *texture_;
 
-  std::uint32_t convert_color_(Color color);
+  static std::uint32_t convert_color_(Color color);
 };
 
 }  // namespace bugme
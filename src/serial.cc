@@ -0,0 +1,75 @@
+#include "serial.hh"
+
+#include "link_cable.hh"
+
+namespace bugme {
+
+namespace {
+/** 8 bits at 8192 Hz. */
+inline const tcycles_t TRANSFER_CYCLES = 4096;
+}  // namespace
+
+Serial::~Serial() { unplug(); }
+
+void Serial::tick(tcycles_t cycles) {
+  if (control.transfer_start() && control.internal_clock()) {
+    transfer_cycles_ += cycles;
+    if (transfer_cycles_ >= TRANSFER_CYCLES) {
+      transfer_cycles_ = 0;
+      if (output_cb_) {
+        output_cb_(data.value());
+      }
+      complete_(cable_ ? cable_->transfer(end_, data.value(), cycles_) : 0xFF);
+    }
+    return;
+  }
+
+  // Driven by the peer's clock. Bits shift in whether or not a transfer was
+  // requested; only a requested one raises the interrupt.
+  transfer_cycles_ = 0;
+  if (cable_ && cable_->offered(end_, cycles_)) {
+    std::optional<byte_t> received =
+        cable_->receive(end_, data.value(), cycles_);
+    if (received) {
+      if (control.transfer_start()) {
+        complete_(*received);
+      } else {
+        data.set(*received);
+      }
+    }
+  }
+}
+
+void Serial::complete_(byte_t received) {
+  data.set(received);
+  control.clear_transfer_start();
+  interrupts_.request(Interrupt::SERIAL);
+}
+
+void Serial::plug(LinkCable &cable, unsigned int end) {
+  unplug();
+  cable_ = &cable;
+  end_ = end;
+  cable_->plug(end_);
+}
+
+void Serial::unplug() {
+  if (cable_) {
+    cable_->unplug(end_);
+    cable_ = nullptr;
+  }
+}
+
+void Serial::save_state(SerialState &state) const {
+  state.data = data.value();
+  state.control = control.value();
+  state.transfer_cycles = transfer_cycles_;
+}
+
+void Serial::load_state(const SerialState &state) {
+  data.set(state.data);
+  control.set(state.control);
+  transfer_cycles_ = state.transfer_cycles;
+}
+
+}  // namespace bugme
@@ -0,0 +1,81 @@
+#ifndef BUGME_SERIAL_HH
+#define BUGME_SERIAL_HH
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+#include "bus.hh"
+#include "interrupts.hh"
+#include "log.hh"
+#include "register.hh"
+#include "savestate.hh"
+#include "types.hh"
+
+namespace bugme {
+
+class LinkCable;
+
+/* clang-format off */
+class SerialControl : public ControlRegister {
+ public:
+  CONTROL_FLAG(7, transfer_start)
+  CONTROL_FLAG(0, internal_clock)  // 1 = this side drives the transfer
+};
+/* clang-format on */
+
+class Serial;
+
+struct SerialBus : Bus<Serial> {
+  ByteRegister data;      // 0xFF01
+  SerialControl control;  // 0xFF02
+};
+
+/**
+ * The serial port.
+ *
+ * A transfer driven by the internal clock takes 4096 T-cycles (8 bits at
+ * 8192 Hz), after which the byte in SB has been swapped with the peer's. With
+ * no cable plugged in, the peer reads as 0xFF, and transfers driven by the
+ * peer's clock never complete, as on hardware.
+ *
+ * \see LinkCable, to connect two machines
+ */
+class Serial : public SerialBus {
+ public:
+  /** \param cycles The machine's T-cycle counter. */
+  Serial(Interrupts &interrupts, const std::uint64_t &cycles)
+      : interrupts_(interrupts), cycles_(cycles) {}
+  ~Serial();
+
+  void tick(tcycles_t cycles);
+
+  /** Plugs this port into one end of a cable, unplugging it from any other. */
+  void plug(LinkCable &cable, unsigned int end);
+  void unplug();
+
+  /**
+   * Registers a callback which receives each byte this side sends, for
+   * capturing the output of test ROMs.
+   */
+  void register_output_cb(std::function<void(byte_t)> cb) {
+    output_cb_ = std::move(cb);
+  }
+
+  void save_state(SerialState &state) const;
+  void load_state(const SerialState &state);
+
+ private:
+  void complete_(byte_t received);
+
+  Interrupts &interrupts_;
+  const std::uint64_t &cycles_;
+  tcycles_t transfer_cycles_ = 0;
+  LinkCable *cable_ = nullptr;
+  unsigned int end_ = 0;
+  std::function<void(byte_t)> output_cb_ = nullptr;
+};
+
+}  // namespace bugme
+
+#endif
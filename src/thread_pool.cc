@@ -0,0 +1,117 @@
+#include "thread_pool.hh"
+
+#include <utility>
+
+namespace bugme {
+
+namespace {
+/** The pool and worker index of the calling thread, if it is a worker. */
+thread_local const ThreadPool *this_pool = nullptr;
+thread_local unsigned int this_worker = 0;
+}  // namespace
+
+ThreadPool::ThreadPool(unsigned int threads) {
+  threads = threads == 0 ? 1 : threads;
+  for (unsigned int i = 0; i < threads; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  // Only start the threads once every deque exists, as workers steal from
+  // each other's right away.
+  for (unsigned int i = 0; i < threads; ++i) {
+    workers_[i]->thread = std::thread(&ThreadPool::run_, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+  for (std::unique_ptr<Worker> &worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+void ThreadPool::submit(Task task) {
+  unsigned int index = worker_index();
+  if (index == size()) {
+    index = next_worker_++ % size();
+  }
+
+  ++pending_;
+  {
+    std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+    workers_[index]->tasks.push_back(std::move(task));
+  }
+  ++queued_;
+
+  // Taking the lock orders this against a worker checking queued_ before it
+  // goes to sleep, so the wakeup cannot be missed.
+  { std::lock_guard<std::mutex> lock(idle_mutex_); }
+  work_available_.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> lock(idle_mutex_);
+  all_done_.wait(lock, [this]() { return pending_ == 0; });
+}
+
+unsigned int ThreadPool::worker_index() const {
+  return this_pool == this ? this_worker : size();
+}
+
+void ThreadPool::run_(unsigned int index) {
+  this_pool = this;
+  this_worker = index;
+
+  Task task;
+  while (true) {
+    if (pop_(index, task) || steal_(index, task)) {
+      task();
+      task = nullptr;
+      if (--pending_ == 0) {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        all_done_.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    work_available_.wait(lock,
+                         [this]() { return stopping_ || queued_ > 0; });
+    if (stopping_) {
+      return;
+    }
+  }
+}
+
+bool ThreadPool::pop_(unsigned int index, Task &task) {
+  Worker &worker = *workers_[index];
+  std::lock_guard<std::mutex> lock(worker.mutex);
+  if (worker.tasks.empty()) {
+    return false;
+  }
+  task = std::move(worker.tasks.back());
+  worker.tasks.pop_back();
+  --queued_;
+  return true;
+}
+
+bool ThreadPool::steal_(unsigned int index, Task &task) {
+  for (unsigned int i = 1; i < size(); ++i) {
+    Worker &victim = *workers_[(index + i) % size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (victim.tasks.empty()) {
+      continue;
+    }
+    task = std::move(victim.tasks.front());
+    victim.tasks.pop_front();
+    --queued_;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace bugme
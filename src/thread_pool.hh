@@ -0,0 +1,87 @@
+#ifndef BUGME_THREAD_POOL_HH
+#define BUGME_THREAD_POOL_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.hh"
+
+namespace bugme {
+
+/**
+ * A fixed set of worker threads which balance work by stealing it.
+ *
+ * Every worker owns a deque of tasks. A worker takes its own tasks from the
+ * back, so a task that resubmits itself keeps running on the same thread
+ * with a warm cache; only when its deque is empty does it steal, from the
+ * front of another worker's deque. Each deque has its own lock, so workers
+ * only contend with each other when stealing.
+ */
+class ThreadPool : public Noncopyable {
+ public:
+  typedef std::function<void()> Task;
+
+  /** \param threads The number of workers. At least one is started. */
+  explicit ThreadPool(unsigned int threads);
+
+  /** Waits for all outstanding tasks, then stops the workers. */
+  ~ThreadPool();
+
+  /**
+   * Queues a task. When called from a worker, the task goes on that worker's
+   * own deque; otherwise the deques are filled round-robin.
+   */
+  void submit(Task task);
+
+  /**
+   * Blocks until every submitted task, including any tasks those submitted
+   * in turn, has finished.
+   */
+  void wait();
+
+  /** \return The number of workers. */
+  unsigned int size() const {
+    return static_cast<unsigned int>(workers_.size());
+  }
+
+  /**
+   * \return The index of the worker running the calling thread, or size()
+   *         if it is not a worker of this pool.
+   */
+  unsigned int worker_index() const;
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  void run_(unsigned int index);
+  bool pop_(unsigned int index, Task &task);
+  bool steal_(unsigned int index, Task &task);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  /** Tasks sitting in a deque, waiting to be picked up. */
+  std::atomic<std::size_t> queued_ = 0;
+  /** Tasks submitted but not yet finished. */
+  std::atomic<std::size_t> pending_ = 0;
+  std::atomic<unsigned int> next_worker_ = 0;
+
+  std::mutex idle_mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable all_done_;
+  bool stopping_ = false;
+};
+
+}  // namespace bugme
+
+#endif
@@ -0,0 +1,134 @@
+#include "timeline.hh"
+
+#include <cstdio>
+
+#include "log.hh"
+
+namespace bugme {
+
+namespace {
+const char *const EVENT_NAMES[] = {"frame", "run-ahead", "render", "present",
+                                   "input", "sync",      "line",   "vblank",
+                                   "halt",  "interrupt"};
+const char *const TRACK_NAMES[] = {"host", "cpu", "ppu"};
+const char *const INTERRUPT_NAMES[] = {"vblank interrupt", "stat interrupt",
+                                       "timer interrupt", "serial interrupt",
+                                       "joypad interrupt"};
+}  // namespace
+
+Timeline::Timeline() : start_(std::chrono::steady_clock::now()) {
+  handlers_.reserve(MAX_DEPTH);
+}
+
+void Timeline::begin(Track track, Event event, std::uint32_t arg) {
+  if (!recording_) {
+    return;
+  }
+  auto t = static_cast<std::size_t>(track);
+  // Spans nested too deeply are counted, so that their ends match, but not
+  // recorded.
+  if (open_count_[t] < MAX_DEPTH) {
+    open_[t][open_count_[t]] = {now_(), arg, event};
+  }
+  ++open_count_[t];
+}
+
+void Timeline::end(Track track) {
+  auto t = static_cast<std::size_t>(track);
+  if (!recording_ || open_count_[t] == 0) {
+    return;
+  }
+  if (--open_count_[t] >= MAX_DEPTH) {
+    return;
+  }
+  if (spans_.size() == MAX_SPANS) {
+    full_ = true;
+    return;
+  }
+  const Open &open = open_[t][open_count_[t]];
+  spans_.push_back({open.start, now_() - open.start, open.arg, open.event,
+                    track});
+}
+
+void Timeline::interrupt(std::uint32_t bit) {
+  if (!recording_) {
+    return;
+  }
+  handlers_.push_back(depth_);
+  ++depth_;
+  begin(Track::Cpu, Event::Interrupt, bit);
+}
+
+void Timeline::ret() {
+  if (depth_ > 0) {
+    --depth_;
+  }
+  while (!handlers_.empty() && handlers_.back() >= depth_) {
+    handlers_.pop_back();
+    end(Track::Cpu);
+  }
+}
+
+void Timeline::reset_machine() {
+  open_count_[static_cast<std::size_t>(Track::Cpu)] = 0;
+  open_count_[static_cast<std::size_t>(Track::Ppu)] = 0;
+  depth_ = 0;
+  handlers_.clear();
+}
+
+bool Timeline::write(const std::string &filename) const {
+  std::FILE *file = std::fopen(filename.c_str(), "w");
+  if (file == nullptr) {
+    log_error("[timeline] cannot open %s for writing", filename.c_str());
+    return false;
+  }
+
+  std::fprintf(file,
+               "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n"
+               "{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": 1, "
+               "\"args\": {\"name\": \"bugme\"}}");
+  for (std::size_t t = 0; t < static_cast<std::size_t>(Track::COUNT); ++t) {
+    std::fprintf(file,
+                 ",\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, "
+                 "\"tid\": %zu, \"args\": {\"name\": \"%s\"}}",
+                 t + 1, TRACK_NAMES[t]);
+  }
+
+  for (const Span &span : spans_) {
+    const char *name = EVENT_NAMES[static_cast<std::size_t>(span.event)];
+    std::fprintf(file,
+                 ",\n{\"ph\": \"X\", \"name\": \"%s\", \"pid\": 1, "
+                 "\"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+                 span.event == Event::Interrupt && span.arg < 5
+                     ? INTERRUPT_NAMES[span.arg]
+                     : name,
+                 static_cast<unsigned int>(span.track) + 1,
+                 static_cast<double>(span.start) / 1000,
+                 static_cast<double>(span.duration) / 1000);
+    switch (span.event) {
+      case Event::Frame:
+        std::fprintf(file, ", \"args\": {\"frame\": %u}}", span.arg);
+        break;
+      case Event::RunAhead:
+        std::fprintf(file, ", \"args\": {\"frames\": %u}}", span.arg);
+        break;
+      case Event::Line:
+        std::fprintf(file, ", \"args\": {\"ly\": %u}}", span.arg);
+        break;
+      default:
+        std::fprintf(file, "}");
+    }
+  }
+  std::fprintf(file, "\n]}\n");
+
+  bool ok = std::ferror(file) == 0;
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok) {
+    log_error("[timeline] cannot write %s", filename.c_str());
+  } else if (full_) {
+    log_warn("[timeline] only the first %zu spans were kept", MAX_SPANS);
+  }
+  return ok;
+}
+
+}  // namespace bugme
@@ -0,0 +1,144 @@
+#ifndef BUGME_TIMELINE_HH
+#define BUGME_TIMELINE_HH
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "types.hh"
+
+/**
+ * Wraps a statement which feeds the timeline, so that it disappears from
+ * builds without BUGME_TIMELINE (cmake -DBUGME_TIMELINE=ON).
+ */
+#ifdef BUGME_TIMELINE
+#define BUGME_EVENT(statement) statement
+#else
+#define BUGME_EVENT(statement)
+#endif
+
+namespace bugme {
+
+/** The rows of the timeline: the frontend, and the emulated CPU and PPU. */
+enum class Track : byte_t { Host, Cpu, Ppu, COUNT };
+
+enum class Event : byte_t {
+  /** Host */
+  Frame,
+  RunAhead,
+  Render,
+  Present,
+  Input,
+  Sync,
+  /** Ppu */
+  Line,
+  VBlank,
+  /** Cpu */
+  Halt,
+  Interrupt,
+};
+
+/**
+ * Records spans of host time, on three tracks, for a trace viewer such as
+ * Perfetto or chrome://tracing: frames and what the frontend does between
+ * them on the host track, and within each frame, what the emulated machine
+ * was doing as emulation reached it, i.e. scanlines and VBlank on the PPU
+ * track, and HALT and interrupt handlers on the CPU track.
+ *
+ * Spans are kept in memory until write(), up to MAX_SPANS of them (a few
+ * minutes' worth), and only while recording.
+ *
+ * \see Machine::timeline, which exists only in builds with BUGME_TIMELINE
+ */
+class Timeline : public Noncopyable {
+ public:
+  static constexpr std::size_t MAX_SPANS = 8 << 20;
+
+  Timeline();
+
+  void start_recording() { recording_ = true; }
+
+  /**
+   * Opens a span, within any still open on the same track.
+   *
+   * \param arg A detail of the span: the frame, the frames run ahead, the
+   *        line (LY), or the interrupt (its bit in IF).
+   */
+  void begin(Track track, Event event, std::uint32_t arg = 0);
+  /** Closes the innermost span open on track, if there is one. */
+  void end(Track track);
+
+  /** Opens a span for an interrupt handler, which ret() closes. */
+  void interrupt(std::uint32_t bit);
+  /** Follows CALL and RST, to know which RET leaves a handler. */
+  void call() { ++depth_; }
+  /** Follows RET and RETI. */
+  void ret();
+
+  /**
+   * Forgets the emulated tracks' open spans, when the machine jumps to
+   * another state, after which they would never be closed properly.
+   */
+  void reset_machine();
+
+  /** Opens a span on the host track for its own lifetime. */
+  class Scope : public Noncopyable {
+   public:
+    Scope(Timeline &timeline, Event event, std::uint32_t arg = 0)
+        : timeline_(timeline) {
+      timeline_.begin(Track::Host, event, arg);
+    }
+    ~Scope() { timeline_.end(Track::Host); }
+
+   private:
+    Timeline &timeline_;
+  };
+
+  /** Writes what was recorded in the Chrome trace event JSON format. */
+  bool write(const std::string &filename) const;
+
+ private:
+  /** Times are in nanoseconds since the timeline was created. */
+  struct Span {
+    std::uint64_t start;
+    /** As long as a debugger stop or a blocking save may take. */
+    std::uint64_t duration;
+    std::uint32_t arg;
+    Event event;
+    Track track;
+  };
+
+  struct Open {
+    std::uint64_t start;
+    std::uint32_t arg;
+    Event event;
+  };
+
+  static constexpr std::size_t MAX_DEPTH = 16;
+
+  std::uint64_t now_() const {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_)
+            .count());
+  }
+
+  bool recording_ = false;
+  std::chrono::steady_clock::time_point start_;
+  std::vector<Span> spans_;
+  bool full_ = false;
+
+  Open open_[static_cast<std::size_t>(Track::COUNT)][MAX_DEPTH];
+  std::size_t open_count_[static_cast<std::size_t>(Track::COUNT)] = {};
+
+  /** Calls made, less returns, on the CPU. */
+  std::size_t depth_ = 0;
+  /** The depths at which open interrupt handlers run, innermost last. */
+  std::vector<std::size_t> handlers_;
+};
+
+}  // namespace bugme
+
+#endif
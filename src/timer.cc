@@ -1,33 +1,110 @@
 #include "timer.hh"
 
+#include "mmap.hh"
+
 namespace bugme {
 
 namespace {
-const tcycles_t DIVIDERS[4] = {1024, 16, 64, 256};
+/** log2 of the T-cycles per TIMA increment, by TAC's clock select. */
+const unsigned int SHIFTS[4] = {10, 4, 6, 8};
+}  // namespace
+
+byte_t Timer::read(word_t addr) const {
+  switch (addr) {
+    case mmap::timer::DIV:
+      return static_cast<byte_t>((cycles_ - div_base_) >> 8);
+    case mmap::timer::TIMA:
+      // No overflow is due before next_overflow_, by which time update() has
+      // taken it, so this stays within a byte.
+      return static_cast<byte_t>(tima_ + ticks_());
+    case mmap::timer::TMA:
+      return timer_modulo.value();
+    case mmap::timer::TAC:
+      return timer_control.value();
+    default:
+      return 0xFF;
+  }
+}
+
+void Timer::write(word_t addr, byte_t byte) {
+  switch (addr) {
+    case mmap::timer::DIV:
+      // DIV register -- writes 0 on attempt, and with it the whole counter
+      sync_();
+      div_base_ = cycles_;
+      break;
+    case mmap::timer::TIMA:
+      sync_();
+      tima_ = byte;
+      break;
+    case mmap::timer::TMA:
+      timer_modulo.set(byte);
+      return;
+    case mmap::timer::TAC:
+      sync_();
+      timer_control.set(byte);
+      break;
+    default:
+      return;
+  }
+  schedule_();
 }
 
-void Timer::tick(tcycles_t cycles) {
-  div_cycle_counter_ += cycles;
-  if (div_cycle_counter_ > 0xFF) {
-    divider.increment();
-    div_cycle_counter_ &= 0xFF;
+void Timer::update() {
+  // Usually one overflow, but as many as fell within a jump of the cycle
+  // counter.
+  while (cycles_ >= next_overflow_) {
+    tima_ = timer_modulo.value();
+    tima_cycle_ = next_overflow_;
+    interrupts_.request(Interrupt::TIMER);
+    schedule_();
   }
+}
+
+unsigned int Timer::shift_() const {
+  return SHIFTS[timer_control.value() & 0b11];
+}
 
-  if (!timer_control.get_bit(2)) {
-    return;  // timer disabled
+std::uint64_t Timer::ticks_() const {
+  if (!enabled_()) {
+    return 0;
   }
+  // Increments fall where the counter is a multiple of the period, so count
+  // the multiples passed between the two cycles.
+  unsigned int shift = shift_();
+  return ((cycles_ - div_base_) >> shift) - ((tima_cycle_ - div_base_) >> shift);
+}
+
+void Timer::sync_() {
+  tima_ = static_cast<byte_t>(tima_ + ticks_());
+  tima_cycle_ = cycles_;
+}
 
-  tima_counter_ += cycles;
-  tcycles_t divider = DIVIDERS[timer_control.value() & 0b11];
-  if (tima_counter_ >= divider) {
-    tima_counter_ -= divider;
-    if (timer_counter.value() == 0xFF) {
-      timer_counter.set(timer_modulo.value());
-      timer_interrupt_request();
-    } else {
-      timer_counter.increment();
-    }
+void Timer::schedule_() {
+  if (!enabled_()) {
+    next_overflow_ = NEVER;
+    return;
   }
+  unsigned int shift = shift_();
+  std::uint64_t ticks = ((tima_cycle_ - div_base_) >> shift) + 0x100 - tima_;
+  next_overflow_ = div_base_ + (ticks << shift);
+}
+
+void Timer::save_state(TimerState &state) const {
+  state.div_base = div_base_;
+  state.tima_cycle = tima_cycle_;
+  state.tima = tima_;
+  state.timer_modulo = timer_modulo.value();
+  state.timer_control = timer_control.value();
+}
+
+void Timer::load_state(const TimerState &state) {
+  div_base_ = state.div_base;
+  tima_cycle_ = state.tima_cycle;
+  tima_ = state.tima;
+  timer_modulo.set(state.timer_modulo);
+  timer_control.set(state.timer_control);
+  schedule_();
 }
 
 }  // namespace bugme
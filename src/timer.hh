@@ -1,49 +1,76 @@
 #ifndef BUGME_TIMER_HH
 #define BUGME_TIMER_HH
 
-#include <functional>
-#include <memory>
+#include <cstdint>
+#include <limits>
 
-#include "bus.hh"
+#include "interrupts.hh"
 #include "register.hh"
+#include "savestate.hh"
 #include "types.hh"
 
 namespace bugme {
 
-class Timer;
+/**
+ * DIV, TIMA, TMA and TAC, computed from the machine's cycle counter rather
+ * than counted up instruction by instruction.
+ *
+ * DIV is the top byte of a 16-bit counter which runs at the T-cycle rate and
+ * which writing DIV resets; the timer keeps only the cycle at which that
+ * last happened. TIMA counts the falling edges of one bit of that counter,
+ * as TAC selects, so it too is a function of the cycle count since it was
+ * last written. Neither costs anything until it is read, however far the
+ * machine has run since.
+ *
+ * The one thing which cannot wait for a read is TIMA's overflow, which
+ * raises the timer interrupt. The timer works out the cycle it falls on
+ * whenever TIMA, TAC or DIV change, and the machine calls update() once it
+ * has run that far.
+ */
+class Timer : public Noncopyable {
+ public:
+  /** next_event() while the timer is stopped. */
+  static constexpr std::uint64_t NEVER =
+      std::numeric_limits<std::uint64_t>::max();
 
-struct TimerBus : Bus<Timer> {
-  ByteRegister divider;        // 0xFF04
-  ByteRegister timer_counter;  // 0xFF05
-  ByteRegister timer_modulo;   // 0xFF06
-  ByteRegister timer_control;  // 0xFF07
+  /** \param cycles The machine's T-cycle counter. */
+  Timer(Interrupts &interrupts, const std::uint64_t &cycles)
+      : interrupts_(interrupts), cycles_(cycles) {}
 
-  std::function<void()> timer_interrupt_request_cb = nullptr;
+  /** \param addr An address within 0xFF04-0xFF07. */
+  byte_t read(word_t addr) const;
+  void write(word_t addr, byte_t byte);
 
-  void register_timer_interrupt_request_cb(std::function<void()> cb) {
-    timer_interrupt_request_cb = cb;
-  }
+  /** \return The T-cycle at which TIMA next overflows, or NEVER. */
+  std::uint64_t next_event() const { return next_overflow_; }
+  /** Reloads TIMA and raises the interrupt for any overflow due by now. */
+  void update();
 
-  void timer_interrupt_request() {
-    if (timer_interrupt_request_cb) {
-      timer_interrupt_request_cb();
-    } else {
-      log_error("No timer interrupt request callback has been registered!");
-    }
-  }
-};
+  void save_state(TimerState &state) const;
+  void load_state(const TimerState &state);
 
-class Timer : public TimerBus {
- public:
-  Timer() = default;
-  virtual ~Timer() = default;
+ private:
+  bool enabled_() const { return timer_control.get_bit(2); }
+  /** \return log2 of the T-cycles per TIMA increment. */
+  unsigned int shift_() const;
+  /** \return TIMA's increments from tima_cycle_ up to now. */
+  std::uint64_t ticks_() const;
+  /** Brings tima_ up to now. Not to be called past an overflow. */
+  void sync_();
+  /** Works out next_overflow_ from tima_ as of tima_cycle_. */
+  void schedule_();
 
-  void tick(tcycles_t cycles);
+  Interrupts &interrupts_;
+  const std::uint64_t &cycles_;
+  /** The cycle at which the 16-bit counter behind DIV was last 0. */
+  std::uint64_t div_base_ = 0;
+  /** TIMA, as of tima_cycle_. */
+  byte_t tima_ = 0;
+  std::uint64_t tima_cycle_ = 0;
+  std::uint64_t next_overflow_ = NEVER;
 
- private:
-  tcycles_t div_cycle_counter_ = 0;
-  tcycles_t tima_counter_ = 0;
-  // bool is_stopped_ = false;
+  ByteRegister timer_modulo;   // 0xFF06
+  ByteRegister timer_control;  // 0xFF07
 };
 
 }  // namespace bugme
@@ -0,0 +1,309 @@
+#include "trace.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include "log.hh"
+
+namespace bugme {
+
+namespace {
+inline const char MAGIC[8] = {'B', 'U', 'G', 'M', 'E', 'T', 'R', 'C'};
+inline const std::uint32_t VERSION = 1;
+
+/** Buffers are this large, and this many of them fill while one is written. */
+inline const std::size_t BUFFER_SIZE = 4 << 20;
+inline const std::size_t BUFFERS = 4;
+
+/**
+ * Two masks, eight registers, sp, then pc and cycles as varints, then the
+ * four bytes at pc.
+ */
+inline const std::size_t MAX_RECORD_SIZE = 2 + 8 + 2 + 3 + 10 + 4;
+
+/** Flags in the second mask of a record. */
+inline const byte_t SP_CHANGED = 0x01;
+/** All four bytes at pc follow. */
+inline const byte_t PCMEM_FULL = 0x02;
+/**
+ * pc moved forwards by 1-3 bytes, over what the last record already held:
+ * only the bytes newly in view follow.
+ */
+inline const byte_t PCMEM_SHIFTED = 0x04;
+
+byte_t *put_varint(byte_t *out, std::uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<byte_t>(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<byte_t>(value);
+  return out;
+}
+
+/** Small jumps either way make for small varints. */
+std::uint64_t zigzag(word_t delta) {
+  auto value = static_cast<std::int16_t>(delta);
+  return static_cast<std::uint16_t>((value << 1) ^ (value >> 15));
+}
+
+word_t unzigzag(std::uint64_t value) {
+  return static_cast<word_t>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+void registers(const TraceRecord &record, byte_t out[8]) {
+  out[0] = record.a;
+  out[1] = record.f;
+  out[2] = record.b;
+  out[3] = record.c;
+  out[4] = record.d;
+  out[5] = record.e;
+  out[6] = record.h;
+  out[7] = record.l;
+}
+}  // namespace
+
+bool TraceRecord::same_state(const TraceRecord &other) const {
+  return a == other.a && f == other.f && b == other.b && c == other.c &&
+         d == other.d && e == other.e && h == other.h && l == other.l &&
+         sp == other.sp && pc == other.pc &&
+         std::memcmp(pcmem, other.pcmem, sizeof(pcmem)) == 0;
+}
+
+TraceWriter::TraceWriter(const std::string &filename)
+    : file_(std::fopen(filename.c_str(), "wb")) {
+  if (file_ == nullptr) {
+    log_error("[trace] cannot open %s for writing", filename.c_str());
+    return;
+  }
+  std::fwrite(MAGIC, 1, sizeof(MAGIC), file_);
+  byte_t version[4] = {static_cast<byte_t>(VERSION), 0, 0, 0};
+  std::fwrite(version, 1, sizeof(version), file_);
+
+  buffer_.resize(BUFFER_SIZE);
+  for (std::size_t i = 1; i < BUFFERS; ++i) {
+    free_.emplace_back(BUFFER_SIZE);
+  }
+  thread_ = std::thread([this]() { run_(); });
+}
+
+TraceWriter::~TraceWriter() {
+  if (file_ == nullptr) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (used_ > 0) {
+      full_.emplace_back(std::move(buffer_), used_);
+    }
+    done_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  std::fclose(file_);
+}
+
+void TraceWriter::record(const TraceRecord &record) {
+  if (file_ == nullptr) {
+    return;
+  }
+  if (buffer_.size() - used_ < MAX_RECORD_SIZE) {
+    submit_();
+  }
+
+  byte_t *start = buffer_.data() + used_;
+  byte_t *out = start + 2;
+  byte_t register_mask = 0;
+  byte_t flags = 0;
+
+  byte_t now[8], before[8];
+  registers(record, now);
+  registers(last_, before);
+  for (unsigned int i = 0; i < 8; ++i) {
+    if (now[i] != before[i]) {
+      register_mask |= static_cast<byte_t>(1 << i);
+      *out++ = now[i];
+    }
+  }
+  if (record.sp != last_.sp) {
+    flags |= SP_CHANGED;
+    *out++ = static_cast<byte_t>(record.sp);
+    *out++ = static_cast<byte_t>(record.sp >> 8);
+  }
+
+  word_t pc_delta = static_cast<word_t>(record.pc - last_.pc);
+  out = put_varint(out, zigzag(pc_delta));
+  out = put_varint(out, record.cycles - last_.cycles);
+
+  if (pc_delta >= 1 && pc_delta <= 3 &&
+      std::memcmp(record.pcmem, last_.pcmem + pc_delta, 4 - pc_delta) == 0) {
+    flags |= PCMEM_SHIFTED;
+    for (unsigned int i = 4 - pc_delta; i < 4; ++i) {
+      *out++ = record.pcmem[i];
+    }
+  } else if (std::memcmp(record.pcmem, last_.pcmem, 4) != 0) {
+    flags |= PCMEM_FULL;
+    std::memcpy(out, record.pcmem, 4);
+    out += 4;
+  }
+
+  start[0] = register_mask;
+  start[1] = flags;
+  used_ += static_cast<std::size_t>(out - start);
+  last_ = record;
+  ++records_;
+}
+
+void TraceWriter::submit_() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  full_.emplace_back(std::move(buffer_), used_);
+  cv_.notify_all();
+  cv_.wait(lock, [this]() { return !free_.empty(); });
+  buffer_ = std::move(free_.back());
+  free_.pop_back();
+  used_ = 0;
+}
+
+void TraceWriter::run_() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this]() { return done_ || !full_.empty(); });
+    if (full_.empty()) {
+      return;
+    }
+    std::pair<std::vector<byte_t>, std::size_t> buffer =
+        std::move(full_.front());
+    full_.pop_front();
+
+    lock.unlock();
+    if (std::fwrite(buffer.first.data(), 1, buffer.second, file_) !=
+        buffer.second) {
+      log_error("[trace] write failed; the trace is incomplete");
+    }
+    lock.lock();
+
+    free_.push_back(std::move(buffer.first));
+    cv_.notify_all();
+  }
+}
+
+TraceReader::TraceReader(const std::string &filename)
+    : file_(std::fopen(filename.c_str(), "rb")),
+      buffer_(BUFFER_SIZE + 2 * MAX_RECORD_SIZE) {
+  if (file_ == nullptr) {
+    log_error("[trace] cannot open %s", filename.c_str());
+    return;
+  }
+  char magic[sizeof(MAGIC)];
+  byte_t version[4];
+  if (std::fread(magic, 1, sizeof(magic), file_) != sizeof(magic) ||
+      std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      std::fread(version, 1, sizeof(version), file_) != sizeof(version)) {
+    log_error("[trace] %s is not a trace", filename.c_str());
+    std::fclose(file_);
+    file_ = nullptr;
+  } else if (version[0] != VERSION) {
+    log_error("[trace] %s is a version %u trace; expected %u",
+              filename.c_str(), version[0], VERSION);
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+TraceReader::~TraceReader() {
+  if (file_ != nullptr) {
+    std::fclose(file_);
+  }
+}
+
+bool TraceReader::is_trace(const std::string &filename) {
+  std::FILE *file = std::fopen(filename.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  char magic[sizeof(MAGIC)];
+  bool is_trace = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                  std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+  std::fclose(file);
+  return is_trace;
+}
+
+void TraceReader::fill_() {
+  if (size_ - position_ >= MAX_RECORD_SIZE) {
+    return;
+  }
+  std::memmove(buffer_.data(), buffer_.data() + position_, size_ - position_);
+  size_ -= position_;
+  position_ = 0;
+  size_ += std::fread(buffer_.data() + size_, 1, BUFFER_SIZE - size_, file_);
+  // Past the end, a truncated record decodes as zeroes rather than garbage.
+  std::fill(buffer_.begin() + static_cast<std::ptrdiff_t>(size_),
+            buffer_.end(), 0);
+}
+
+std::uint64_t TraceReader::varint_() {
+  std::uint64_t value = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    byte_t byte = byte_();
+    value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      break;
+    }
+  }
+  return value;
+}
+
+bool TraceReader::next(TraceRecord &record) {
+  if (file_ == nullptr) {
+    return false;
+  }
+  fill_();
+  if (position_ == size_) {
+    return false;
+  }
+
+  record = last_;
+  byte_t register_mask = byte_();
+  byte_t flags = byte_();
+  byte_t *registers[8] = {&record.a, &record.f, &record.b, &record.c,
+                          &record.d, &record.e, &record.h, &record.l};
+  for (unsigned int i = 0; i < 8; ++i) {
+    if (register_mask & (1 << i)) {
+      *registers[i] = byte_();
+    }
+  }
+  if (flags & SP_CHANGED) {
+    byte_t low = byte_();
+    record.sp = static_cast<word_t>(low | (byte_() << 8));
+  }
+
+  word_t pc_delta = unzigzag(varint_());
+  record.pc = static_cast<word_t>(last_.pc + pc_delta);
+  record.cycles = last_.cycles + varint_();
+
+  if (flags & PCMEM_SHIFTED) {
+    if (pc_delta < 1 || pc_delta > 3) {
+      log_error("[trace] corrupt record after %llu cycles",
+                static_cast<unsigned long long>(last_.cycles));
+      position_ = size_;
+      return false;
+    }
+    std::memmove(record.pcmem, last_.pcmem + pc_delta, 4 - pc_delta);
+    for (unsigned int i = 4 - pc_delta; i < 4; ++i) {
+      record.pcmem[i] = byte_();
+    }
+  } else if (flags & PCMEM_FULL) {
+    for (byte_t &byte : record.pcmem) {
+      byte = byte_();
+    }
+  }
+
+  if (position_ > size_) {
+    log_warn("[trace] the trace ends in a truncated record");
+    position_ = size_;
+    return false;
+  }
+  last_ = record;
+  return true;
+}
+
+}  // namespace bugme
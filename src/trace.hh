@@ -0,0 +1,113 @@
+#ifndef BUGME_TRACE_HH
+#define BUGME_TRACE_HH
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "types.hh"
+
+namespace bugme {
+
+/** The CPU's state as an instruction is about to execute. */
+struct TraceRecord {
+  byte_t a = 0, f = 0, b = 0, c = 0, d = 0, e = 0, h = 0, l = 0;
+  word_t sp = 0;
+  word_t pc = 0;
+  /** T-cycles elapsed since power on. */
+  std::uint64_t cycles = 0;
+  /** The four bytes at pc: the instruction and whatever follows it. */
+  byte_t pcmem[4] = {};
+
+  /** \return Whether everything but cycles is equal. */
+  bool same_state(const TraceRecord &other) const;
+};
+
+/**
+ * Writes an execution trace: a record of the CPU's state before every
+ * instruction, in a compact binary format.
+ *
+ * Each record is stored as the difference from the one before it: a mask of
+ * the registers that changed and their new values, the change in pc and in
+ * cycles as variable-length integers, and only those bytes at pc which the
+ * previous record did not already hold. That comes to about seven bytes
+ * an instruction, against some seventy for a line of text.
+ *
+ * Encoding happens on the emulation thread, into large buffers which a
+ * background thread writes to disk. Nothing is dropped: if the disk falls
+ * behind, emulation waits for a buffer to come free.
+ *
+ * \see TraceReader
+ */
+class TraceWriter : public Noncopyable {
+ public:
+  explicit TraceWriter(const std::string &filename);
+  /** Writes out what is buffered, and closes the file. */
+  ~TraceWriter();
+
+  /** \return Whether the file could be opened. */
+  bool good() const { return file_ != nullptr; }
+
+  void record(const TraceRecord &record);
+
+  std::uint64_t records() const { return records_; }
+
+ private:
+  /** Hands the current buffer to the writer thread, and takes a free one. */
+  void submit_();
+  void run_();
+
+  std::FILE *file_;
+  TraceRecord last_;
+  std::uint64_t records_ = 0;
+
+  std::vector<byte_t> buffer_;
+  std::size_t used_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  /** Buffers waiting to be written, with how much of each is used. */
+  std::deque<std::pair<std::vector<byte_t>, std::size_t>> full_;
+  std::vector<std::vector<byte_t>> free_;
+  bool done_ = false;
+  std::thread thread_;
+};
+
+/** Reads back the traces TraceWriter writes. */
+class TraceReader : public Noncopyable {
+ public:
+  explicit TraceReader(const std::string &filename);
+  ~TraceReader();
+
+  /** \return Whether the file could be opened, and is a trace. */
+  bool good() const { return file_ != nullptr; }
+
+  /** \return false at the end of the trace. */
+  bool next(TraceRecord &record);
+
+  /** \return Whether filename starts like a trace. */
+  static bool is_trace(const std::string &filename);
+
+ private:
+  /** Makes sure at least the largest record is buffered, unless at EOF. */
+  void fill_();
+  byte_t byte_() { return buffer_[position_++]; }
+  std::uint64_t varint_();
+
+  std::FILE *file_;
+  TraceRecord last_;
+  std::vector<byte_t> buffer_;
+  std::size_t position_ = 0;
+  std::size_t size_ = 0;
+};
+
+}  // namespace bugme
+
+#endif
@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "log.hh"
+#include "trace.hh"
+
+namespace bugme {
+
+namespace {
+
+struct DiffOptions {
+  std::string trace;
+  /** A trace, or a gameboy-doctor log. If empty, the trace is printed. */
+  std::string reference;
+  /** Matching instructions shown before a divergence. */
+  unsigned int context = 8;
+  /** Skip the trace's boot ROM, up to where the reference starts. */
+  bool align = true;
+};
+
+/** Somewhere records come from. */
+class Source {
+ public:
+  virtual ~Source() = default;
+  virtual bool good() const = 0;
+  virtual bool next(TraceRecord &record) = 0;
+  /** \return Whether records carry cycle counts to compare. */
+  virtual bool has_cycles() const = 0;
+};
+
+class TraceSource : public Source {
+ public:
+  explicit TraceSource(const std::string &filename) : reader_(filename) {}
+  bool good() const override { return reader_.good(); }
+  bool next(TraceRecord &record) override { return reader_.next(record); }
+  bool has_cycles() const override { return true; }
+
+ private:
+  TraceReader reader_;
+};
+
+/**
+ * A log in the text format of gameboy-doctor, one instruction a line:
+ * A:01 F:B0 B:00 C:13 D:00 E:D8 H:01 L:4D SP:FFFE PC:0100 PCMEM:00,C3,13,02
+ */
+class DoctorSource : public Source {
+ public:
+  explicit DoctorSource(const std::string &filename)
+      : filename_(filename), file_(std::fopen(filename.c_str(), "r")) {
+    if (file_ == nullptr) {
+      log_error("[tracediff] cannot open %s", filename.c_str());
+    }
+  }
+  ~DoctorSource() override {
+    if (file_ != nullptr) {
+      std::fclose(file_);
+    }
+  }
+
+  bool good() const override { return file_ != nullptr; }
+  bool has_cycles() const override { return false; }
+
+  bool next(TraceRecord &record) override {
+    char line[256];
+    while (std::fgets(line, sizeof(line), file_) != nullptr) {
+      ++line_number_;
+      unsigned int v[14];
+      int fields = std::sscanf(
+          line,
+          " A:%x F:%x B:%x C:%x D:%x E:%x H:%x L:%x SP:%x PC:%x "
+          "PCMEM:%x,%x,%x,%x",
+          &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8],
+          &v[9], &v[10], &v[11], &v[12], &v[13]);
+      if (fields == EOF) {
+        continue;  // a blank line
+      }
+      if (fields != 14) {
+        log_error("[tracediff] %s:%lu is not a gameboy-doctor line",
+                  filename_.c_str(), line_number_);
+        std::exit(2);
+      }
+      record.a = static_cast<byte_t>(v[0]);
+      record.f = static_cast<byte_t>(v[1]);
+      record.b = static_cast<byte_t>(v[2]);
+      record.c = static_cast<byte_t>(v[3]);
+      record.d = static_cast<byte_t>(v[4]);
+      record.e = static_cast<byte_t>(v[5]);
+      record.h = static_cast<byte_t>(v[6]);
+      record.l = static_cast<byte_t>(v[7]);
+      record.sp = static_cast<word_t>(v[8]);
+      record.pc = static_cast<word_t>(v[9]);
+      for (unsigned int i = 0; i < 4; ++i) {
+        record.pcmem[i] = static_cast<byte_t>(v[10 + i]);
+      }
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  std::string filename_;
+  std::FILE *file_;
+  unsigned long line_number_ = 0;
+};
+
+std::string format(const TraceRecord &r) {
+  char line[96];
+  std::snprintf(line, sizeof(line),
+                "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X "
+                "SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X",
+                r.a, r.f, r.b, r.c, r.d, r.e, r.h, r.l, r.sp, r.pc,
+                r.pcmem[0], r.pcmem[1], r.pcmem[2], r.pcmem[3]);
+  return line;
+}
+
+/** \return The names of the fields which differ, space separated. */
+std::string differences(const TraceRecord &x, const TraceRecord &y,
+                        bool cycles) {
+  std::string out;
+  auto check = [&](bool differs, const char *name) {
+    if (differs) {
+      out += out.empty() ? "" : " ";
+      out += name;
+    }
+  };
+  check(x.a != y.a, "A");
+  check(x.f != y.f, "F");
+  check(x.b != y.b, "B");
+  check(x.c != y.c, "C");
+  check(x.d != y.d, "D");
+  check(x.e != y.e, "E");
+  check(x.h != y.h, "H");
+  check(x.l != y.l, "L");
+  check(x.sp != y.sp, "SP");
+  check(x.pc != y.pc, "PC");
+  check(!std::equal(x.pcmem, x.pcmem + 4, y.pcmem), "PCMEM");
+  check(cycles && x.cycles != y.cycles, "cycles");
+  return out;
+}
+
+int dump(const DiffOptions &options) {
+  TraceReader reader(options.trace);
+  if (!reader.good()) {
+    return 2;
+  }
+  TraceRecord record;
+  while (reader.next(record)) {
+    std::printf("%s\n", format(record).c_str());
+  }
+  return 0;
+}
+
+int diff(const DiffOptions &options) {
+  TraceReader trace(options.trace);
+  std::unique_ptr<Source> reference;
+  if (TraceReader::is_trace(options.reference)) {
+    reference = std::make_unique<TraceSource>(options.reference);
+  } else {
+    reference = std::make_unique<DoctorSource>(options.reference);
+  }
+  if (!trace.good() || !reference->good()) {
+    return 2;
+  }
+
+  TraceRecord ours, theirs;
+  if (!reference->next(theirs)) {
+    std::printf("the reference is empty\n");
+    return 0;
+  }
+  std::uint64_t skipped = 0;
+  bool more = trace.next(ours);
+  while (more && options.align && ours.pc != theirs.pc) {
+    ++skipped;
+    more = trace.next(ours);
+  }
+  if (!more) {
+    std::printf("the trace never reaches the reference's start, PC:%04X\n",
+                theirs.pc);
+    return 1;
+  }
+  if (skipped > 0) {
+    std::printf("skipped %llu instructions, to PC:%04X\n",
+                static_cast<unsigned long long>(skipped), theirs.pc);
+  }
+
+  // Timelines may start apart, e.g. past a boot ROM, so cycles are compared
+  // as elapsed since the first instruction.
+  const std::uint64_t our_start = ours.cycles;
+  const std::uint64_t their_start = theirs.cycles;
+  const bool cycles = reference->has_cycles();
+  // Formatted only on divergence: traces run to billions of instructions.
+  std::deque<TraceRecord> context;
+  std::uint64_t matched = 0;
+  while (more) {
+    TraceRecord ours_rel = ours, theirs_rel = theirs;
+    ours_rel.cycles -= our_start;
+    theirs_rel.cycles -= their_start;
+    std::string fields = differences(ours_rel, theirs_rel, cycles);
+    if (!fields.empty()) {
+      std::uint64_t index = skipped + matched - context.size();
+      for (const TraceRecord &record : context) {
+        std::printf("%12llu  %s\n", static_cast<unsigned long long>(index++),
+                    format(record).c_str());
+      }
+      std::printf(
+          "divergence at instruction %llu, cycle %llu, in %s\n"
+          "  trace:     %s\n  reference: %s\n",
+          static_cast<unsigned long long>(skipped + matched),
+          static_cast<unsigned long long>(ours.cycles), fields.c_str(),
+          format(ours).c_str(), format(theirs).c_str());
+      if (cycles) {
+        std::printf("  cycles:    %llu != %llu\n",
+                    static_cast<unsigned long long>(ours_rel.cycles),
+                    static_cast<unsigned long long>(theirs_rel.cycles));
+      }
+      return 1;
+    }
+
+    ++matched;
+    if (options.context > 0) {
+      if (context.size() == options.context) {
+        context.pop_front();
+      }
+      context.push_back(ours);
+    }
+    if (!reference->next(theirs)) {
+      std::printf("matched %llu instructions; the reference ends here\n",
+                  static_cast<unsigned long long>(matched));
+      return 0;
+    }
+    more = trace.next(ours);
+  }
+  // A truncated trace has not shown that the rest would match.
+  std::printf("matched %llu instructions; the trace ends first\n",
+              static_cast<unsigned long long>(matched));
+  return 1;
+}
+
+DiffOptions get_diff_options(int argc, char **argv) {
+  DiffOptions options;
+  std::vector<std::string> files;
+  std::vector<std::string> args(argv + 1, argv + argc);
+  for (unsigned int i = 0; i < args.size(); ++i) {
+    if (args[i] == "--context" && i + 1 < args.size()) {
+      options.context =
+          static_cast<unsigned int>(std::max(0, std::atoi(args[++i].c_str())));
+    } else if (args[i] == "--no-align") {
+      options.align = false;
+    } else {
+      files.push_back(args[i]);
+    }
+  }
+  if (files.empty() || files.size() > 2) {
+    log_error(
+        "usage: bugme-tracediff <trace> [reference] [--context n] "
+        "[--no-align]");
+    std::exit(2);
+  }
+  options.trace = files[0];
+  if (files.size() == 2) {
+    options.reference = files[1];
+  }
+  return options;
+}
+
+}  // namespace
+
+int tracediff_main(int argc, char **argv) {
+  log_set_level(LogLevel::Warning);
+  DiffOptions options = get_diff_options(argc, argv);
+  return options.reference.empty() ? dump(options) : diff(options);
+}
+
+}  // namespace bugme
+
+int main(int argc, char **argv) { return bugme::tracediff_main(argc, argv); }
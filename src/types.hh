@@ -23,10 +23,6 @@ class Noncopyable {
   Noncopyable &operator=(const Noncopyable &) = delete;
 };
 
-class Debuggable {
-  friend class Debug;
-};
-
 }  // namespace bugme
 
 #endif
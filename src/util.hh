@@ -1,6 +1,14 @@
 #ifndef BUGME_UTIL_HH
 #define BUGME_UTIL_HH
 
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #include "types.hh"
 
 namespace bugme {
@@ -34,6 +42,63 @@ inline bool in_range(word_t n, word_t low, word_t high) {
 }
 
 inline bool get_bit(byte_t n, bit_t bit) { return ((n >> bit) & 0x1); }
+
+/**
+ * Reads a whole file.
+ *
+ * \return false if the file cannot be read, in which case contents is left
+ *         unspecified.
+ */
+inline bool read_file(const std::string &filename,
+                      std::vector<byte_t> &contents) {
+  std::ifstream s(filename, std::ios_base::binary | std::ios_base::ate);
+  if (!s.good()) {
+    return false;
+  }
+  contents.resize(static_cast<std::size_t>(s.tellg()));
+  s.seekg(0, std::ios::beg);
+  s.read(reinterpret_cast<char *>(contents.data()),
+         static_cast<std::streamsize>(contents.size()));
+  return s.good();
+}
+
+/** \return The 64-bit FNV-1a hash of size bytes at data. */
+inline std::uint64_t fnv1a(const byte_t *data, std::size_t size) {
+  std::uint64_t hash = 0xCBF29CE484222325;
+  for (std::size_t i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001B3;
+  }
+  return hash;
+}
+
+template <class Signature>
+class FunctionRef;
+
+/**
+ * A reference to a callable, for callbacks on hot paths: unlike
+ * std::function, it neither allocates nor copies the callable, and calls it
+ * through a plain function pointer, within which the callable is inlined.
+ * The callable must outlive the reference, so only lvalues bind to it.
+ */
+template <class R, class... Args>
+class FunctionRef<R(Args...)> {
+ public:
+  template <class F>
+    requires(!std::is_same_v<std::remove_cv_t<F>, FunctionRef>)
+  FunctionRef(F &callable)
+      : object_(const_cast<void *>(static_cast<const void *>(&callable))),
+        call_([](void *object, Args... args) -> R {
+          return (*static_cast<F *>(object))(std::forward<Args>(args)...);
+        }) {}
+
+  R operator()(Args... args) const {
+    return call_(object_, std::forward<Args>(args)...);
+  }
+
+ private:
+  void *object_;
+  R (*call_)(void *, Args...);
+};
 }  // namespace util
 }  // namespace bugme
 #endif